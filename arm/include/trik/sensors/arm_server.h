@@ -13,8 +13,13 @@ int trik_init_arm_server(uint16_t rproc_id);
 int trik_destroy_arm_server(void);
 
 void* trik_start_arm_server(void* _arg);
-int trik_req_step(struct trik_cv_algorithm_out_args* out_args, struct trik_cv_algorithm_in_args in_args);
-int trik_req_cv_algorithm(RuntimeConfig r_config, uint32_t line_length);
+/*
+  out_args are indexed by algorithm, only those of the requested set are filled; stats are filled if in_args request them,
+  jpeg_size is that of the preview JPEG in the DSP buffer, 0 unless in_args request it
+*/
+int trik_req_step(struct trik_cv_algorithm_out_args out_args[TRIK_CV_ALGORITHM_COUNT], struct trik_frame_stats* stats, uint32_t* jpeg_size,
+  struct trik_cv_algorithm_in_args in_args);
+int trik_req_cv_algorithm(RuntimeConfig r_config, uint32_t width, uint32_t height, uint32_t line_length);
 #ifdef __cplusplus
 }
 #endif
@@ -2,6 +2,9 @@
 #define TRIK_V4L2_DSP_FB_INTERNAL_MODULE_FB_H_
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 
 #include <linux/fb.h>
 
@@ -16,12 +19,27 @@ typedef struct FBConfig // what user wants to set
   const char* m_path;
 } FBConfig;
 
+/*
+  Display is double buffered when the virtual resolution can hold two screens: frames are
+  written to the page not shown and flipped to with FBIOPAN_DISPLAY, which takes effect at the
+  next vertical blank. Flip does not wait for it; the page shown before is waited for only when
+  it is about to be written again less than a refresh period after the flip, so writes never
+  race scan-out. Otherwise the only page is written.
+*/
 typedef struct FBOutput {
   int m_fd;
   struct fb_fix_screeninfo m_fbFixInfo;
   struct fb_var_screeninfo m_fbVarInfo;
+  struct fb_var_screeninfo m_fbVarInfoOrig; // restored on close
   void* m_fbPtr;
   size_t m_fbSize;
+  size_t m_pageSize;
+  uint32_t m_pageCount;
+  uint32_t m_backPage;
+  bool m_waitVsync; // cleared if the driver cannot wait for vertical blank
+  bool m_flipPending;
+  struct timespec m_flipTime;
+  uint32_t m_refreshUs; // 0 if the mode does not tell its pixel clock
 } FBOutput;
 
 int fbOutputInit(bool _verbose);
@@ -31,8 +49,12 @@ int fbOutputOpen(FBOutput* _fb, const FBConfig* _config);
 int fbOutputClose(FBOutput* _fb);
 int fbOutputStart(FBOutput* _fb);
 int fbOutputStop(FBOutput* _fb);
+// page to write the next frame to
 int fbOutputGetFrame(FBOutput* _fb, void** _framePtr, size_t* _frameSize);
+// shows the page written, the next frame goes to the other one
 int fbOutputPutFrame(FBOutput* _fb);
+// draws RGB565 image, red in the top bits, into the page at top left, in the format and stride of the display
+int fbOutputCopyRgb565(FBOutput* _fb, void* _framePtr, const void* _rgb565Ptr, uint32_t _width, uint32_t _height, uint32_t _lineLength);
 
 int fbOutputGetFormat(FBOutput* _fb, ImageDescription* _imageDesc);
 
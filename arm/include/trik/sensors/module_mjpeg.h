@@ -0,0 +1,58 @@
+#ifndef TRIK_V4L2_DSP_FB_INTERNAL_MODULE_MJPEG_H_
+#define TRIK_V4L2_DSP_FB_INTERNAL_MODULE_MJPEG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "trik/sensors/common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#define MJPEG_CLIENTS_MAX 4
+
+typedef struct MJPEGConfig // what user wants to set
+{
+  const char* m_path; // unix socket, NULL for none
+  int m_port;         // tcp port, 0 for none
+  int m_decimation;   // every n-th frame is streamed
+  int m_quality;      // [1..100] JPEG quality
+} MJPEGConfig;
+
+/*
+  Preview JPEGs encoded on the DSP served as an HTTP multipart/x-mixed-replace stream,
+  which browsers and players show as MJPEG. Stream is optional, with neither socket set
+  the output stays closed and never asks for frames.
+  Client sockets never block the video thread: the part of a frame a client cannot take at once
+  is sent on the following frames, a client still behind when the next one is streamed is dropped.
+*/
+typedef struct MJPEGOutput {
+  int m_listenFd;
+  int m_clientFds[MJPEG_CLIENTS_MAX];
+  size_t m_clientSent[MJPEG_CLIENTS_MAX]; // bytes of the stored frame the client has taken
+  char* m_frame;                          // boundary, headers, JPEG and trailer of the last streamed frame
+  size_t m_frameSize;
+  const char* m_path; // unlinked on close
+  int m_decimation;
+  int m_quality;
+  unsigned m_frameCount;
+} MJPEGOutput;
+
+int mjpegOutputInit(bool _verbose);
+int mjpegOutputFini();
+
+int mjpegOutputOpen(MJPEGOutput* _mjpeg, const MJPEGConfig* _config);
+int mjpegOutputClose(MJPEGOutput* _mjpeg);
+int mjpegOutputStart(MJPEGOutput* _mjpeg);
+int mjpegOutputStop(MJPEGOutput* _mjpeg);
+// accepts new clients, _quality is the one to encode the preview of this frame with, 0 if it is not streamed
+int mjpegOutputGetFrame(MJPEGOutput* _mjpeg, int* _quality);
+// queues the JPEG for every client, clients which have not taken the previous one yet are dropped
+int mjpegOutputPutFrame(MJPEGOutput* _mjpeg, const void* _jpegPtr, size_t _jpegSize);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif // __cplusplus
+
+#endif // !TRIK_V4L2_DSP_FB_INTERNAL_MODULE_MJPEG_H_
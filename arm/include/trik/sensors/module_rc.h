@@ -15,12 +15,18 @@ typedef struct RCConfig // what user wants to set
   const char* m_fifoInput;
   const char* m_fifoOutput;
   enum trik_cv_algorithm m_sensorType;
+  uint32_t m_secondarySensors; // TRIK_CV_ALGORITHM_BIT mask of sensors run on the same frames after m_sensorType
   bool m_videoOutEnable;
   union {
     MxnParams   m_mxnParams;
   } m_extraParams;
 } RCConfig;
 
+typedef struct SensorSet {
+  enum trik_cv_algorithm m_sensorType;
+  uint32_t m_secondarySensors; // TRIK_CV_ALGORITHM_BIT mask, as in RCConfig
+} SensorSet;
+
 typedef struct MxnParamsInput
 {
   MxnParams   m_mxnParams;
@@ -50,6 +56,18 @@ typedef struct RCInput {
 
   bool m_videoOutParamsUpdated;
   bool m_videoOutEnable;
+
+  bool m_roiParamsUpdated;
+  RoiParams m_roiParams;
+
+  bool m_decimationUpdated;
+  int m_decimation;
+
+  bool m_morphologyUpdated;
+  int m_morphology;
+
+  bool m_sensorSetUpdated;
+  SensorSet m_sensorSet;
   union {
     MxnParamsInput m_mxnParamsInput;
   } m_extraRCInput;
@@ -69,8 +87,20 @@ int rcInputGetTargetDetectParams(RCInput* _rc, trik_cv_algorithm_in_args* _targe
 int rcInputGetTargetDetectCommand(RCInput* _rc, TargetDetectCommand* _targetDetectCommand);
 int rcInputGetMxNParams(RCInput* _rc, MxnParams* mxnParams);
 int rcInputGetVideoOutParams(RCInput* _rc, bool* _videoOutEnable);
-
-int rcInputUnsafeReportTargetLocation(RCInput* _rc, const TargetLocation* _targetLocation);
+int rcInputGetRoiParams(RCInput* _rc, RoiParams* _roiParams);
+int rcInputGetDecimation(RCInput* _rc, int* _decimation);
+int rcInputGetMorphology(RCInput* _rc, int* _morphology);
+int rcInputGetSensorSet(RCInput* _rc, SensorSet* _sensorSet);
+
+/*
+  Comma separated list of sensors run on the same frames, the first one draws the preview.
+  Returns false on unknown or repeated sensor.
+*/
+bool trik_cv_algorithms_from_string(char* string, enum trik_cv_algorithm* primary, uint32_t* secondary);
+const char* trik_cv_algorithm_to_string(enum trik_cv_algorithm algorithm);
+
+// writes already formatted report lines to the output fifo
+int rcInputUnsafeReport(RCInput* _rc, const char* _report);
 int rcInputUnsafeReportTargetColors(RCInput* _rc, const TargetColors* _targetColors);
 int rcInputUnsafeReportTargetDetectParams(RCInput* _rc, const trik_cv_algorithm_out_args* _targetDetectParams);
 
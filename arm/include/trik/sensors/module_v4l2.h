@@ -5,6 +5,7 @@
 #include <stdbool.h>
 
 #include "trik/sensors/common.h"
+#include "trik/sensors/cv_algorithm_args.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +17,7 @@ typedef struct V4L2Config // what user wants to set
   size_t m_width;
   size_t m_height;
   uint32_t m_format;
+  int m_exposureTarget; // mean luma to keep by exposure and gain, 0 leaves them to the camera
 } V4L2Config;
 
 typedef struct V4L2Input {
@@ -25,6 +27,14 @@ typedef struct V4L2Input {
 
   void* m_buffers[3];
   size_t m_bufferSize[3];
+
+  // manual exposure control, controls with zero id are not supported by the camera
+  int m_exposureTarget;
+  int m_exposureSettle; // frames to skip until the last change shows up
+  struct v4l2_queryctrl m_exposureCtrl;
+  struct v4l2_queryctrl m_gainCtrl;
+  int32_t m_exposure;
+  int32_t m_gain;
 } V4L2Input;
 
 int v4l2InputInit(bool _verbose);
@@ -41,6 +51,9 @@ int v4l2InputGetFormat(V4L2Input* _v4l2, ImageDescription* _imageDesc);
 
 int v4l2InputReportFPS(V4L2Input* _v4l2, long long _ms);
 
+// Steers exposure and gain towards the target by statistics of a processed frame
+int v4l2InputControlExposure(V4L2Input* _v4l2, const struct trik_frame_stats* _stats);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif // __cplusplus
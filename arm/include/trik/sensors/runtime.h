@@ -5,6 +5,7 @@
 
 #include "trik/sensors/common.h"
 #include "trik/sensors/module_fb.h"
+#include "trik/sensors/module_mjpeg.h"
 #include "trik/sensors/module_rc.h"
 #include "trik/sensors/module_v4l2.h"
 
@@ -18,17 +19,20 @@ typedef struct RuntimeConfig {
 
   V4L2Config m_v4l2Config;
   FBConfig m_fbConfig;
+  MJPEGConfig m_mjpegConfig;
   RCConfig m_rcConfig;
 } RuntimeConfig;
 
 typedef struct DSP {
   struct buffer* dsp_in_buf;
   struct buffer* dsp_out_buf;
+  struct buffer* dsp_jpeg_buf;
 } DSP;
 
 typedef struct RuntimeModules {
   V4L2Input m_v4l2Input;
   FBOutput m_fbOutput;
+  MJPEGOutput m_mjpegOutput;
   RCInput m_rcInput;
   DSP m_dsp;
 } RuntimeModules;
@@ -45,6 +49,11 @@ typedef struct RuntimeState {
   trik_cv_algorithm_in_args m_targetDetectParams;
   TargetDetectCommand m_targetDetectCommand;
   bool m_videoOutEnable;
+  RoiParams m_roiParams;
+  int m_decimation;
+  int m_morphology;
+  bool m_sensorSetUpdated;
+  SensorSet m_sensorSet;
 
   union {
     MxnParams   m_mxnParams;
@@ -71,10 +80,12 @@ int runtimeStop(Runtime* _runtime);
 bool runtimeCfgVerbose(const Runtime* _runtime);
 const V4L2Config* runtimeCfgV4L2Input(const Runtime* _runtime);
 const FBConfig* runtimeCfgFBOutput(const Runtime* _runtime);
+const MJPEGConfig* runtimeCfgMJPEGOutput(const Runtime* _runtime);
 const RCConfig* runtimeCfgRCInput(const Runtime* _runtime);
 
 V4L2Input* runtimeModV4L2Input(Runtime* _runtime);
 FBOutput* runtimeModFBOutput(Runtime* _runtime);
+MJPEGOutput* runtimeModMJPEGOutput(Runtime* _runtime);
 RCInput* runtimeModRCInput(Runtime* _runtime);
 
 bool runtimeGetTerminate(Runtime* _runtime);
@@ -87,9 +98,25 @@ int runtimeSetMxNParams(Runtime* _runtime, MxnParams* mxnParams);
 
 int runtimeGetVideoOutParams(Runtime* _runtime, bool* _videoOutEnable);
 int runtimeSetVideoOutParams(Runtime* _runtime, const bool* _videoOutEnable);
-
+int runtimeGetRoiParams(Runtime* _runtime, RoiParams* _roiParams);
+int runtimeSetRoiParams(Runtime* _runtime, const RoiParams* _roiParams);
+int runtimeGetDecimation(Runtime* _runtime, int* _decimation);
+int runtimeSetDecimation(Runtime* _runtime, const int* _decimation);
+int runtimeGetMorphology(Runtime* _runtime, int* _morphology);
+int runtimeSetMorphology(Runtime* _runtime, const int* _morphology);
+// returns ENODATA unless a new set of sensors was requested since the last fetch
+int runtimeFetchSensorSet(Runtime* _runtime, SensorSet* _sensorSet);
+int runtimeSetSensorSet(Runtime* _runtime, const SensorSet* _sensorSet);
+// set of sensors the DSP runs, kept in the rc config
+int runtimeGetRunningSensorSet(Runtime* _runtime, SensorSet* _sensorSet);
+int runtimeSetRunningSensorSet(Runtime* _runtime, const SensorSet* _sensorSet);
+
+// starts reports of one sensor of a set, the ones following belong to it
+int runtimeReportSensor(Runtime* _runtime, enum trik_cv_algorithm _sensor);
 int runtimeReportTargetLocation(Runtime* _runtime, const TargetLocation* _targetLocation);
 int runtimeReportTargetColors(Runtime* _runtime, const TargetColors* _targetColors);
+int runtimeReportTargetLines(Runtime* _runtime, const TargetLine* _targetLines);
+int runtimeReportTargetObjects(Runtime* _runtime, const trik_cv_algorithm_out_target* _targets);
 int runtimeGetMxnParams(Runtime* _runtime, MxnParams* _mxnParams);
 int runtimeReportTargetDetectParams(Runtime* _runtime, const trik_cv_algorithm_out_args* _targetDetectParams);
 
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -173,12 +174,12 @@ static int trik_drain_pipeline() {
   return 0;
 }
 
-static int8_t* trik_get_ptr_for_phys_addr(void* addr) {
+static int8_t* trik_get_ptr_for_phys_addr(void* addr, size_t size) {
   uint32_t page_base = ((uint32_t) addr) / PAGE_SIZE * PAGE_SIZE;
   uint32_t page_offset = ((uint32_t) addr) - page_base;
 
   int memfd = open("/dev/mem", O_RDWR | O_SYNC);
-  int8_t* mapped_start = mmap(0, page_offset + BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, page_base);
+  int8_t* mapped_start = mmap(0, page_offset + size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, page_base);
 
   if (mapped_start == MAP_FAILED)
     return NULL;
@@ -186,7 +187,7 @@ static int8_t* trik_get_ptr_for_phys_addr(void* addr) {
   return (int8_t*) (((uint32_t) mapped_start) + page_offset);
 }
 
-static int trik_req_init(struct buffer* dsp_in_buf, struct buffer* dsp_out_buf) {
+static int trik_req_init(struct buffer* dsp_in_buf, struct buffer* dsp_out_buf, struct buffer* dsp_jpeg_buf) {
   if (trik_send_cmd(TRIK_CMD_INIT) < 0)
     return -1;
 
@@ -195,17 +196,23 @@ static int trik_req_init(struct buffer* dsp_in_buf, struct buffer* dsp_out_buf)
     return -1;
 
   int retval = 0;
-  if ((dsp_in_buf->start = trik_get_ptr_for_phys_addr(res->dsp_in_buffer)) == NULL) {
+  if ((dsp_in_buf->start = trik_get_ptr_for_phys_addr(res->dsp_in_buffer, BUFFER_SIZE)) == NULL) {
     retval = -1;
     goto cleanup;
   }
   dsp_in_buf->length = BUFFER_SIZE;
 
-  if ((dsp_out_buf->start = trik_get_ptr_for_phys_addr(res->dsp_out_buffer)) == NULL) {
+  if ((dsp_out_buf->start = trik_get_ptr_for_phys_addr(res->dsp_out_buffer, PREVIEW_BUFFER_SIZE)) == NULL) {
     retval = -1;
     goto cleanup;
   }
-  dsp_out_buf->length = BUFFER_SIZE;
+  dsp_out_buf->length = PREVIEW_BUFFER_SIZE;
+
+  if ((dsp_jpeg_buf->start = trik_get_ptr_for_phys_addr(res->dsp_jpeg_buffer, PREVIEW_JPEG_BUFFER_SIZE)) == NULL) {
+    retval = -1;
+    goto cleanup;
+  }
+  dsp_jpeg_buf->length = PREVIEW_JPEG_BUFFER_SIZE;
 
 cleanup:
   trik_destroy_msg(res);
@@ -217,20 +224,39 @@ static enum VideoFormat trik_get_video_format(uint32_t video_format) {
     return YUV422;
   else if (video_format == V4L2_PIX_FMT_NV16)
     return NV16;
+  // converted on DSP before sensors run
+  else if (video_format == V4L2_PIX_FMT_YUV422P)
+    return YUV422P;
+  else if (video_format == V4L2_PIX_FMT_YUV32)
+    return YUV444;
+  else if (video_format == V4L2_PIX_FMT_RGB565)
+    return RGB565;
+  else if (video_format == V4L2_PIX_FMT_RGB565X)
+    return RGB565X;
+  else if (video_format == V4L2_PIX_FMT_RGB24)
+    return RGB888;
   else
     return Unknown;
 }
 
 
-int trik_req_cv_algorithm(RuntimeConfig r_config, uint32_t line_length) {
+int trik_req_cv_algorithm(RuntimeConfig r_config, uint32_t width, uint32_t height, uint32_t line_length) {
   enum trik_cmd cmd = trik_cmd_from_cv_algorithm(r_config.m_rcConfig.m_sensorType);
   if (cmd == TRIK_CMD_NOP)
     return -1;
 
+  if (!trik_is_supported_frame_size(width, height)) {
+    errorf("unsupported frame size %ux%u, use 160x120, 320x240 or 640x480", width, height);
+    return -1;
+  }
+
   struct trik_req_cv_algorithm_msg* req = (struct trik_req_cv_algorithm_msg*) trik_create_msg(cmd);
 
   req->video_format = trik_get_video_format(r_config.m_v4l2Config.m_format);
+  req->width = width;
+  req->height = height;
   req->line_length = line_length;
+  req->secondary = r_config.m_rcConfig.m_secondarySensors;
 
   if (!req->video_format) {
     errorf("unknown video format, check if we support formats other than yuyv422 and nv16");
@@ -240,12 +266,24 @@ int trik_req_cv_algorithm(RuntimeConfig r_config, uint32_t line_length) {
   if (trik_send_msg((struct trik_msg*) req) < 0)
     return -1;
 
-  if (trik_wait_for_cmd(cmd) < 0)
+  struct trik_req_cv_algorithm_msg* res;
+  if (trik_wait_for_msg((struct trik_msg**) &res) < 0)
     return -1;
+  if (res->header.cmd != cmd) {
+    // DSP keeps the current set of sensors running if it cannot switch to the requested one, unless the frame geometry changed too
+    if (res->header.cmd == TRIK_CMD_NOP)
+      errorf("DSP rejected sensor set %d with %x", r_config.m_rcConfig.m_sensorType, r_config.m_rcConfig.m_secondarySensors);
+    trik_destroy_msg(res);
+    return -1;
+  }
+
+  infof("DSP arena: %u bytes used, high-water %u of %u", res->arena_used, res->arena_high_water, res->arena_size);
+  trik_destroy_msg(res);
   return 0;
 }
 
-int trik_req_step(struct trik_cv_algorithm_out_args* out_args, struct trik_cv_algorithm_in_args in_args) {
+int trik_req_step(struct trik_cv_algorithm_out_args out_args[TRIK_CV_ALGORITHM_COUNT], struct trik_frame_stats* stats, uint32_t* jpeg_size,
+  struct trik_cv_algorithm_in_args in_args) {
   struct trik_res_step_msg* req = (struct trik_res_step_msg*) trik_create_msg(TRIK_CMD_STEP);
   // if (trik_send_cmd(TRIK_CMD_STEP) < 0)
   //   return -1;
@@ -254,13 +292,37 @@ int trik_req_step(struct trik_cv_algorithm_out_args* out_args, struct trik_cv_al
   if (trik_send_msg((struct trik_msg*) req) < 0)
     return -1;
 
-  struct trik_res_step_msg* res;
-  if (trik_wait_for_msg((struct trik_msg**) &res) < 0)
-    return -1;
-
-  *out_args = res->out_args;
+  // primary algorithm replies first, then every secondary one, each with its own message
+  uint32_t pending;
+  bool primary = true;
+  do {
+    struct trik_res_step_msg* res;
+    if (trik_wait_for_msg((struct trik_msg**) &res) < 0)
+      return -1;
+    if (res->header.cmd != TRIK_CMD_STEP || res->algorithm < TRIK_CV_ALGORITHM_NONE || res->algorithm >= TRIK_CV_ALGORITHM_COUNT) {
+      trik_destroy_msg(res);
+      return -1;
+    }
+
+    // DSP left with no sensor selected replies for none, with empty out args
+    if (res->algorithm != TRIK_CV_ALGORITHM_NONE)
+      out_args[res->algorithm] = res->out_args;
+    // only the reply of the primary algorithm carries statistics of the frame and the preview JPEG
+    if (primary && stats != NULL) {
+      *stats = res->stats;
+      debugf("DSP frame luma mean %u, 5%% %u, median %u, 95%% %u of %u samples", stats->luma_mean, stats->luma_low, stats->luma_median, stats->luma_high,
+        stats->samples);
+    }
+    if (primary && jpeg_size != NULL)
+      *jpeg_size = res->jpeg_size;
+    primary = false;
+    debugf("DSP step cycles of %d: invalidate %u, run %u, jpeg %u, write back %u of %u bytes", res->algorithm, res->timings.cache_inv, res->timings.run,
+      res->timings.jpeg, res->timings.cache_wb, res->timings.wb_bytes);
+
+    pending = res->pending;
+    trik_destroy_msg(res);
+  } while (pending > 0);
 
-  trik_destroy_msg(res);
   return 0;
 }
 
@@ -354,13 +416,14 @@ void* trik_start_arm_server(void* _arg) {
 
   struct buffer dsp_in_buf;
   struct buffer dsp_out_buf;
+  struct buffer dsp_jpeg_buf;
   if (runtime->m_config.m_configFile) {
     if (trik_read_cv_algorithm_in_args_from_file(runtime->m_config.m_configFile, &(runtime->m_state.m_targetDetectParams)) < 0)
       warnf("failed to read config from '%s', using fallback", runtime->m_config.m_configFile);
     else
       debugf("sucessfully loaded config file '%s'", runtime->m_config.m_configFile);
   }
-  if ((res = trik_req_init(&dsp_in_buf, &dsp_out_buf)) < 0) {
+  if ((res = trik_req_init(&dsp_in_buf, &dsp_out_buf, &dsp_jpeg_buf)) < 0) {
     errorf("failed to recieve image buffer %d", res);
     exit_code = res;
     goto destroy_arm_server;
@@ -368,6 +431,7 @@ void* trik_start_arm_server(void* _arg) {
   debugf("successully recieved image bufs");
   runtime->m_modules.m_dsp.dsp_in_buf = &dsp_in_buf;
   runtime->m_modules.m_dsp.dsp_out_buf = &dsp_out_buf;
+  runtime->m_modules.m_dsp.dsp_jpeg_buf = &dsp_jpeg_buf;
 
   if ((res = threadVideo(runtime)) != 0) {
     errorf("failed to threadVideo %d", res);
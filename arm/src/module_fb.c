@@ -8,6 +8,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <linux/videodev2.h> // pixel formats
@@ -45,6 +46,13 @@ static int do_fbOutputClose(FBOutput* _fb) {
   return 0;
 }
 
+// Refresh period of the mode, pixel clock is in picoseconds
+static uint32_t do_fbOutputRefreshUs(const struct fb_var_screeninfo* _varInfo) {
+  const uint64_t lineClocks = _varInfo->xres + _varInfo->left_margin + _varInfo->right_margin + _varInfo->hsync_len;
+  const uint64_t frameLines = _varInfo->yres + _varInfo->upper_margin + _varInfo->lower_margin + _varInfo->vsync_len;
+  return (uint32_t) ((uint64_t) _varInfo->pixclock * lineClocks * frameLines / 1000000);
+}
+
 static int do_fbOutputSetFormat(FBOutput* _fb) {
   int res;
 
@@ -65,6 +73,45 @@ static int do_fbOutputSetFormat(FBOutput* _fb) {
     fprintf(stderr, "ioctl(FBIOGET_VSCREENINFO) failed: %d\n", res);
     return res;
   }
+  _fb->m_fbVarInfoOrig = _fb->m_fbVarInfo;
+
+  switch (_fb->m_fbVarInfo.bits_per_pixel) {
+  case 16:
+  case 24:
+  case 32:
+    break;
+  default:
+    fprintf(stderr, "Framebuffer of %u bits per pixel is not supported\n", _fb->m_fbVarInfo.bits_per_pixel);
+    return ENOTSUP;
+  }
+
+  // second screen below the shown one, driver reallocates memory for it if it can
+  if (_fb->m_fbVarInfo.yres_virtual < 2 * _fb->m_fbVarInfo.yres) {
+    struct fb_var_screeninfo varInfo = _fb->m_fbVarInfo;
+    varInfo.yres_virtual = 2 * varInfo.yres;
+    varInfo.xoffset = 0;
+    varInfo.yoffset = 0;
+    if (ioctl(_fb->m_fd, FBIOPUT_VSCREENINFO, &varInfo) != 0)
+      fprintf(stderr, "ioctl(FBIOPUT_VSCREENINFO) failed: %d, display is not double buffered\n", errno);
+    else if (ioctl(_fb->m_fd, FBIOGET_FSCREENINFO, &_fb->m_fbFixInfo) != 0 || ioctl(_fb->m_fd, FBIOGET_VSCREENINFO, &_fb->m_fbVarInfo) != 0) {
+      res = errno;
+      fprintf(stderr, "ioctl(FBIOGET_SCREENINFO) failed: %d\n", res);
+      return res;
+    }
+  }
+
+  _fb->m_pageSize = (size_t) _fb->m_fbFixInfo.line_length * _fb->m_fbVarInfo.yres;
+  if (_fb->m_fbVarInfo.yres_virtual >= 2 * _fb->m_fbVarInfo.yres && _fb->m_fbFixInfo.smem_len >= 2 * _fb->m_pageSize
+      && _fb->m_fbFixInfo.ypanstep != 0) {
+    _fb->m_pageCount = 2;
+    _fb->m_backPage = _fb->m_fbVarInfo.yoffset < _fb->m_fbVarInfo.yres ? 1 : 0;
+  } else {
+    _fb->m_pageCount = 1;
+    _fb->m_backPage = 0;
+  }
+  _fb->m_waitVsync = true;
+  _fb->m_flipPending = false;
+  _fb->m_refreshUs = do_fbOutputRefreshUs(&_fb->m_fbVarInfo);
 
   return 0;
 }
@@ -73,6 +120,18 @@ static int do_fbOutputUnsetFormat(FBOutput* _fb) {
   if (_fb == NULL)
     return EINVAL;
 
+  // console expects the resolution and page it had
+  if (_fb->m_fbVarInfoOrig.yres_virtual != _fb->m_fbVarInfo.yres_virtual
+      && ioctl(_fb->m_fd, FBIOPUT_VSCREENINFO, &_fb->m_fbVarInfoOrig) != 0)
+    fprintf(stderr, "ioctl(FBIOPUT_VSCREENINFO) failed: %d\n", errno);
+  else if (_fb->m_fbVarInfoOrig.yoffset != _fb->m_fbVarInfo.yoffset
+           && ioctl(_fb->m_fd, FBIOPAN_DISPLAY, &_fb->m_fbVarInfoOrig) != 0)
+    fprintf(stderr, "ioctl(FBIOPAN_DISPLAY) failed: %d\n", errno);
+
+  _fb->m_pageSize = 0;
+  _fb->m_pageCount = 0;
+  _fb->m_backPage = 0;
+  _fb->m_flipPending = false;
   memset(&_fb->m_fbFixInfo, 0, sizeof(_fb->m_fbFixInfo));
   memset(&_fb->m_fbVarInfo, 0, sizeof(_fb->m_fbVarInfo));
 
@@ -83,13 +142,27 @@ static int do_fbOutputGetFormat(FBOutput* _fb, ImageDescription* _imageDesc) {
   if (_fb == NULL || _imageDesc == NULL)
     return EINVAL;
 
-  _imageDesc->m_width = _fb->m_fbVarInfo.xres;
-  _imageDesc->m_height = _fb->m_fbVarInfo.yres;
+  const struct fb_var_screeninfo* varInfo = &_fb->m_fbVarInfo;
+  _imageDesc->m_width = varInfo->xres;
+  _imageDesc->m_height = varInfo->yres;
   _imageDesc->m_lineLength = _fb->m_fbFixInfo.line_length;
-  _imageDesc->m_imageSize = _fb->m_fbFixInfo.smem_len;
-
-#warning TODO check and get framebuffer format!
-  _imageDesc->m_format = V4L2_PIX_FMT_RGB565X;
+  _imageDesc->m_imageSize = _fb->m_pageSize;
+
+  // formats of little endian pixels, others are still drawn by fbOutputCopyRgb565 from the bitfields
+  switch (varInfo->bits_per_pixel) {
+  case 16:
+    _imageDesc->m_format = varInfo->red.offset == 11 && varInfo->green.length == 6 ? V4L2_PIX_FMT_RGB565 : 0;
+    break;
+  case 24:
+    _imageDesc->m_format = varInfo->red.offset == 16 ? V4L2_PIX_FMT_BGR24 : V4L2_PIX_FMT_RGB24;
+    break;
+  case 32:
+    _imageDesc->m_format = varInfo->red.offset == 16 ? V4L2_PIX_FMT_BGR32 : V4L2_PIX_FMT_RGB32;
+    break;
+  default:
+    _imageDesc->m_format = 0;
+    break;
+  }
 
   return 0;
 }
@@ -132,8 +205,105 @@ static int do_fbOutputGetFrame(FBOutput* _fb, void** _framePtr, size_t* _frameSi
   if (_fb->m_fbPtr == NULL)
     return ENOTCONN;
 
-  *_framePtr = _fb->m_fbPtr;
-  *_frameSize = _fb->m_fbSize;
+  *_framePtr = (uint8_t*) _fb->m_fbPtr + _fb->m_backPage * _fb->m_pageSize;
+  *_frameSize = _fb->m_pageSize;
+
+  return 0;
+}
+
+static int do_fbOutputFlip(FBOutput* _fb) {
+  int res;
+
+  if (_fb->m_pageCount < 2)
+    return 0;
+
+  struct fb_var_screeninfo varInfo = _fb->m_fbVarInfo;
+  varInfo.xoffset = 0;
+  varInfo.yoffset = _fb->m_backPage * varInfo.yres;
+  if (ioctl(_fb->m_fd, FBIOPAN_DISPLAY, &varInfo) != 0) {
+    res = errno;
+    fprintf(stderr, "ioctl(FBIOPAN_DISPLAY) failed: %d\n", res);
+    return res;
+  }
+  _fb->m_fbVarInfo.yoffset = varInfo.yoffset;
+
+  // page shown until the vertical blank is the one written next
+  _fb->m_flipPending = true;
+  clock_gettime(CLOCK_MONOTONIC, &_fb->m_flipTime);
+
+  _fb->m_backPage = 1 - _fb->m_backPage;
+  return 0;
+}
+
+/*
+  Back page is still scanned out until the vertical blank after the last flip. A flip at least a
+  refresh period old has surely taken effect, so frames drawn no faster than the display refreshes
+  never wait; faster ones wait for vertical blank, at most one refresh period.
+*/
+static void do_fbOutputWaitFlip(FBOutput* _fb) {
+  if (!_fb->m_flipPending)
+    return;
+  _fb->m_flipPending = false;
+  if (!_fb->m_waitVsync)
+    return;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const int64_t sinceFlipUs = (int64_t) (now.tv_sec - _fb->m_flipTime.tv_sec) * 1000000 + (now.tv_nsec - _fb->m_flipTime.tv_nsec) / 1000;
+  if (_fb->m_refreshUs != 0 && sinceFlipUs >= _fb->m_refreshUs)
+    return;
+
+  uint32_t crtc = 0;
+  if (ioctl(_fb->m_fd, FBIO_WAITFORVSYNC, &crtc) != 0) {
+    fprintf(stderr, "ioctl(FBIO_WAITFORVSYNC) failed: %d, flips are not synchronized\n", errno);
+    _fb->m_waitVsync = false;
+  }
+}
+
+// Channel of 5 or 6 bits widened to 8 and cut to the framebuffer bitfield
+static inline uint32_t do_fbOutputPackChannel(uint32_t _value, uint32_t _bits, const struct fb_bitfield* _field) {
+  const uint32_t value8 = (_value << (8 - _bits)) | (_value >> (2 * _bits - 8));
+  return _field->length >= 8 ? value8 << (_field->offset + _field->length - 8) : (value8 >> (8 - _field->length)) << _field->offset;
+}
+
+static int do_fbOutputCopyRgb565(FBOutput* _fb, void* _framePtr, const void* _rgb565Ptr, uint32_t _width, uint32_t _height, uint32_t _lineLength) {
+  const struct fb_var_screeninfo* varInfo = &_fb->m_fbVarInfo;
+  const uint32_t width = _width < varInfo->xres ? _width : varInfo->xres;
+  const uint32_t height = _height < varInfo->yres ? _height : varInfo->yres;
+  const uint32_t bytesPerPixel = varInfo->bits_per_pixel / 8;
+  const bool same = varInfo->bits_per_pixel == 16 && varInfo->red.offset == 11 && varInfo->red.length == 5 && varInfo->green.offset == 5
+                    && varInfo->green.length == 6 && varInfo->blue.offset == 0 && varInfo->blue.length == 5;
+  uint32_t row;
+  uint32_t col;
+
+  for (row = 0; row < height; ++row) {
+    const uint16_t* src = (const uint16_t*) ((const uint8_t*) _rgb565Ptr + row * _lineLength);
+    uint8_t* dst = (uint8_t*) _framePtr + row * _fb->m_fbFixInfo.line_length;
+
+    if (same) {
+      memcpy(dst, src, width * sizeof(*src));
+      continue;
+    }
+
+    for (col = 0; col < width; ++col, dst += bytesPerPixel) {
+      const uint32_t rgb565 = src[col];
+      const uint32_t pixel = do_fbOutputPackChannel(rgb565 >> 11, 5, &varInfo->red) | do_fbOutputPackChannel((rgb565 >> 5) & 0x3f, 6, &varInfo->green)
+                             | do_fbOutputPackChannel(rgb565 & 0x1f, 5, &varInfo->blue);
+      switch (bytesPerPixel) {
+      case 2:
+        *(uint16_t*) dst = pixel;
+        break;
+      case 3:
+        dst[0] = pixel;
+        dst[1] = pixel >> 8;
+        dst[2] = pixel >> 16;
+        break;
+      case 4:
+        *(uint32_t*) dst = pixel;
+        break;
+      }
+    }
+  }
 
   return 0;
 }
@@ -194,6 +364,9 @@ int fbOutputStart(FBOutput* _fb) {
   if (_fb->m_fd == -1)
     return ENOTCONN;
 
+  // frames may not cover the screen, what is left of it stays blank on every page
+  memset(_fb->m_fbPtr, 0, _fb->m_pageCount * _fb->m_pageSize);
+
   return 0;
 }
 
@@ -221,7 +394,17 @@ int fbOutputPutFrame(FBOutput* _fb) {
   if (_fb->m_fd == -1)
     return ENOTCONN;
 
-  return 0;
+  return do_fbOutputFlip(_fb);
+}
+
+int fbOutputCopyRgb565(FBOutput* _fb, void* _framePtr, const void* _rgb565Ptr, uint32_t _width, uint32_t _height, uint32_t _lineLength) {
+  if (_fb == NULL || _framePtr == NULL || _rgb565Ptr == NULL)
+    return EINVAL;
+  if (_fb->m_fd == -1)
+    return ENOTCONN;
+
+  do_fbOutputWaitFlip(_fb);
+  return do_fbOutputCopyRgb565(_fb, _framePtr, _rgb565Ptr, _width, _height, _lineLength);
 }
 
 int fbOutputGetFormat(FBOutput* _fb, ImageDescription* _imageDesc) {
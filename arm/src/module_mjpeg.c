@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "trik/buffer.h"
+#include "trik/sensors/module_mjpeg.h"
+
+#define MJPEG_BOUNDARY "trikframe"
+#define MJPEG_HEADER_MAX 128
+#define MJPEG_FRAME_MAX (MJPEG_HEADER_MAX + PREVIEW_JPEG_BUFFER_SIZE + 2)
+
+static int do_mjpegOutputListen(MJPEGOutput* _mjpeg, const MJPEGConfig* _config) {
+  int res;
+  const int reuse = 1;
+
+  if (_config->m_path != NULL) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(_config->m_path) >= sizeof(addr.sun_path))
+      return ENAMETOOLONG;
+    strcpy(addr.sun_path, _config->m_path);
+
+    _mjpeg->m_listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (_mjpeg->m_listenFd < 0) {
+      res = errno;
+      fprintf(stderr, "socket(AF_UNIX) failed: %d\n", res);
+      _mjpeg->m_listenFd = -1;
+      return res;
+    }
+
+    // socket left by a previous run
+    unlink(_config->m_path);
+    if (bind(_mjpeg->m_listenFd, (const struct sockaddr*) &addr, sizeof(addr)) != 0) {
+      res = errno;
+      fprintf(stderr, "bind(%s) failed: %d\n", _config->m_path, res);
+      return res;
+    }
+    _mjpeg->m_path = _config->m_path;
+  } else {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(_config->m_port);
+
+    _mjpeg->m_listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_mjpeg->m_listenFd < 0) {
+      res = errno;
+      fprintf(stderr, "socket(AF_INET) failed: %d\n", res);
+      _mjpeg->m_listenFd = -1;
+      return res;
+    }
+
+    if (setsockopt(_mjpeg->m_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0)
+      fprintf(stderr, "setsockopt(SO_REUSEADDR) failed: %d\n", errno);
+    if (bind(_mjpeg->m_listenFd, (const struct sockaddr*) &addr, sizeof(addr)) != 0) {
+      res = errno;
+      fprintf(stderr, "bind(%d) failed: %d\n", _config->m_port, res);
+      return res;
+    }
+  }
+
+  if (fcntl(_mjpeg->m_listenFd, F_SETFL, fcntl(_mjpeg->m_listenFd, F_GETFL) | O_NONBLOCK) != 0) {
+    res = errno;
+    fprintf(stderr, "fcntl(O_NONBLOCK) failed: %d\n", res);
+    return res;
+  }
+
+  if (listen(_mjpeg->m_listenFd, MJPEG_CLIENTS_MAX) != 0) {
+    res = errno;
+    fprintf(stderr, "listen() failed: %d\n", res);
+    return res;
+  }
+
+  return 0;
+}
+
+static void do_mjpegOutputUnlisten(MJPEGOutput* _mjpeg) {
+  if (_mjpeg->m_listenFd != -1 && close(_mjpeg->m_listenFd) != 0)
+    fprintf(stderr, "close() failed: %d\n", errno);
+  _mjpeg->m_listenFd = -1;
+
+  if (_mjpeg->m_path != NULL)
+    unlink(_mjpeg->m_path);
+  _mjpeg->m_path = NULL;
+}
+
+// Sends as much of the stored frame the client is behind on as its socket takes without blocking
+static int do_mjpegOutputSendBacklog(MJPEGOutput* _mjpeg, int _client) {
+  const int fd = _mjpeg->m_clientFds[_client];
+  size_t* sent = &_mjpeg->m_clientSent[_client];
+
+  while (*sent < _mjpeg->m_frameSize) {
+    const ssize_t res = send(fd, _mjpeg->m_frame + *sent, _mjpeg->m_frameSize - *sent, MSG_NOSIGNAL);
+    if (res < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      return errno;
+    }
+    *sent += res;
+  }
+  return 0;
+}
+
+static void do_mjpegOutputDropClient(MJPEGOutput* _mjpeg, int _client) {
+  close(_mjpeg->m_clientFds[_client]);
+  _mjpeg->m_clientFds[_client] = -1;
+}
+
+static void do_mjpegOutputCloseClients(MJPEGOutput* _mjpeg) {
+  int client;
+  for (client = 0; client < MJPEG_CLIENTS_MAX; ++client)
+    if (_mjpeg->m_clientFds[client] != -1)
+      do_mjpegOutputDropClient(_mjpeg, client);
+}
+
+static void do_mjpegOutputDrain(MJPEGOutput* _mjpeg) {
+  int client;
+  for (client = 0; client < MJPEG_CLIENTS_MAX; ++client)
+    if (_mjpeg->m_clientFds[client] != -1 && do_mjpegOutputSendBacklog(_mjpeg, client) != 0)
+      do_mjpegOutputDropClient(_mjpeg, client);
+}
+
+// Request of the client is not read, every one gets the stream
+static int do_mjpegOutputAccept(MJPEGOutput* _mjpeg) {
+  static const char s_response[] = "HTTP/1.0 200 OK\r\n"
+                                   "Cache-Control: no-cache\r\n"
+                                   "Connection: close\r\n"
+                                   "Content-Type: multipart/x-mixed-replace; boundary=" MJPEG_BOUNDARY "\r\n"
+                                   "\r\n";
+  int res;
+
+  while (true) {
+    const int fd = accept(_mjpeg->m_listenFd, NULL, NULL);
+    if (fd < 0) {
+      res = errno;
+      if (res == EAGAIN || res == EWOULDBLOCK || res == EINTR)
+        return 0;
+      fprintf(stderr, "accept() failed: %d\n", res);
+      return res;
+    }
+
+    int client;
+    for (client = 0; client < MJPEG_CLIENTS_MAX; ++client)
+      if (_mjpeg->m_clientFds[client] == -1)
+        break;
+    if (client == MJPEG_CLIENTS_MAX) {
+      fprintf(stderr, "MJPEG stream has %d clients already\n", MJPEG_CLIENTS_MAX);
+      close(fd);
+      continue;
+    }
+
+    // empty socket buffer of a new client takes the whole response, it gets the stream from the next frame on
+    _mjpeg->m_clientFds[client] = fd;
+    _mjpeg->m_clientSent[client] = _mjpeg->m_frameSize;
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0
+        || send(fd, s_response, sizeof(s_response) - 1, MSG_NOSIGNAL) != (ssize_t) (sizeof(s_response) - 1))
+      do_mjpegOutputDropClient(_mjpeg, client);
+  }
+}
+
+int mjpegOutputInit(bool _verbose) {
+  (void) _verbose;
+  return 0;
+}
+
+int mjpegOutputFini() { return 0; }
+
+int mjpegOutputOpen(MJPEGOutput* _mjpeg, const MJPEGConfig* _config) {
+  int res;
+
+  if (_mjpeg == NULL || _config == NULL)
+    return EINVAL;
+  if (_mjpeg->m_listenFd != -1)
+    return EALREADY;
+
+  if (_config->m_path == NULL && _config->m_port == 0)
+    return 0;
+  if (_config->m_decimation < 1 || _config->m_quality < 1 || _config->m_quality > 100)
+    return EINVAL;
+
+  if ((res = do_mjpegOutputListen(_mjpeg, _config)) != 0) {
+    do_mjpegOutputUnlisten(_mjpeg);
+    return res;
+  }
+
+  _mjpeg->m_frame = malloc(MJPEG_FRAME_MAX);
+  _mjpeg->m_frameSize = 0;
+  if (_mjpeg->m_frame == NULL) {
+    do_mjpegOutputUnlisten(_mjpeg);
+    return ENOMEM;
+  }
+
+  _mjpeg->m_decimation = _config->m_decimation;
+  _mjpeg->m_quality = _config->m_quality;
+  _mjpeg->m_frameCount = 0;
+  return 0;
+}
+
+int mjpegOutputClose(MJPEGOutput* _mjpeg) {
+  if (_mjpeg == NULL)
+    return EINVAL;
+  if (_mjpeg->m_listenFd == -1)
+    return 0;
+
+  do_mjpegOutputCloseClients(_mjpeg);
+  do_mjpegOutputUnlisten(_mjpeg);
+
+  free(_mjpeg->m_frame);
+  _mjpeg->m_frame = NULL;
+  _mjpeg->m_frameSize = 0;
+  return 0;
+}
+
+int mjpegOutputStart(MJPEGOutput* _mjpeg) {
+  if (_mjpeg == NULL)
+    return EINVAL;
+
+  _mjpeg->m_frameCount = 0;
+  return 0;
+}
+
+int mjpegOutputStop(MJPEGOutput* _mjpeg) {
+  if (_mjpeg == NULL)
+    return EINVAL;
+  if (_mjpeg->m_listenFd == -1)
+    return 0;
+
+  do_mjpegOutputCloseClients(_mjpeg);
+  return 0;
+}
+
+int mjpegOutputGetFrame(MJPEGOutput* _mjpeg, int* _quality) {
+  int res;
+
+  if (_mjpeg == NULL || _quality == NULL)
+    return EINVAL;
+
+  *_quality = 0;
+  if (_mjpeg->m_listenFd == -1)
+    return 0;
+
+  if ((res = do_mjpegOutputAccept(_mjpeg)) != 0)
+    return res;
+  do_mjpegOutputDrain(_mjpeg);
+
+  // frames are counted only while somebody watches, so the first client gets the very next one
+  int client;
+  for (client = 0; client < MJPEG_CLIENTS_MAX; ++client)
+    if (_mjpeg->m_clientFds[client] != -1)
+      break;
+  if (client == MJPEG_CLIENTS_MAX) {
+    _mjpeg->m_frameCount = 0;
+    return 0;
+  }
+
+  if (_mjpeg->m_frameCount++ % _mjpeg->m_decimation == 0)
+    *_quality = _mjpeg->m_quality;
+  return 0;
+}
+
+int mjpegOutputPutFrame(MJPEGOutput* _mjpeg, const void* _jpegPtr, size_t _jpegSize) {
+  if (_mjpeg == NULL || _jpegPtr == NULL)
+    return EINVAL;
+  if (_mjpeg->m_listenFd == -1)
+    return ENOTCONN;
+  if (_jpegSize > PREVIEW_JPEG_BUFFER_SIZE)
+    return EINVAL;
+
+  // client still behind on the previous frame cannot keep up with the stream
+  int client;
+  for (client = 0; client < MJPEG_CLIENTS_MAX; ++client)
+    if (_mjpeg->m_clientFds[client] != -1
+        && (do_mjpegOutputSendBacklog(_mjpeg, client) != 0 || _mjpeg->m_clientSent[client] < _mjpeg->m_frameSize))
+      do_mjpegOutputDropClient(_mjpeg, client);
+
+  const int headerSize = snprintf(_mjpeg->m_frame, MJPEG_HEADER_MAX, "--" MJPEG_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n", _jpegSize);
+  memcpy(_mjpeg->m_frame + headerSize, _jpegPtr, _jpegSize);
+  memcpy(_mjpeg->m_frame + headerSize + _jpegSize, "\r\n", 2);
+  _mjpeg->m_frameSize = headerSize + _jpegSize + 2;
+
+  for (client = 0; client < MJPEG_CLIENTS_MAX; ++client)
+    _mjpeg->m_clientSent[client] = 0;
+  do_mjpegOutputDrain(_mjpeg);
+
+  return 0;
+}
@@ -15,6 +15,55 @@
 
 #include "trik/sensors/module_rc.h"
 
+static enum trik_cv_algorithm trik_cv_algorithm_from_string(char* string) {
+  if (strcmp(string, "motion_sensor") == 0)
+    return TRIK_CV_ALGORITHM_MOTION_SENSOR;
+  else if (strcmp(string, "edge_line_sensor") == 0)
+    return TRIK_CV_ALGORITHM_EDGE_LINE_SENSOR;
+  else if (strcmp(string, "object_sensor") == 0)
+    return TRIK_CV_ALGORITHM_OBJECT_SENSOR;
+  else if (strcmp(string, "line_sensor") == 0)
+    return TRIK_CV_ALGORITHM_LINE_SENSOR;
+  else if (strcmp(string, "mxn_sensor") == 0)
+    return TRIK_CV_ALGORITHM_MXN_SENSOR;
+  else
+    return TRIK_CV_ALGORITHM_NONE;
+}
+
+const char* trik_cv_algorithm_to_string(enum trik_cv_algorithm algorithm) {
+  if (algorithm == TRIK_CV_ALGORITHM_MOTION_SENSOR)
+    return "motion_sensor";
+  else if (algorithm == TRIK_CV_ALGORITHM_EDGE_LINE_SENSOR)
+    return "edge_line_sensor";
+  else if (algorithm == TRIK_CV_ALGORITHM_OBJECT_SENSOR)
+    return "object_sensor";
+  else if (algorithm == TRIK_CV_ALGORITHM_LINE_SENSOR)
+    return "line_sensor";
+  else if (algorithm == TRIK_CV_ALGORITHM_MXN_SENSOR)
+    return "mxn_sensor";
+  else
+    return "none";
+}
+
+bool trik_cv_algorithms_from_string(char* string, enum trik_cv_algorithm* primary, uint32_t* secondary) {
+  char* saveptr = NULL;
+  char* name;
+
+  *primary = TRIK_CV_ALGORITHM_NONE;
+  *secondary = 0;
+  for (name = strtok_r(string, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+    enum trik_cv_algorithm algorithm = trik_cv_algorithm_from_string(name);
+    if (algorithm == TRIK_CV_ALGORITHM_NONE || algorithm == *primary || (*secondary & TRIK_CV_ALGORITHM_BIT(algorithm)))
+      return false;
+
+    if (*primary == TRIK_CV_ALGORITHM_NONE)
+      *primary = algorithm;
+    else
+      *secondary |= TRIK_CV_ALGORITHM_BIT(algorithm);
+  }
+  return true;
+}
+
 static int do_openFifoInput(RCInput* _rc, const char* _fifoInputName) {
   int res;
   if (_rc == NULL)
@@ -283,6 +332,63 @@ static int do_readFifoInput(RCInput* _rc) {
         _rc->m_videoOutEnable = videoOutEnable;
         _rc->m_videoOutParamsUpdated = true;
       }
+    } else if (strncmp(parseAt, "roi ", strlen("roi ")) == 0) {
+      int left, top, right, bottom, rowStep = 1;
+      int parsed;
+      parseAt += strlen("roi ");
+
+      parsed = sscanf(parseAt, "%d %d %d %d %d", &left, &top, &right, &bottom, &rowStep);
+      if (parsed != 4 && parsed != 5)
+        fprintf(stderr, "Cannot parse roi command, args '%s'\n", parseAt);
+      else if (left < 0 || top < 0 || right > 100 || bottom > 100 || left >= right || top >= bottom || rowStep < 0)
+        fprintf(stderr, "Invalid roi command, args '%s'\n", parseAt);
+      else {
+        _rc->m_roiParams.left = left;
+        _rc->m_roiParams.top = top;
+        _rc->m_roiParams.right = right;
+        _rc->m_roiParams.bottom = bottom;
+        _rc->m_roiParams.row_step = rowStep;
+        _rc->m_roiParamsUpdated = true;
+      }
+    } else if (strncmp(parseAt, "decimation ", strlen("decimation ")) == 0) {
+      int decimation;
+      parseAt += strlen("decimation ");
+
+      if ((sscanf(parseAt, "%d", &decimation)) != 1)
+        fprintf(stderr, "Cannot parse decimation command, args '%s'\n", parseAt);
+      else if (decimation != 1 && decimation != 2 && decimation != 4)
+        fprintf(stderr, "Invalid decimation command, args '%s'\n", parseAt);
+      else {
+        _rc->m_decimation = decimation;
+        _rc->m_decimationUpdated = true;
+      }
+    } else if (strncmp(parseAt, "morphology ", strlen("morphology ")) == 0) {
+      static const char* const s_morphologies[] = { "none", "erode", "dilate", "open", "close" };
+      int morphology;
+      parseAt += strlen("morphology ");
+
+      for (morphology = TRIK_MORPHOLOGY_NONE; morphology <= TRIK_MORPHOLOGY_CLOSE; ++morphology)
+        if (strncmp(parseAt, s_morphologies[morphology], strlen(s_morphologies[morphology])) == 0)
+          break;
+
+      if (morphology > TRIK_MORPHOLOGY_CLOSE)
+        fprintf(stderr, "Invalid morphology command, args '%s'\n", parseAt);
+      else {
+        _rc->m_morphology = morphology;
+        _rc->m_morphologyUpdated = true;
+      }
+    } else if (strncmp(parseAt, "sensor ", strlen("sensor ")) == 0) {
+      SensorSet sensorSet;
+      parseAt += strlen("sensor ");
+
+      // applied by the video thread between frames
+      if (!trik_cv_algorithms_from_string(parseAt, &sensorSet.m_sensorType, &sensorSet.m_secondarySensors)
+          || sensorSet.m_sensorType == TRIK_CV_ALGORITHM_NONE)
+        fprintf(stderr, "Invalid sensor command, unknown or repeated sensor\n");
+      else {
+        _rc->m_sensorSet = sensorSet;
+        _rc->m_sensorSetUpdated = true;
+      }
     } else
       fprintf(stderr, "Unknown command '%s'\n", parseAt);
 
@@ -410,6 +516,58 @@ int rcInputGetVideoOutParams(RCInput* _rc, bool* _videoOutEnable) {
   return 0;
 }
 
+int rcInputGetRoiParams(RCInput* _rc, RoiParams* _roiParams) {
+  if (_rc == NULL || _roiParams == NULL)
+    return EINVAL;
+
+  if (!_rc->m_roiParamsUpdated)
+    return ENODATA;
+
+  _rc->m_roiParamsUpdated = false;
+  *_roiParams = _rc->m_roiParams;
+
+  return 0;
+}
+
+int rcInputGetDecimation(RCInput* _rc, int* _decimation) {
+  if (_rc == NULL || _decimation == NULL)
+    return EINVAL;
+
+  if (!_rc->m_decimationUpdated)
+    return ENODATA;
+
+  _rc->m_decimationUpdated = false;
+  *_decimation = _rc->m_decimation;
+
+  return 0;
+}
+
+int rcInputGetMorphology(RCInput* _rc, int* _morphology) {
+  if (_rc == NULL || _morphology == NULL)
+    return EINVAL;
+
+  if (!_rc->m_morphologyUpdated)
+    return ENODATA;
+
+  _rc->m_morphologyUpdated = false;
+  *_morphology = _rc->m_morphology;
+
+  return 0;
+}
+
+int rcInputGetSensorSet(RCInput* _rc, SensorSet* _sensorSet) {
+  if (_rc == NULL || _sensorSet == NULL)
+    return EINVAL;
+
+  if (!_rc->m_sensorSetUpdated)
+    return ENODATA;
+
+  _rc->m_sensorSetUpdated = false;
+  *_sensorSet = _rc->m_sensorSet;
+
+  return 0;
+}
+
 int rcInputGetMxNParams(RCInput* _rc, MxnParams* mxnParams) {
   if (_rc == NULL || mxnParams == NULL)
     return EINVAL;
@@ -435,12 +593,13 @@ int rcInputGetTargetDetectCommand(RCInput* _rc, TargetDetectCommand* _targetDete
 
 #warning TODO code below if unsafe since it is used from another thread; consider reworking
 
-int rcInputUnsafeReportTargetLocation(RCInput* _rc, const TargetLocation* _targetLocation) {
-  if (_rc == NULL || _targetLocation == NULL)
+// Report of one or more whole lines, formatted by the caller
+int rcInputUnsafeReport(RCInput* _rc, const char* _report) {
+  if (_rc == NULL || _report == NULL)
     return EINVAL;
 
   if (_rc->m_fifoOutputFd != -1)
-    dprintf(_rc->m_fifoOutputFd, "loc: %d %d %d\n", _targetLocation->x, _targetLocation->y, _targetLocation->size);
+    dprintf(_rc->m_fifoOutputFd, "%s", _report);
 
   return 0;
 }
@@ -104,6 +104,158 @@ static int do_v4l2InputSetFormat(V4L2Input* _v4l2, size_t _width, size_t _height
   return 0;
 }
 
+// Leaves zero id in _ctrl if the camera has no such control or it is disabled
+static void do_v4l2InputQueryControl(V4L2Input* _v4l2, uint32_t _id, struct v4l2_queryctrl* _ctrl) {
+  memset(_ctrl, 0, sizeof(*_ctrl));
+  _ctrl->id = _id;
+  if (ioctl(_v4l2->m_fd, VIDIOC_QUERYCTRL, _ctrl) != 0 || (_ctrl->flags & V4L2_CTRL_FLAG_DISABLED) || _ctrl->id != _id)
+    _ctrl->id = 0;
+}
+
+static int do_v4l2InputSetControl(V4L2Input* _v4l2, uint32_t _id, int32_t _value) {
+  int res;
+  struct v4l2_control control;
+  control.id = _id;
+  control.value = _value;
+
+  if (ioctl(_v4l2->m_fd, VIDIOC_S_CTRL, &control) != 0) {
+    res = errno;
+    fprintf(stderr, "v4l2_ioctl(VIDIOC_S_CTRL, id %" PRIx32 ", value %" PRId32 ") failed: %d\n", _id, _value, res);
+    return res;
+  }
+
+  return 0;
+}
+
+static int32_t do_v4l2InputGetControl(V4L2Input* _v4l2, const struct v4l2_queryctrl* _ctrl) {
+  struct v4l2_control control;
+  control.id = _ctrl->id;
+  control.value = _ctrl->default_value;
+
+  if (ioctl(_v4l2->m_fd, VIDIOC_G_CTRL, &control) != 0)
+    fprintf(stderr, "v4l2_ioctl(VIDIOC_G_CTRL, id %" PRIx32 ") failed: %d\n", _ctrl->id, errno);
+
+  return control.value;
+}
+
+static int do_v4l2InputSetupExposure(V4L2Input* _v4l2, int _target) {
+  if (_v4l2 == NULL)
+    return EINVAL;
+
+  _v4l2->m_exposureTarget = 0;
+  _v4l2->m_exposureSettle = 0;
+  memset(&_v4l2->m_exposureCtrl, 0, sizeof(_v4l2->m_exposureCtrl));
+  memset(&_v4l2->m_gainCtrl, 0, sizeof(_v4l2->m_gainCtrl));
+  if (_target <= 0)
+    return 0;
+
+  do_v4l2InputQueryControl(_v4l2, V4L2_CID_EXPOSURE_ABSOLUTE, &_v4l2->m_exposureCtrl);
+  if (_v4l2->m_exposureCtrl.id == 0)
+    do_v4l2InputQueryControl(_v4l2, V4L2_CID_EXPOSURE, &_v4l2->m_exposureCtrl);
+  do_v4l2InputQueryControl(_v4l2, V4L2_CID_GAIN, &_v4l2->m_gainCtrl);
+
+  if (_v4l2->m_exposureCtrl.id == 0 && _v4l2->m_gainCtrl.id == 0) {
+    fprintf(stderr, "V4L2 camera has neither exposure nor gain control, exposure is left to the camera\n");
+    return 0;
+  }
+
+  // not every camera has automatic modes, keep going if they cannot be turned off
+  struct v4l2_queryctrl autoCtrl;
+  do_v4l2InputQueryControl(_v4l2, V4L2_CID_EXPOSURE_AUTO, &autoCtrl);
+  if (autoCtrl.id != 0 && _v4l2->m_exposureCtrl.id != 0)
+    do_v4l2InputSetControl(_v4l2, V4L2_CID_EXPOSURE_AUTO, V4L2_EXPOSURE_MANUAL);
+  do_v4l2InputQueryControl(_v4l2, V4L2_CID_AUTOGAIN, &autoCtrl);
+  if (autoCtrl.id != 0 && _v4l2->m_gainCtrl.id != 0)
+    do_v4l2InputSetControl(_v4l2, V4L2_CID_AUTOGAIN, 0);
+
+  if (_v4l2->m_exposureCtrl.id != 0)
+    _v4l2->m_exposure = do_v4l2InputGetControl(_v4l2, &_v4l2->m_exposureCtrl);
+  if (_v4l2->m_gainCtrl.id != 0)
+    _v4l2->m_gain = do_v4l2InputGetControl(_v4l2, &_v4l2->m_gainCtrl);
+
+  _v4l2->m_exposureTarget = _target;
+  return 0;
+}
+
+/*
+ * Scales control value by _ratio percents, moving at least one step and staying in its range.
+ * _ratio is left with what is still to be applied by the next control.
+ */
+static int32_t do_v4l2InputScaleControl(const struct v4l2_queryctrl* _ctrl, int32_t _value, int* _ratio) {
+  if (_ctrl->id == 0 || *_ratio == 100)
+    return _value;
+
+  const int32_t step = _ctrl->step > 0 ? _ctrl->step : 1;
+  int64_t scaled = ((int64_t)_value * *_ratio) / 100;
+  if (*_ratio > 100 && scaled < _value + step)
+    scaled = _value + step;
+  else if (*_ratio < 100 && scaled > _value - step)
+    scaled = _value - step;
+  scaled = _ctrl->minimum + ((scaled - _ctrl->minimum) / step) * step;
+
+  if (scaled > _ctrl->maximum)
+    scaled = _ctrl->maximum;
+  if (scaled < _ctrl->minimum)
+    scaled = _ctrl->minimum;
+
+  if (scaled > 0 && _value > 0)
+    *_ratio = (int)(((int64_t)*_ratio * _value) / scaled);
+  else
+    *_ratio = 100;
+
+  return scaled;
+}
+
+static int do_v4l2InputControlExposure(V4L2Input* _v4l2, const struct trik_frame_stats* _stats) {
+  const int settleFrames = 2;
+  const int deadband = 8;
+
+  if (_v4l2->m_exposureTarget <= 0 || _stats->samples == 0)
+    return 0;
+  if (_v4l2->m_exposureSettle > 0) {
+    --_v4l2->m_exposureSettle;
+    return 0;
+  }
+
+  int ratio = (_v4l2->m_exposureTarget * 100) / (_stats->luma_mean > 0 ? _stats->luma_mean : 1);
+  // a few saturated highlights are fine, brightening more would spread them over the frame
+  if (ratio > 100 && _stats->luma_high >= 250)
+    return 0;
+  if (ratio > 100 - deadband && ratio < 100 + deadband)
+    return 0;
+  if (ratio > 150)
+    ratio = 150;
+  if (ratio < 67)
+    ratio = 67;
+
+  // longer exposure adds less noise than gain, so it is raised first and lowered last
+  int32_t exposure = _v4l2->m_exposure;
+  int32_t gain = _v4l2->m_gain;
+  if (ratio > 100) {
+    exposure = do_v4l2InputScaleControl(&_v4l2->m_exposureCtrl, exposure, &ratio);
+    gain = do_v4l2InputScaleControl(&_v4l2->m_gainCtrl, gain, &ratio);
+  } else {
+    gain = do_v4l2InputScaleControl(&_v4l2->m_gainCtrl, gain, &ratio);
+    exposure = do_v4l2InputScaleControl(&_v4l2->m_exposureCtrl, exposure, &ratio);
+  }
+
+  int res;
+  if (_v4l2->m_exposureCtrl.id != 0 && exposure != _v4l2->m_exposure) {
+    if ((res = do_v4l2InputSetControl(_v4l2, _v4l2->m_exposureCtrl.id, exposure)) != 0)
+      return res;
+    _v4l2->m_exposure = exposure;
+    _v4l2->m_exposureSettle = settleFrames;
+  }
+  if (_v4l2->m_gainCtrl.id != 0 && gain != _v4l2->m_gain) {
+    if ((res = do_v4l2InputSetControl(_v4l2, _v4l2->m_gainCtrl.id, gain)) != 0)
+      return res;
+    _v4l2->m_gain = gain;
+    _v4l2->m_exposureSettle = settleFrames;
+  }
+
+  return 0;
+}
+
 static int do_v4l2InputUnsetFormat(V4L2Input* _v4l2) {
   if (_v4l2 == NULL)
     return EINVAL;
@@ -374,6 +526,10 @@ int v4l2InputOpen(V4L2Input* _v4l2, const V4L2Config* _config) {
   if (ret != 0)
     goto exit_close;
 
+  ret = do_v4l2InputSetupExposure(_v4l2, _config->m_exposureTarget);
+  if (ret != 0)
+    goto exit_unset_format;
+
   ret = do_v4l2InputMmapBuffers(_v4l2);
   if (ret != 0)
     goto exit_unset_format;
@@ -454,3 +610,12 @@ int v4l2InputReportFPS(V4L2Input* _v4l2, long long _ms) {
 
   return do_v4l2InputReportFPS(_v4l2, _ms);
 }
+
+int v4l2InputControlExposure(V4L2Input* _v4l2, const struct trik_frame_stats* _stats) {
+  if (_v4l2 == NULL || _stats == NULL)
+    return EINVAL;
+  if (_v4l2->m_fd == -1)
+    return ENOTCONN;
+
+  return do_v4l2InputControlExposure(_v4l2, _stats);
+}
@@ -14,9 +14,10 @@
 
 static const RuntimeConfig s_runtimeConfig = { .m_verbose = false, 
   .m_configFile = NULL,
-  .m_v4l2Config = { NULL, 320, 240, V4L2_PIX_FMT_NV16 },
+  .m_v4l2Config = { NULL, 320, 240, V4L2_PIX_FMT_NV16, 0 },
   .m_fbConfig = { "/dev/fb0" },
-  .m_rcConfig = { NULL, NULL, TRIK_CV_ALGORITHM_NONE, true } };
+  .m_mjpegConfig = { NULL, 0, 5, 75 },
+  .m_rcConfig = { NULL, NULL, TRIK_CV_ALGORITHM_NONE, 0, true } };
 
 void runtimeReset(Runtime* _runtime) {
   memset(_runtime, 0, sizeof(*_runtime));
@@ -27,6 +28,10 @@ void runtimeReset(Runtime* _runtime) {
   _runtime->m_modules.m_v4l2Input.m_fd = -1;
   memset(&_runtime->m_modules.m_fbOutput, 0, sizeof(_runtime->m_modules.m_fbOutput));
   _runtime->m_modules.m_fbOutput.m_fd = -1;
+  memset(&_runtime->m_modules.m_mjpegOutput, 0, sizeof(_runtime->m_modules.m_mjpegOutput));
+  _runtime->m_modules.m_mjpegOutput.m_listenFd = -1;
+  for (int client = 0; client < MJPEG_CLIENTS_MAX; ++client)
+    _runtime->m_modules.m_mjpegOutput.m_clientFds[client] = -1;
   memset(&_runtime->m_modules.m_rcInput, 0, sizeof(_runtime->m_modules.m_rcInput));
   memset(&_runtime->m_modules.m_dsp, 0, sizeof(_runtime->m_modules.m_dsp));
   _runtime->m_modules.m_rcInput.m_fifoInputFd = -1;
@@ -38,21 +43,10 @@ void runtimeReset(Runtime* _runtime) {
   pthread_mutex_init(&_runtime->m_state.m_mutex, NULL);
   memset(&_runtime->m_state.m_targetDetectParams, 0, sizeof(_runtime->m_state.m_targetDetectParams));
   memset(&_runtime->m_state.m_targetDetectCommand, 0, sizeof(_runtime->m_state.m_targetDetectCommand));
-}
-
-static enum trik_cv_algorithm trik_cv_algorithm_from_string(char* string) {
-  if (strcmp(string, "motion_sensor") == 0)
-    return TRIK_CV_ALGORITHM_MOTION_SENSOR;
-  else if (strcmp(string, "edge_line_sensor") == 0)
-    return TRIK_CV_ALGORITHM_EDGE_LINE_SENSOR;
-  else if (strcmp(string, "object_sensor") == 0)
-    return TRIK_CV_ALGORITHM_OBJECT_SENSOR;
-  else if (strcmp(string, "line_sensor") == 0)
-    return TRIK_CV_ALGORITHM_LINE_SENSOR;
-  else if (strcmp(string, "mxn_sensor") == 0)
-    return TRIK_CV_ALGORITHM_MXN_SENSOR;
-  else
-    return TRIK_CV_ALGORITHM_NONE;
+  memset(&_runtime->m_state.m_roiParams, 0, sizeof(_runtime->m_state.m_roiParams)); // whole frame
+  _runtime->m_state.m_decimation = 1;
+  _runtime->m_state.m_morphology = TRIK_MORPHOLOGY_NONE;
+  _runtime->m_state.m_sensorSetUpdated = false;
 }
 
 bool runtimeParseArgs(Runtime* _runtime, int _argc, char* const _argv[]) {
@@ -74,7 +68,12 @@ bool runtimeParseArgs(Runtime* _runtime, int _argc, char* const _argv[]) {
     { "config-file", 1, NULL, 0 }, 
     { "mxn-width-m", 1, NULL, 0 }, //10
     { "mxn-height-n", 1, NULL, 0 },             
-    { "verbose", 0, NULL, 'v' }, //12
+    { "v4l2-exposure-target", 1, NULL, 0 }, //12
+    { "mjpeg-path", 1, NULL, 0 },
+    { "mjpeg-port", 1, NULL, 0 }, //14
+    { "mjpeg-decimation", 1, NULL, 0 },
+    { "mjpeg-quality", 1, NULL, 0 }, //16
+    { "verbose", 0, NULL, 'v' },
     { "help", 0, NULL, 'h' }, 
        { NULL, 0, NULL, 0 } };
 
@@ -138,7 +137,10 @@ bool runtimeParseArgs(Runtime* _runtime, int _argc, char* const _argv[]) {
         cfg->m_rcConfig.m_videoOutEnable = atoi(optarg);
         break;
       case 8:
-        cfg->m_rcConfig.m_sensorType = trik_cv_algorithm_from_string(optarg);
+        if (!trik_cv_algorithms_from_string(optarg, &cfg->m_rcConfig.m_sensorType, &cfg->m_rcConfig.m_secondarySensors)) {
+          fprintf(stderr, "Unknown or repeated sensor in '%s'\n", optarg);
+          return false;
+        }
         break;
       case 9:
         cfg->m_configFile = optarg;
@@ -149,6 +151,21 @@ bool runtimeParseArgs(Runtime* _runtime, int _argc, char* const _argv[]) {
       case 11:
         cfg->m_rcConfig.m_extraParams.m_mxnParams.m_n = atoi(optarg);
         break;
+      case 12:
+        cfg->m_v4l2Config.m_exposureTarget = atoi(optarg);
+        break;
+      case 13:
+        cfg->m_mjpegConfig.m_path = optarg;
+        break;
+      case 14:
+        cfg->m_mjpegConfig.m_port = atoi(optarg);
+        break;
+      case 15:
+        cfg->m_mjpegConfig.m_decimation = atoi(optarg);
+        break;
+      case 16:
+        cfg->m_mjpegConfig.m_quality = atoi(optarg);
+        break;
       default:
         return false;
       }
@@ -177,7 +194,17 @@ bool runtimeParseArgs(Runtime* _runtime, int _argc, char* const _argv[]) {
     return false;
   }
 
-  if (cfg->m_rcConfig.m_sensorType == TRIK_CV_ALGORITHM_MXN_SENSOR) {
+  if (cfg->m_mjpegConfig.m_decimation < 1) {
+    fprintf(stderr, "Invalid argument: --mjpeg-decimation has to be 1 or more\n");
+    return false;
+  }
+  if (cfg->m_mjpegConfig.m_quality < 1 || cfg->m_mjpegConfig.m_quality > 100) {
+    fprintf(stderr, "Invalid argument: --mjpeg-quality has to be in [1..100]\n");
+    return false;
+  }
+
+  if (cfg->m_rcConfig.m_sensorType == TRIK_CV_ALGORITHM_MXN_SENSOR
+      || (cfg->m_rcConfig.m_secondarySensors & TRIK_CV_ALGORITHM_BIT(TRIK_CV_ALGORITHM_MXN_SENSOR))) {
     if (cfg->m_rcConfig.m_extraParams.m_mxnParams.m_m <= 0 
         && cfg->m_rcConfig.m_extraParams.m_mxnParams.m_n <= 0) {
       fprintf(stderr, "Missing or invalid required argument: mxn-width-m or mxn-height-n\n");
@@ -200,12 +227,19 @@ void runtimeArgsHelpMessage(Runtime* _runtime, const char* _arg0) {
     "   --v4l2-width   <input-width>\n"
     "   --v4l2-height  <input-height>\n"
     "   --v4l2-format  <input-pixel-format>\n"
+    "   --v4l2-exposure-target  <mean-luma-to-keep-0-255>\n"
     "   --fb-path      <output-device-path>\n"
+    "   --mjpeg-path   <preview-stream-unix-socket-path>\n"
+    "   --mjpeg-port   <preview-stream-tcp-port>\n"
+    "   --mjpeg-decimation      <stream-every-nth-frame>\n"
+    "   --mjpeg-quality         <jpeg-quality-1-100>\n"
     "   --rc-fifo-in            <remote-control-fifo-input>\n"
     "   --rc-fifo-out           <remote-control-fifo-output>\n"
     "   --video-out             <enable-video-output>\n"
-    "   --sensor-type             <type-of-sensor-algo>\n"
-    "   --help\n",
+    "   --sensor-type             <type-of-sensor-algo>[,<type-of-sensor-algo>...]\n"
+    "   --help\n"
+    " sensor set is switched at runtime with 'sensor <type-of-sensor-algo>[,...]' written to the input fifo\n"
+    " preview is streamed as MJPEG over HTTP to clients of the unix socket, or of the tcp port if no socket is set\n",
     _arg0);
 }
 
@@ -229,6 +263,11 @@ int runtimeInit(Runtime* _runtime) {
     exit_code = res;
   }
 
+  if ((res = mjpegOutputInit(verbose)) != 0) {
+    fprintf(stderr, "mjpegOutputInit() failed: %d\n", res);
+    exit_code = res;
+  }
+
   if ((res = rcInputInit(verbose)) != 0) {
     fprintf(stderr, "rcInputInit() failed: %d\n", res);
     exit_code = res;
@@ -246,6 +285,9 @@ int runtimeFini(Runtime* _runtime) {
   if ((res = rcInputFini()) != 0)
     fprintf(stderr, "rcInputFini() failed: %d\n", res);
 
+  if ((res = mjpegOutputFini()) != 0)
+    fprintf(stderr, "mjpegOutputFini() failed: %d\n", res);
+
   if ((res = fbOutputFini()) != 0)
     fprintf(stderr, "fbOutputFini() failed: %d\n", res);
 
@@ -325,6 +367,13 @@ const FBConfig* runtimeCfgFBOutput(const Runtime* _runtime) {
   return &_runtime->m_config.m_fbConfig;
 }
 
+const MJPEGConfig* runtimeCfgMJPEGOutput(const Runtime* _runtime) {
+  if (_runtime == NULL)
+    return NULL;
+
+  return &_runtime->m_config.m_mjpegConfig;
+}
+
 const RCConfig* runtimeCfgRCInput(const Runtime* _runtime) {
   if (_runtime == NULL)
     return NULL;
@@ -346,6 +395,13 @@ FBOutput* runtimeModFBOutput(Runtime* _runtime) {
   return &_runtime->m_modules.m_fbOutput;
 }
 
+MJPEGOutput* runtimeModMJPEGOutput(Runtime* _runtime) {
+  if (_runtime == NULL)
+    return NULL;
+
+  return &_runtime->m_modules.m_mjpegOutput;
+}
+
 RCInput* runtimeModRCInput(Runtime* _runtime) {
   if (_runtime == NULL)
     return NULL;
@@ -416,6 +472,114 @@ int runtimeSetVideoOutParams(Runtime* _runtime, const bool* _videoOutEnable) {
   return 0;
 }
 
+int runtimeGetRoiParams(Runtime* _runtime, RoiParams* _roiParams) {
+  if (_runtime == NULL || _roiParams == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  *_roiParams = _runtime->m_state.m_roiParams;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeSetRoiParams(Runtime* _runtime, const RoiParams* _roiParams) {
+  if (_runtime == NULL || _roiParams == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  _runtime->m_state.m_roiParams = *_roiParams;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeGetDecimation(Runtime* _runtime, int* _decimation) {
+  if (_runtime == NULL || _decimation == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  *_decimation = _runtime->m_state.m_decimation;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeSetDecimation(Runtime* _runtime, const int* _decimation) {
+  if (_runtime == NULL || _decimation == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  _runtime->m_state.m_decimation = *_decimation;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeGetMorphology(Runtime* _runtime, int* _morphology) {
+  if (_runtime == NULL || _morphology == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  *_morphology = _runtime->m_state.m_morphology;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeSetMorphology(Runtime* _runtime, const int* _morphology) {
+  if (_runtime == NULL || _morphology == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  _runtime->m_state.m_morphology = *_morphology;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeFetchSensorSet(Runtime* _runtime, SensorSet* _sensorSet) {
+  int res = 0;
+  if (_runtime == NULL || _sensorSet == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  if (_runtime->m_state.m_sensorSetUpdated) {
+    *_sensorSet = _runtime->m_state.m_sensorSet;
+    _runtime->m_state.m_sensorSetUpdated = false;
+  } else
+    res = ENODATA;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return res;
+}
+
+int runtimeSetSensorSet(Runtime* _runtime, const SensorSet* _sensorSet) {
+  if (_runtime == NULL || _sensorSet == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  _runtime->m_state.m_sensorSet = *_sensorSet;
+  _runtime->m_state.m_sensorSetUpdated = true;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeGetRunningSensorSet(Runtime* _runtime, SensorSet* _sensorSet) {
+  if (_runtime == NULL || _sensorSet == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  _sensorSet->m_sensorType = _runtime->m_config.m_rcConfig.m_sensorType;
+  _sensorSet->m_secondarySensors = _runtime->m_config.m_rcConfig.m_secondarySensors;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
+int runtimeSetRunningSensorSet(Runtime* _runtime, const SensorSet* _sensorSet) {
+  if (_runtime == NULL || _sensorSet == NULL)
+    return EINVAL;
+
+  pthread_mutex_lock(&_runtime->m_state.m_mutex);
+  _runtime->m_config.m_rcConfig.m_sensorType = _sensorSet->m_sensorType;
+  _runtime->m_config.m_rcConfig.m_secondarySensors = _sensorSet->m_secondarySensors;
+  pthread_mutex_unlock(&_runtime->m_state.m_mutex);
+  return 0;
+}
+
 int runtimeFetchTargetDetectCommand(Runtime* _runtime, TargetDetectCommand* _targetDetectCommand) {
   if (_runtime == NULL || _targetDetectCommand == NULL)
     return EINVAL;
@@ -447,14 +611,30 @@ int runtimeSetMxNParams(Runtime* _runtime, MxnParams* mxnParams) {
   return 0;
 }
 
+// Reports are formatted here and written whole to the rc fifo by the one unsafe call
+static int do_runtimeReport(Runtime* _runtime, const char* _report) {
+#warning Unsafe
+  return rcInputUnsafeReport(&_runtime->m_modules.m_rcInput, _report);
+}
+
+int runtimeReportSensor(Runtime* _runtime, enum trik_cv_algorithm _sensor) {
+  char report[64];
+
+  if (_runtime == NULL)
+    return EINVAL;
+
+  snprintf(report, sizeof(report), "sensor: %s\n", trik_cv_algorithm_to_string(_sensor));
+  return do_runtimeReport(_runtime, report);
+}
+
 int runtimeReportTargetLocation(Runtime* _runtime, const TargetLocation* _targetLocation) {
+  char report[64];
+
   if (_runtime == NULL || _targetLocation == NULL)
     return EINVAL;
 
-#warning Unsafe
-  rcInputUnsafeReportTargetLocation(&_runtime->m_modules.m_rcInput, _targetLocation);
-
-  return 0;
+  snprintf(report, sizeof(report), "loc: %d %d %d\n", _targetLocation->x, _targetLocation->y, _targetLocation->size);
+  return do_runtimeReport(_runtime, report);
 }
 
 int runtimeReportTargetColors(Runtime* _runtime, const TargetColors* _targetColors) {
@@ -467,6 +647,37 @@ int runtimeReportTargetColors(Runtime* _runtime, const TargetColors* _targetColo
   return 0;
 }
 
+int runtimeReportTargetLines(Runtime* _runtime, const TargetLine* _targetLines) {
+  char report[TRIK_MAX_TARGET_COUNT * 32];
+  size_t length = 0;
+  int i;
+
+  if (_runtime == NULL || _targetLines == NULL)
+    return EINVAL;
+
+  for (i = 0; i < TRIK_MAX_TARGET_COUNT && _targetLines[i].support > 0; i++)
+    length += snprintf(report + length, sizeof(report) - length, "line: %d %d %d\n", _targetLines[i].angle, _targetLines[i].offset, _targetLines[i].support);
+
+  return length > 0 ? do_runtimeReport(_runtime, report) : 0;
+}
+
+int runtimeReportTargetObjects(Runtime* _runtime, const trik_cv_algorithm_out_target* _targets) {
+  char report[TRIK_MAX_TARGET_COUNT * 128];
+  size_t length = 0;
+  int i;
+
+  if (_runtime == NULL || _targets == NULL)
+    return EINVAL;
+
+  for (i = 0; i < TRIK_MAX_TARGET_COUNT && _targets[i].out_target.targetObject.area > 0; i++) {
+    const TargetObject* object = &_targets[i].out_target.targetObject;
+    length += snprintf(report + length, sizeof(report) - length, "object: %d %d %d %d %d %d %d %d %d %d\n", object->x, object->y, object->size, object->left,
+      object->top, object->right, object->bottom, object->area, object->orientation, object->elongation);
+  }
+
+  return length > 0 ? do_runtimeReport(_runtime, report) : 0;
+}
+
 int runtimeReportTargetDetectParams(Runtime* _runtime, const trik_cv_algorithm_out_args* _targetDetectParams) {
   if (_runtime == NULL || _targetDetectParams == NULL)
     return EINVAL;
@@ -64,6 +64,50 @@ static int threadInputSelectLoop(Runtime* _runtime, RCInput* _rc) {
     return res;
   }
 
+  RoiParams roiParams;
+  if ((res = rcInputGetRoiParams(_rc, &roiParams)) != 0) {
+    if (res != ENODATA) {
+      fprintf(stderr, "rcInputGetRoiParams() failed: %d\n", res);
+      return res;
+    }
+  } else if ((res = runtimeSetRoiParams(_runtime, &roiParams)) != 0) {
+    fprintf(stderr, "runtimeSetRoiParams() failed: %d\n", res);
+    return res;
+  }
+
+  int decimation;
+  if ((res = rcInputGetDecimation(_rc, &decimation)) != 0) {
+    if (res != ENODATA) {
+      fprintf(stderr, "rcInputGetDecimation() failed: %d\n", res);
+      return res;
+    }
+  } else if ((res = runtimeSetDecimation(_runtime, &decimation)) != 0) {
+    fprintf(stderr, "runtimeSetDecimation() failed: %d\n", res);
+    return res;
+  }
+
+  int morphology;
+  if ((res = rcInputGetMorphology(_rc, &morphology)) != 0) {
+    if (res != ENODATA) {
+      fprintf(stderr, "rcInputGetMorphology() failed: %d\n", res);
+      return res;
+    }
+  } else if ((res = runtimeSetMorphology(_runtime, &morphology)) != 0) {
+    fprintf(stderr, "runtimeSetMorphology() failed: %d\n", res);
+    return res;
+  }
+
+  SensorSet sensorSet;
+  if ((res = rcInputGetSensorSet(_rc, &sensorSet)) != 0) {
+    if (res != ENODATA) {
+      fprintf(stderr, "rcInputGetSensorSet() failed: %d\n", res);
+      return res;
+    }
+  } else if ((res = runtimeSetSensorSet(_runtime, &sensorSet)) != 0) {
+    fprintf(stderr, "runtimeSetSensorSet() failed: %d\n", res);
+    return res;
+  }
+
   TargetDetectCommand targetDetectCommand;
   if ((res = rcInputGetTargetDetectCommand(_rc, &targetDetectCommand)) != 0) {
     if (res != ENODATA) {
@@ -3,6 +3,7 @@
 #include "trik/sensors/arm_server.h"
 #include "trik/sensors/cv_algorithm_args.h"
 #include "trik/sensors/module_fb.h"
+#include "trik/sensors/module_mjpeg.h"
 #include "trik/sensors/module_v4l2.h"
 #include "trik/sensors/runtime.h"
 #include <assert.h>
@@ -14,13 +15,87 @@
 #include <sys/select.h>
 #include <time.h>
 
-static int threadVideoSelectLoop(Runtime* _runtime, V4L2Input* _v4l2, FBOutput* _fb) {
+static int threadVideoReportTargets(Runtime* _runtime, enum trik_cv_algorithm _sensor, const trik_cv_algorithm_out_args* _targetArgs) {
+  int res;
+  const trik_cv_algorithm_out_target* target = &_targetArgs->targets[0];
+
+  if (_sensor == TRIK_CV_ALGORITHM_MXN_SENSOR) {
+    if ((res = runtimeReportTargetColors(_runtime, &(target->out_target.targetColors))) != 0) {
+      fprintf(stderr, "runtimeReportTargetColors() failed: %d\n", res);
+      return res;
+    }
+  } else {
+    if ((res = runtimeReportTargetLocation(_runtime, &(target->out_target.targetLocation))) != 0) {
+      fprintf(stderr, "runtimeReportTargetLocation() failed: %d\n", res);
+      return res;
+    }
+    if (_sensor == TRIK_CV_ALGORITHM_LINE_SENSOR || _sensor == TRIK_CV_ALGORITHM_EDGE_LINE_SENSOR) {
+      if ((res = runtimeReportTargetLines(_runtime, _targetArgs->lines)) != 0) {
+        fprintf(stderr, "runtimeReportTargetLines() failed: %d\n", res);
+        return res;
+      }
+    }
+    if (_sensor == TRIK_CV_ALGORITHM_OBJECT_SENSOR) {
+      if ((res = runtimeReportTargetObjects(_runtime, _targetArgs->targets)) != 0) {
+        fprintf(stderr, "runtimeReportTargetObjects() failed: %d\n", res);
+        return res;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+  Switches the set of sensors run on the DSP between two frames, without restarting capture.
+  DSP keeps every sensor set up for the frame geometry, so that takes less than a frame.
+  Rejected set is reported and the current one keeps running.
+*/
+static int threadVideoSwitchSensors(Runtime* _runtime, V4L2Input* _v4l2, const SensorSet* _sensorSet, const MxnParams* _mxnParams) {
+  int res;
+  SensorSet running;
+
+  if ((res = runtimeGetRunningSensorSet(_runtime, &running)) != 0) {
+    fprintf(stderr, "runtimeGetRunningSensorSet() failed: %d\n", res);
+    return res;
+  }
+  if (_sensorSet->m_sensorType == running.m_sensorType && _sensorSet->m_secondarySensors == running.m_secondarySensors)
+    return 0;
+
+  if ((_sensorSet->m_sensorType == TRIK_CV_ALGORITHM_MXN_SENSOR || (_sensorSet->m_secondarySensors & TRIK_CV_ALGORITHM_BIT(TRIK_CV_ALGORITHM_MXN_SENSOR)))
+      && (_mxnParams->m_m <= 0 || _mxnParams->m_n <= 0)) {
+    fprintf(stderr, "Cannot switch to mxn_sensor without mxn parameters set\n");
+    return 0;
+  }
+
+  ImageDescription srcImageDesc;
+  if ((res = v4l2InputGetFormat(_v4l2, &srcImageDesc)) != 0) {
+    fprintf(stderr, "v4l2InputGetFormat() failed: %d\n", res);
+    return res;
+  }
+
+  RuntimeConfig config = _runtime->m_config;
+  config.m_rcConfig.m_sensorType = _sensorSet->m_sensorType;
+  config.m_rcConfig.m_secondarySensors = _sensorSet->m_secondarySensors;
+  if (trik_req_cv_algorithm(config, srcImageDesc.m_width, srcImageDesc.m_height, srcImageDesc.m_lineLength) < 0) {
+    fprintf(stderr, "Cannot switch to sensor %s, keeping %s\n", trik_cv_algorithm_to_string(_sensorSet->m_sensorType),
+      trik_cv_algorithm_to_string(running.m_sensorType));
+    return 0;
+  }
+
+  if ((res = runtimeSetRunningSensorSet(_runtime, _sensorSet)) != 0) {
+    fprintf(stderr, "runtimeSetRunningSensorSet() failed: %d\n", res);
+    return res;
+  }
+  return 0;
+}
+
+static int threadVideoSelectLoop(Runtime* _runtime, V4L2Input* _v4l2, FBOutput* _fb, MJPEGOutput* _mjpeg) {
   int res;
   int maxFd = 0;
   fd_set fdsIn;
   static const struct timespec s_selectTimeout = { .tv_sec = 1, .tv_nsec = 0 };
 
-  if (_runtime == NULL || _v4l2 == NULL || _fb == NULL)
+  if (_runtime == NULL || _v4l2 == NULL || _fb == NULL || _mjpeg == NULL)
     return EINVAL;
 
   FD_ZERO(&fdsIn);
@@ -75,35 +150,101 @@ static int threadVideoSelectLoop(Runtime* _runtime, V4L2Input* _v4l2, FBOutput*
     fprintf(stderr, "runtimeGetVideoOutParams() failed: %d\n", res);
     return res;
   }
+  targetDetectParams.video_out = videoOutEnable;
+
+  // preview is drawn for the stream even if the display does not show it
+  int jpegQuality;
+  if ((res = mjpegOutputGetFrame(_mjpeg, &jpegQuality)) != 0) {
+    fprintf(stderr, "mjpegOutputGetFrame() failed: %d\n", res);
+    jpegQuality = 0;
+  }
+  targetDetectParams.preview_jpeg = jpegQuality;
+  targetDetectParams.video_out = videoOutEnable || jpegQuality > 0;
+
+  if ((res = runtimeGetRoiParams(_runtime, &targetDetectParams.roi)) != 0) {
+    fprintf(stderr, "runtimeGetRoiParams() failed: %d\n", res);
+    return res;
+  }
+
+  int decimation;
+  if ((res = runtimeGetDecimation(_runtime, &decimation)) != 0) {
+    fprintf(stderr, "runtimeGetDecimation() failed: %d\n", res);
+    return res;
+  }
+  targetDetectParams.decimation = decimation;
+  targetDetectParams.frame_stats = _v4l2->m_exposureTarget > 0;
+
+  int morphology;
+  if ((res = runtimeGetMorphology(_runtime, &morphology)) != 0) {
+    fprintf(stderr, "runtimeGetMorphology() failed: %d\n", res);
+    return res;
+  }
+  targetDetectParams.morphology = morphology;
 
   if ((res = runtimeGetMxnParams(_runtime, &(targetDetectParams.extra_inArgs.mxnParams))) != 0) {
     fprintf(stderr, "runtimeGetVideoOutParams() failed: %d\n", res);
     return res;
   }
 
+  SensorSet sensorSet;
+  if ((res = runtimeFetchSensorSet(_runtime, &sensorSet)) != 0) {
+    if (res != ENODATA) {
+      fprintf(stderr, "runtimeFetchSensorSet() failed: %d\n", res);
+      return res;
+    }
+  } else if ((res = threadVideoSwitchSensors(_runtime, _v4l2, &sensorSet, &(targetDetectParams.extra_inArgs.mxnParams))) != 0) {
+    fprintf(stderr, "threadVideoSwitchSensors() failed: %d\n", res);
+    return res;
+  }
+
+  if (frameSrcSize > _runtime->m_modules.m_dsp.dsp_in_buf->length) {
+    fprintf(stderr, "Frame of %zu bytes does not fit DSP buffer\n", frameSrcSize);
+    return ENOMEM;
+  }
   memcpy(_runtime->m_modules.m_dsp.dsp_in_buf->start, frameSrcPtr, frameSrcSize);
 
-  trik_cv_algorithm_out_args targetArgs;
+  // indexed by sensor, each sensor of the set reports separately
+  trik_cv_algorithm_out_args targetArgs[TRIK_CV_ALGORITHM_COUNT];
+  SensorSet running;
+  if ((res = runtimeGetRunningSensorSet(_runtime, &running)) != 0) {
+    fprintf(stderr, "runtimeGetRunningSensorSet() failed: %d\n", res);
+    return res;
+  }
+  const enum trik_cv_algorithm sensorType = running.m_sensorType;
+  const uint32_t secondarySensors = running.m_secondarySensors;
 
 
   struct timespec start, end;
   double elapsed;
 
-  if (trik_req_step(&targetArgs, targetDetectParams) < 0) {
+  struct trik_frame_stats frameStats;
+  uint32_t jpegSize = 0;
+  if (trik_req_step(targetArgs, &frameStats, &jpegSize, targetDetectParams) < 0) {
     printf("unable to proccess a frame on a DSP \n");
     return -1;
   }
 
-  trik_cv_algorithm_out_target target;
-  target = targetArgs.targets[0];
-  if (videoOutEnable)
-    memcpy(frameDstPtr, _runtime->m_modules.m_dsp.dsp_out_buf->start, BUFFER_SIZE_FOR_FB);
+  // the camera keeps working with the previous settings if they cannot be changed
+  if (targetDetectParams.frame_stats && (res = v4l2InputControlExposure(_v4l2, &frameStats)) != 0)
+    fprintf(stderr, "v4l2InputControlExposure() failed: %d\n", res);
 
-  if ((res = fbOutputPutFrame(_fb)) != 0) {
-    fprintf(stderr, "fbOutputPutFrame() failed: %d\n", res);
-    return res;
+  // frame goes to the page not shown, which is flipped to only when drawn
+  if (videoOutEnable) {
+    if ((res = fbOutputCopyRgb565(_fb, frameDstPtr, _runtime->m_modules.m_dsp.dsp_out_buf->start, PREVIEW_WIDTH, PREVIEW_FB_HEIGHT, PREVIEW_WIDTH * 2)) != 0) {
+      fprintf(stderr, "fbOutputCopyRgb565() failed: %d\n", res);
+      return res;
+    }
+
+    if ((res = fbOutputPutFrame(_fb)) != 0) {
+      fprintf(stderr, "fbOutputPutFrame() failed: %d\n", res);
+      return res;
+    }
   }
 
+  // JPEG is sent before the next step overwrites it, a failing stream does not stop the sensors
+  if (jpegSize > 0 && (res = mjpegOutputPutFrame(_mjpeg, _runtime->m_modules.m_dsp.dsp_jpeg_buf->start, jpegSize)) != 0)
+    fprintf(stderr, "mjpegOutputPutFrame() failed: %d\n", res);
+
   if ((res = v4l2InputPutFrame(_v4l2, frameSrcIndex)) != 0) {
     fprintf(stderr, "v4l2InputPutFrame() failed: %d\n", res);
     return res;
@@ -111,7 +252,7 @@ static int threadVideoSelectLoop(Runtime* _runtime, V4L2Input* _v4l2, FBOutput*
 
   switch (targetDetectCommand.m_cmd) {
   case 1:
-    if ((res = runtimeReportTargetDetectParams(_runtime, &targetArgs)) != 0) {
+    if ((res = runtimeReportTargetDetectParams(_runtime, &targetArgs[sensorType])) != 0) {
       fprintf(stderr, "runtimeReportTargetDetectParams() failed: %d\n", res);
       return res;
     }
@@ -119,16 +260,20 @@ static int threadVideoSelectLoop(Runtime* _runtime, V4L2Input* _v4l2, FBOutput*
 
   case 0:
   default:
-    if (_runtime->m_config.m_rcConfig.m_sensorType == TRIK_CV_ALGORITHM_MXN_SENSOR) {
-      if ((res = runtimeReportTargetColors(_runtime, &(target.out_target.targetColors))) != 0) {
-        fprintf(stderr, "runtimeReportTargetColors() failed: %d\n", res);
+    // a single sensor reports as before, a set prefixes reports of every sensor with its name
+    if (secondarySensors != 0 && (res = runtimeReportSensor(_runtime, sensorType)) != 0)
+      return res;
+    if ((res = threadVideoReportTargets(_runtime, sensorType, &targetArgs[sensorType])) != 0)
+      return res;
+
+    int sensor;
+    for (sensor = 0; sensor < TRIK_CV_ALGORITHM_COUNT; ++sensor) {
+      if ((secondarySensors & TRIK_CV_ALGORITHM_BIT(sensor)) == 0)
+        continue;
+      if ((res = runtimeReportSensor(_runtime, (enum trik_cv_algorithm) sensor)) != 0)
         return res;
-      }
-    } else {
-      if ((res = runtimeReportTargetLocation(_runtime, &(target.out_target.targetLocation))) != 0) {
-        fprintf(stderr, "runtimeReportTargetLocation() failed: %d\n", res);
+      if ((res = threadVideoReportTargets(_runtime, (enum trik_cv_algorithm) sensor, &targetArgs[sensor])) != 0)
         return res;
-      }
     }
     break;
   }
@@ -140,13 +285,14 @@ int threadVideo(Runtime* runtime) {
   int res = 0;
   V4L2Input* v4l2;
   FBOutput* fb;
+  MJPEGOutput* mjpeg;
 
   if (runtime == NULL) {
     res = EINVAL;
     goto exit;
   }
 
-  if ((v4l2 = runtimeModV4L2Input(runtime)) == NULL || (fb = runtimeModFBOutput(runtime)) == NULL) {
+  if ((v4l2 = runtimeModV4L2Input(runtime)) == NULL || (fb = runtimeModFBOutput(runtime)) == NULL || (mjpeg = runtimeModMJPEGOutput(runtime)) == NULL) {
     res = EINVAL;
     goto exit;
   }
@@ -161,25 +307,30 @@ int threadVideo(Runtime* runtime) {
     goto exit_v4l2_close;
   }
 
+  if ((res = mjpegOutputOpen(mjpeg, runtimeCfgMJPEGOutput(runtime))) != 0) {
+    fprintf(stderr, "mjpegOutputOpen() failed: %d\n", res);
+    goto exit_fb_close;
+  }
+
   ImageDescription srcImageDesc;
   ImageDescription dstImageDesc;
   if ((res = v4l2InputGetFormat(v4l2, &srcImageDesc)) != 0) {
     fprintf(stderr, "v4l2InputGetFormat() failed: %d\n", res);
-    goto exit_fb_close;
+    goto exit_mjpeg_close;
   }
   if ((res = fbOutputGetFormat(fb, &dstImageDesc)) != 0) {
     fprintf(stderr, "fbOutputGetFormat() failed: %d\n", res);
-    goto exit_fb_close;
+    goto exit_mjpeg_close;
   }
 
-  if ((res = trik_req_cv_algorithm(runtime->m_config, srcImageDesc.m_lineLength)) < 0) {
+  if ((res = trik_req_cv_algorithm(runtime->m_config, srcImageDesc.m_width, srcImageDesc.m_height, srcImageDesc.m_lineLength)) < 0) {
     fprintf(stderr,"failed to request a cv algorithm %d", res);
     goto exit;
   }
 
   if ((res = v4l2InputStart(v4l2)) != 0) {
     fprintf(stderr, "v4l2InputStart() failed: %d\n", res);
-    goto exit_fb_close;
+    goto exit_mjpeg_close;
   }
 
   if ((res = fbOutputStart(fb)) != 0) {
@@ -187,17 +338,26 @@ int threadVideo(Runtime* runtime) {
     goto exit_v4l2_stop;
   }
 
+  if ((res = mjpegOutputStart(mjpeg)) != 0) {
+    fprintf(stderr, "mjpegOutputStart() failed: %d\n", res);
+    goto exit_fb_stop;
+  }
+
   printf("Entering video thread loop\n");
   struct timespec start, end;
   double elapsed;
   while (!runtimeGetTerminate(runtime)) {
-    if ((res = threadVideoSelectLoop(runtime, v4l2, fb)) != 0) {
+    if ((res = threadVideoSelectLoop(runtime, v4l2, fb, mjpeg)) != 0) {
       fprintf(stderr, "threadVideoSelectLoop() failed: %d\n", res);
-      goto exit_fb_stop;
+      goto exit_mjpeg_stop;
     }
   }
   printf("Exit video thread loop\n");
 
+exit_mjpeg_stop:
+  if ((res = mjpegOutputStop(mjpeg)) != 0)
+    fprintf(stderr, "mjpegOutputStop() failed: %d\n", res);
+
 exit_fb_stop:
   if ((res = fbOutputStop(fb)) != 0)
     fprintf(stderr, "fbOutputStop() failed: %d\n", res);
@@ -206,6 +366,10 @@ exit_v4l2_stop:
   if ((res = v4l2InputStop(v4l2)) != 0)
     fprintf(stderr, "v4l2InputStop() failed: %d\n", res);
 
+exit_mjpeg_close:
+  if ((res = mjpegOutputClose(mjpeg)) != 0)
+    fprintf(stderr, "mjpegOutputClose() failed: %d\n", res);
+
 exit_fb_close:
   if ((res = fbOutputClose(fb)) != 0)
     fprintf(stderr, "fbOutputClose() failed: %d\n", res);
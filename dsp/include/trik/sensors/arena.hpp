@@ -0,0 +1,63 @@
+#ifndef TRIK_SENSORS_ARENA_HPP_
+#define TRIK_SENSORS_ARENA_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace trik {
+namespace sensors {
+
+/*
+  Bump allocator for working buffers of a sensor.
+  All sensors are set up together for the requested frame geometry and carve buffers sized
+  for it in their setup; the arena is reset only when the geometry changes.
+  Nothing is freed individually. High-water mark survives resets and tells how large
+  the backing memory has to be for the sensors and geometries used so far.
+*/
+class Arena {
+private:
+  // allocations start on L2 cache line boundary
+  static const size_t m_alignment = 128;
+
+  int8_t* m_base;
+  size_t m_size;
+  size_t m_used;
+  size_t m_highWater;
+
+public:
+  Arena(int8_t* _base, size_t _size) {
+    m_base = _base;
+    m_size = _size;
+    m_used = 0;
+    m_highWater = 0;
+  }
+
+  void reset() { m_used = 0; }
+
+  // Returns NULL if the arena is exhausted
+  template <typename _T>
+  _T* alloc(const size_t _count) {
+    const size_t offset = (m_used + m_alignment - 1) & ~(m_alignment - 1);
+    const size_t size = _count * sizeof(_T);
+    if (offset > m_size || size > m_size - offset)
+      return NULL;
+
+    m_used = offset + size;
+    if (m_used > m_highWater)
+      m_highWater = m_used;
+    return reinterpret_cast<_T*>(m_base + offset);
+  }
+
+  size_t used() const { return m_used; }
+  size_t highWater() const { return m_highWater; }
+  size_t size() const { return m_size; }
+};
+
+}
+}
+
+#endif
@@ -19,8 +19,9 @@
 namespace trik {
 namespace sensors {
 
-static uint16_t s_hi2ho_bb[IMG_WIDTH];
-static uint8_t s_metapixFillerShifter_bb[IMG_WIDTH];
+// per input row, carved from the arena in setup
+static uint16_t* restrict s_hi2ho_bb = NULL;
+static uint8_t* restrict s_metapixFillerShifter_bb = NULL;
 
 class BitmapBuilderCvAlgorithm : public CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X> {
 private:
@@ -52,6 +53,15 @@ private:
   uint32_t m_detectSatTol;
   uint32_t m_detectValTol;
 
+  // window of the input image to build metapixels from, aligned to metapixels
+  uint32_t m_windowLeft;
+  uint32_t m_windowTop;
+  uint32_t m_windowRight;
+  uint32_t m_windowBottom;
+  // every m_windowStep pixel and row is sampled, a detected sample fills m_windowStep x m_windowStep metapixel bits
+  uint32_t m_windowStep;
+  uint32_t m_sampleMask;
+
   static bool __attribute__((always_inline)) detectHsvPixel(const uint32_t _hsv, const uint64_t _hsv_range, const uint32_t _hsv_expect) {
     const uint32_t u32_hsv_det = _cmpltu4(_hsv, _hill(_hsv_range)) | _cmpgtu4(_hsv, _loll(_hsv_range));
 
@@ -71,13 +81,18 @@ private:
   }
 
 public:
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
     m_inImageDesc = _inImageDesc;
     m_outImageDesc = _outImageDesc;
 
     if (m_inImageDesc.m_width % 32 != 0 || m_inImageDesc.m_height % 4 != 0)
       return false;
 
+    s_hi2ho_bb = _arena.alloc<uint16_t>(m_inImageDesc.m_height);
+    s_metapixFillerShifter_bb = _arena.alloc<uint8_t>(m_inImageDesc.m_height);
+    if (s_hi2ho_bb == NULL || s_metapixFillerShifter_bb == NULL)
+      return false;
+
     // 0 0 0 0 320 320 320 320 640 640 640 640 ...
     uint16_t* p_hi2ho = s_hi2ho_bb;
     for (uint16_t i = 0; i < m_inImageDesc.m_height; i++)
@@ -88,12 +103,86 @@ public:
     for (uint16_t i = 0; i < m_inImageDesc.m_height; i++)
       *(p_metapixFillerShifter++) = (i % METAPIX_SIZE) * METAPIX_SIZE;
 
+    setWindow(0, 0, m_inImageDesc.m_width, m_inImageDesc.m_height, 1);
+
     return true;
   }
 
-  virtual bool run(const ImageBuffer& _inImage, ImageBuffer& _outImage, const trik_cv_algorithm_in_args& _inArgs, trik_cv_algorithm_out_args& _outArgs) {
-    // /if (_inArgs.setHsvRange) {
+  // Pixels outside of the window are not looked at, their metapixels are left as they are
+  void setWindow(const uint32_t _left, const uint32_t _top, const uint32_t _right, const uint32_t _bottom, const uint32_t _step) {
+    assert(_left % METAPIX_SIZE == 0 && _top % METAPIX_SIZE == 0 && _right % METAPIX_SIZE == 0 && _bottom % METAPIX_SIZE == 0);
+    assert(_step == 1 || _step == 2 || _step == METAPIX_SIZE);
+    m_windowLeft = _left;
+    m_windowTop = _top;
+    m_windowRight = _right;
+    m_windowBottom = _bottom;
+    m_windowStep = _step;
+    m_sampleMask = _step == 1 ? 0x0001 : (_step == 2 ? 0x0033 : 0xffff);
+  }
+
+  /*
+    Counts pixels of [_left.._right) x [_top.._bottom) matching HSV range of the last run,
+    every pixel is looked at regardless of window step. Column and row sums of matches are
+    added to _sumCol and _sumRow.
+  */
+  uint32_t detectWindow(const ImageBuffer& _inImage, const uint32_t _left, const uint32_t _top, const uint32_t _right, const uint32_t _bottom,
+    int32_t& _sumCol, int32_t& _sumRow) const {
+    const uint32_t* restrict inImg = reinterpret_cast<const uint32_t*>(_inImage.m_ptr);
+    const uint64_t u64_hsv_range = m_detectRange;
+    const uint32_t u32_hsv_expect = m_detectExpected;
+    uint32_t points = 0;
+    int32_t sumCol = 0;
+    int32_t sumRow = 0;
+
+    for (uint32_t srcRow = _top; srcRow < _bottom; ++srcRow) {
+      const uint32_t* restrict p_inImg = inImg + srcRow * m_inImageDesc.m_width;
+      uint32_t rowPoints = 0;
+
+#pragma MUST_ITERATE(32, , 32)
+      for (uint32_t srcCol = _left; srcCol < _right; ++srcCol) {
+        const bool det = detectHsvPixel(p_inImg[srcCol], u64_hsv_range, u32_hsv_expect);
+        rowPoints += det;
+        sumCol += det ? srcCol : 0;
+      }
+
+      points += rowPoints;
+      sumRow += rowPoints * srcRow;
+    }
+
+    _sumCol += sumCol;
+    _sumRow += sumRow;
+    return points;
+  }
+
+  // Same as detectWindow, on pixels of a class frame having _classBit set
+  uint32_t detectWindowClasses(const uint8_t* restrict _classFrame, const uint32_t _classBit, const uint32_t _left, const uint32_t _top, const uint32_t _right,
+    const uint32_t _bottom, int32_t& _sumCol, int32_t& _sumRow) const {
+    uint32_t points = 0;
+    int32_t sumCol = 0;
+    int32_t sumRow = 0;
+
+    for (uint32_t srcRow = _top; srcRow < _bottom; ++srcRow) {
+      const uint8_t* restrict classRow = _classFrame + srcRow * m_inImageDesc.m_width;
+      uint32_t rowPoints = 0;
 
+#pragma MUST_ITERATE(32, , 32)
+      for (uint32_t srcCol = _left; srcCol < _right; ++srcCol) {
+        const bool det = (classRow[srcCol] & _classBit) != 0;
+        rowPoints += det;
+        sumCol += det ? srcCol : 0;
+      }
+
+      points += rowPoints;
+      sumRow += rowPoints * srcRow;
+    }
+
+    _sumCol += sumCol;
+    _sumRow += sumRow;
+    return points;
+  }
+
+  // Takes HSV range from in args, run does it on its own
+  void setHsvRange(const trik_cv_algorithm_in_args& _inArgs) {
     m_detectHueFrom = range<int16_t>(0, (_inArgs.detect_hue_from * 255) / 359, 255); // scaling 0..359 to 0..255
     m_detectHueTo = range<int16_t>(0, (_inArgs.detect_hue_to * 255) / 359, 255);     // scaling 0..359 to 0..255
     m_detectSatFrom = range<int16_t>(0, (_inArgs.detect_sat_from * 255) / 100, 255); // scaling 0..100 to 0..255
@@ -102,7 +191,33 @@ public:
     m_detectValTo = range<int16_t>(0, (_inArgs.detect_val_to * 255) / 100, 255);     // scaling 0..100 to 0..255
 
     resetHsvRange();
-    // }
+  }
+
+  uint64_t detectRange() const { return m_detectRange; }
+  uint32_t detectExpected() const { return m_detectExpected; }
+
+  // Builds metapixels from pixels of a class frame having _classBit set, range is the one of setHsvRange
+  void runClasses(const uint8_t* restrict _classFrame, const uint32_t _classBit, ImageBuffer& _outImage) {
+    uint16_t* restrict outImg = reinterpret_cast<uint16_t*>(_outImage.m_ptr);
+    const uint32_t step = m_windowStep;
+    const uint32_t sampleMask = m_sampleMask;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint16_t srcRow = m_windowTop; srcRow < m_windowBottom; srcRow += step) {
+      const uint8_t* restrict classRow = _classFrame + srcRow * m_inImageDesc.m_width;
+      uint16_t* restrict p_outImg = outImg + s_hi2ho_bb[srcRow];
+      const uint16_t metapixFillerShifter = s_metapixFillerShifter_bb[srcRow]; //(0 4 8 12)...
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint16_t srcCol = m_windowLeft; srcCol < m_windowRight; srcCol += step) {
+        const bool det = (classRow[srcCol] & _classBit) != 0;
+        p_outImg[srcCol / METAPIX_SIZE] |= (det ? sampleMask : 0) << (metapixFillerShifter + srcCol % METAPIX_SIZE);
+      }
+    }
+  }
+
+  virtual bool run(const ImageBuffer& _inImage, ImageBuffer& _outImage, const trik_cv_algorithm_in_args& _inArgs, trik_cv_algorithm_out_args& _outArgs) {
+    setHsvRange(_inArgs);
 
     const uint64_t u64_hsv_range = m_detectRange;
     const uint32_t u32_hsv_expect = m_detectExpected;
@@ -120,8 +235,10 @@ public:
           |12|13|14|15|
           -------------
     */
-    const uint64_t* restrict p_inImg = reinterpret_cast<const uint64_t*>(_inImage.m_ptr);
-    const uint16_t* restrict p_hi2ho = s_hi2ho_bb;
+    const uint32_t* restrict inImg = reinterpret_cast<const uint32_t*>(_inImage.m_ptr);
+    uint16_t* restrict outImg = reinterpret_cast<uint16_t*>(_outImage.m_ptr);
+    const uint32_t step = m_windowStep;
+    const uint32_t sampleMask = m_sampleMask;
 
     int64_t detectedPoints = 0;
 #ifdef HSV_CORRECTION
@@ -132,17 +249,16 @@ public:
 #endif
 
     // just detect and build metapixels:
-    uint8_t* restrict p_metapixFillerShifter = s_metapixFillerShifter_bb;
-    uint8_t metapixFiller = 0;
     U_Hsv8x3 pixel;
-#pragma MUST_ITERATE(4, , 4)
-    for (uint16_t srcRow = 0; srcRow < m_inImageDesc.m_height; srcRow++) {
-      uint16_t* restrict p_outImg = reinterpret_cast<uint16_t*>(_outImage.m_ptr) + *(p_hi2ho++);
-      const uint16_t metapixFillerShifter = *(p_metapixFillerShifter++); //(0 4 8 12)...
-
-#pragma MUST_ITERATE(32, , 32)
-      for (uint16_t srcCol = 0; srcCol < m_inImageDesc.m_width; srcCol++) {
-        pixel.whole = _loll(*(p_inImg++));
+#pragma MUST_ITERATE(1, , )
+    for (uint16_t srcRow = m_windowTop; srcRow < m_windowBottom; srcRow += step) {
+      const uint32_t* restrict p_inImg = inImg + srcRow * m_inImageDesc.m_width;
+      uint16_t* restrict p_outImg = outImg + s_hi2ho_bb[srcRow];
+      const uint16_t metapixFillerShifter = s_metapixFillerShifter_bb[srcRow]; //(0 4 8 12)...
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint16_t srcCol = m_windowLeft; srcCol < m_windowRight; srcCol += step) {
+        pixel.whole = p_inImg[srcCol];
         bool det = detectHsvPixel(pixel.whole, u64_hsv_range, u32_hsv_expect);
 
 #ifdef HSV_CORRECTION
@@ -152,12 +268,7 @@ public:
           detectedPoints++;
         }
 #endif
-        *p_outImg += det << (metapixFillerShifter + metapixFiller++);
-
-        if (metapixFiller == METAPIX_SIZE) {
-          p_outImg++;
-          metapixFiller = 0;
-        }
+        p_outImg[srcCol / METAPIX_SIZE] |= (det ? sampleMask : 0) << (metapixFillerShifter + srcCol % METAPIX_SIZE);
       }
     }
 
@@ -0,0 +1,163 @@
+#ifndef TRIK_SENSORS_BITMAP_MORPHOLOGY_HPP_
+#define TRIK_SENSORS_BITMAP_MORPHOLOGY_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <trik/sensors/cv_algorithms.hpp>
+
+#include <stdint.h>
+#include <string.h>
+
+#include <c6x.h>
+#include <cassert>
+
+extern "C" {
+#include <ti/imglib/src/IMG_dilate_bin/IMG_dilate_bin.h>
+#include <ti/imglib/src/IMG_erode_bin/IMG_erode_bin.h>
+}
+
+#include "image.hpp"
+#include <trik/sensors/video_format.h>
+
+namespace trik {
+namespace sensors {
+
+// two packed bitmaps passes go back and forth between, carved from the arena in setup
+static uint8_t* restrict s_morphologyBits = NULL;
+static uint8_t* restrict s_morphologyBitsTmp = NULL;
+
+// 3x3 square, every neighbour counts
+static const char s_morphologyMask[9] = { 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+
+/*
+  Binary erosion and dilation of detected metapixels, before they are clustered.
+  Metapixels detected the way clusterizer counts them are packed one bit each, LSB first;
+  IMG_erode_bin and IMG_dilate_bin then run row by row with a 3x3 square mask.
+  Kernels put the result of a window one bit left of its center, so every packed row keeps
+  a zero column left of the frame, rows above and below the frame are zero as well,
+  and rows are shifted back after every pass.
+  Metapixel map is rewritten in place with all or none of the bits of a metapixel set.
+*/
+class BitmapMorphologyCvAlgorithm : public CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X> {
+private:
+  ImageDesc m_inImageDesc;
+  ImageDesc m_outImageDesc;
+
+  // bytes in a packed row, multiple of 8 as kernels require, with room for the zero columns
+  uint32_t m_rowBytes;
+  // bits of a packed row holding metapixels
+  uint32_t m_rowMask[(IMG_WIDTH_MAX / METAPIX_SIZE + 2 + 63) / 32];
+
+  uint32_t packedRowOffset(const uint32_t _row) const { return (_row + 1) * m_rowBytes; }
+
+  void pack(const uint16_t* restrict _bitmap, uint8_t* _bits) {
+    const uint32_t width = m_inImageDesc.m_width;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t row = 0; row < m_inImageDesc.m_height; ++row) {
+      const uint16_t* restrict metapix = _bitmap + row * width;
+      uint32_t* restrict packed = reinterpret_cast<uint32_t*>(_bits + packedRowOffset(row));
+      memset(packed, 0, m_rowBytes);
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < width; ++col) {
+        const uint32_t det = pop(metapix[col]) > METAPIX_SIZE / 2;
+        packed[(col + 1) / 32] |= det << ((col + 1) % 32);
+      }
+    }
+  }
+
+  void unpack(const uint8_t* _bits, uint16_t* restrict _bitmap) {
+    const uint32_t width = m_inImageDesc.m_width;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t row = 0; row < m_inImageDesc.m_height; ++row) {
+      uint16_t* restrict metapix = _bitmap + row * width;
+      const uint32_t* restrict packed = reinterpret_cast<const uint32_t*>(_bits + packedRowOffset(row));
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < width; ++col)
+        metapix[col] = ((packed[(col + 1) / 32] >> ((col + 1) % 32)) & 0x1) ? 0xffff : 0x0000;
+    }
+  }
+
+  // Runs a kernel from _in to _out and moves result back one bit right, to the columns of _in
+  void pass(const bool _erode, const uint8_t* _in, uint8_t* _out) {
+    const uint32_t words = m_rowBytes / sizeof(uint32_t);
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t row = 0; row < m_inImageDesc.m_height; ++row) {
+      const uint8_t* above = _in + row * m_rowBytes;
+      uint8_t* out = _out + packedRowOffset(row);
+      if (_erode)
+        IMG_erode_bin(above, out, s_morphologyMask, m_rowBytes);
+      else
+        IMG_dilate_bin(above, out, s_morphologyMask, m_rowBytes);
+
+      uint32_t* restrict packed = reinterpret_cast<uint32_t*>(out);
+      uint32_t carry = 0;
+#pragma MUST_ITERATE(2, , 2)
+      for (uint32_t word = 0; word < words; ++word) {
+        const uint32_t bits = packed[word];
+        packed[word] = ((bits << 1) | carry) & m_rowMask[word];
+        carry = bits >> 31;
+      }
+    }
+  }
+
+public:
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
+    m_inImageDesc = _inImageDesc;
+    m_outImageDesc = _outImageDesc;
+
+    if (m_inImageDesc.m_width > IMG_WIDTH_MAX / METAPIX_SIZE || m_inImageDesc.m_height == 0)
+      return false;
+
+    m_rowBytes = ((m_inImageDesc.m_width + 2 + 63) / 64) * 8;
+    for (uint32_t word = 0; word < m_rowBytes / sizeof(uint32_t); ++word) {
+      m_rowMask[word] = 0;
+      for (uint32_t bit = 0; bit < 32; ++bit)
+        if (word * 32 + bit >= 1 && word * 32 + bit <= m_inImageDesc.m_width)
+          m_rowMask[word] |= 1u << bit;
+    }
+
+    // kernels read a few bytes past the row below the last one
+    const uint32_t size = m_rowBytes * (m_inImageDesc.m_height + 2) + 8;
+    s_morphologyBits = _arena.alloc<uint8_t>(size);
+    s_morphologyBitsTmp = _arena.alloc<uint8_t>(size);
+    if (s_morphologyBits == NULL || s_morphologyBitsTmp == NULL)
+      return false;
+
+    // only rows of the frame are ever written
+    memset(s_morphologyBits, 0, size);
+    memset(s_morphologyBitsTmp, 0, size);
+    return true;
+  }
+
+  virtual bool run(const ImageBuffer& _inImage, ImageBuffer& _outImage, const trik_cv_algorithm_in_args& _inArgs, trik_cv_algorithm_out_args& _outArgs) {
+    const uint32_t morphology = _inArgs.morphology;
+    if (morphology == TRIK_MORPHOLOGY_NONE || morphology > TRIK_MORPHOLOGY_CLOSE)
+      return true;
+
+    pack(reinterpret_cast<const uint16_t*>(_inImage.m_ptr), s_morphologyBits);
+    if (morphology == TRIK_MORPHOLOGY_ERODE || morphology == TRIK_MORPHOLOGY_DILATE) {
+      pass(morphology == TRIK_MORPHOLOGY_ERODE, s_morphologyBits, s_morphologyBitsTmp);
+      unpack(s_morphologyBitsTmp, reinterpret_cast<uint16_t*>(_outImage.m_ptr));
+    } else {
+      // opening drops specks, closing fills holes and joins pieces split by a metapixel
+      const bool open = morphology == TRIK_MORPHOLOGY_OPEN;
+      pass(open, s_morphologyBits, s_morphologyBitsTmp);
+      pass(!open, s_morphologyBitsTmp, s_morphologyBits);
+      unpack(s_morphologyBits, reinterpret_cast<uint16_t*>(_outImage.m_ptr));
+    }
+
+    return true;
+  }
+};
+
+}
+}
+
+#endif
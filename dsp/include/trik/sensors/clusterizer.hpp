@@ -28,14 +28,22 @@
 namespace trik {
 namespace sensors {
 
+// sums are over metapixel coordinates of the cluster
 typedef struct Target {
   int32_t x;
   int32_t y;
   int32_t size;
+  // second order, for orientation and elongation
+  int32_t xx;
+  int32_t yy;
+  int32_t xy;
+  // bounding box in metapixels, inclusive
+  int32_t left;
+  int32_t top;
+  int32_t right;
+  int32_t bottom;
 } Target;
 
-static inline bool compareTargetBySize(const Target& a, const Target& b) { return a.size > b.size; }
-
 class ClusterizerCvAlgorithm : public CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X> {
 private:
   ImageDesc m_inImageDesc;
@@ -46,6 +54,10 @@ private:
 
   uint16_t m_maxCluster;
 
+  // largest clusters, largest first, picked without sorting the rest
+  uint32_t m_topCount;
+  uint16_t m_top[TRIK_MAX_TARGET_COUNT];
+
   uint16_t min2(uint16_t* envPixs) {
     uint16_t v = envPixs[0];
     for (int n = 1; n < 4; n++)
@@ -55,11 +67,47 @@ private:
     return v;
   }
 
-  bool isClustersEqual(const uint16_t cluster1, const uint16_t cluster2) {
-    if (cluster1 == cluster2)
-      return true;
-    else
-      return (equalClusters[cluster1] == equalClusters[cluster2]);
+  // Clusters only ever get linked to lower ones, so the root of a chain is its lowest cluster
+  uint16_t rootCluster(uint16_t _cluster) {
+    while (equalClusters[_cluster] != _cluster) {
+      equalClusters[_cluster] = equalClusters[equalClusters[_cluster]];
+      _cluster = equalClusters[_cluster];
+    }
+    return _cluster;
+  }
+
+  void linkClusters(const uint16_t _cluster1, const uint16_t _cluster2) {
+    const uint16_t root1 = rootCluster(_cluster1);
+    const uint16_t root2 = rootCluster(_cluster2);
+    if (root1 < root2)
+      equalClusters[root2] = root1;
+    else if (root2 < root1)
+      equalClusters[root1] = root2;
+  }
+
+  void addPixel(Target& _cluster, const int _r, const int _c) {
+    _cluster.x += _c;
+    _cluster.y += _r;
+    _cluster.xx += _c * _c;
+    _cluster.yy += _r * _r;
+    _cluster.xy += _c * _r;
+    _cluster.size++;
+  }
+
+  void insertTop(const uint16_t _cluster) {
+    const int32_t size = clusters[_cluster].size;
+    uint32_t idx = m_topCount;
+    if (idx == TRIK_MAX_TARGET_COUNT) {
+      if (size <= clusters[m_top[idx - 1]].size)
+        return;
+      --idx;
+    } else {
+      ++m_topCount;
+    }
+
+    for (; idx > 0 && clusters[m_top[idx - 1]].size < size; --idx)
+      m_top[idx] = m_top[idx - 1];
+    m_top[idx] = _cluster;
   }
 
   /*
@@ -92,15 +140,17 @@ private:
     uint16_t localMinCluster;
     if (localMinCluster = min2(a)) {
       *pixPtr = localMinCluster;
-      clusters[localMinCluster].x += c;
-      clusters[localMinCluster].y += r;
-      clusters[localMinCluster].size++;
+      addPixel(clusters[localMinCluster], r, c);
+      if (c < clusters[localMinCluster].left)
+        clusters[localMinCluster].left = c;
+      if (c > clusters[localMinCluster].right)
+        clusters[localMinCluster].right = c;
+      clusters[localMinCluster].bottom = r; // rows are scanned top to bottom
 
 #pragma MUST_ITERATE(4, , 4)
       for (int i = 0; i < ENV_PIXS; i++)
-        if (a[i]) // if no bg
-          if (!isClustersEqual(a[i], localMinCluster))
-            equalClusters[a[i]] = equalClusters[localMinCluster];
+        if (a[i] && a[i] != localMinCluster) // if no bg
+          linkClusters(a[i], localMinCluster);
 
     } else { // no clusters around
       *pixPtr = m_maxCluster;
@@ -108,6 +158,11 @@ private:
 
       Target cluster;
       memset(&cluster, 0, sizeof(Target));
+      addPixel(cluster, r, c);
+      cluster.left = c;
+      cluster.top = r;
+      cluster.right = c;
+      cluster.bottom = r;
       clusters.push_back(cluster);
       m_maxCluster++;
     }
@@ -115,16 +170,33 @@ private:
 
   void postProcessing() // link clusters
   {
-    for (int i = 0; i < equalClusters.size(); i++) {
-      if (i != equalClusters[i]) {
-        clusters[equalClusters[i]].x += clusters[i].x;
-        clusters[equalClusters[i]].y += clusters[i].y;
-        clusters[equalClusters[i]].size += clusters[i].size;
+    m_topCount = 0;
+    for (int i = 1; i < equalClusters.size(); i++) {
+      const uint16_t rootIdx = rootCluster(i);
+      if (i != rootIdx) {
+        Target& root = clusters[rootIdx];
+        root.x += clusters[i].x;
+        root.y += clusters[i].y;
+        root.size += clusters[i].size;
+        root.xx += clusters[i].xx;
+        root.yy += clusters[i].yy;
+        root.xy += clusters[i].xy;
+        if (clusters[i].left < root.left)
+          root.left = clusters[i].left;
+        if (clusters[i].top < root.top)
+          root.top = clusters[i].top;
+        if (clusters[i].right > root.right)
+          root.right = clusters[i].right;
+        if (clusters[i].bottom > root.bottom)
+          root.bottom = clusters[i].bottom;
         clusters[i].size = 0;
       }
     }
 
-    std::sort(clusters.begin(), clusters.end(), compareTargetBySize);
+    // only the targets reported are ordered
+    for (int i = 1; i < equalClusters.size(); i++)
+      if (clusters[i].size > 0)
+        insertTop(i);
   }
 
 public:
@@ -139,13 +211,35 @@ public:
     return amount; // others have 0 size
   }
 
-  int32_t getX(int i) { return (clusters[i].x / (clusters[i].size + 1)) * METAPIX_SIZE; }
+  // Clusters below are the largest ones, i-th largest first; those past the found ones are empty
+
+  // centroid in source pixels
+  int32_t getX(int i) { return i < m_topCount ? ((2 * clusters[m_top[i]].x + clusters[m_top[i]].size) * METAPIX_SIZE) / (2 * clusters[m_top[i]].size) : 0; }
 
-  int32_t getY(int i) { return (clusters[i].y / (clusters[i].size + 1)) * METAPIX_SIZE; }
+  int32_t getY(int i) { return i < m_topCount ? ((2 * clusters[m_top[i]].y + clusters[m_top[i]].size) * METAPIX_SIZE) / (2 * clusters[m_top[i]].size) : 0; }
 
-  uint16_t getSize(int i) { return clusters[i].size; }
+  // area in metapixels
+  uint16_t getSize(int i) { return i < m_topCount ? clusters[m_top[i]].size : 0; }
+
+  // bounding box in source pixels, [left..right) x [top..bottom)
+  void getBox(int i, int32_t& _left, int32_t& _top, int32_t& _right, int32_t& _bottom) {
+    const Target& cluster = clusters[m_top[i]];
+    _left = cluster.left * METAPIX_SIZE;
+    _top = cluster.top * METAPIX_SIZE;
+    _right = (cluster.right + 1) * METAPIX_SIZE;
+    _bottom = (cluster.bottom + 1) * METAPIX_SIZE;
+  }
+
+  // central second order moments in metapixels squared, times area
+  void getMoments(int i, int64_t& _mu20, int64_t& _mu02, int64_t& _mu11) {
+    const Target& cluster = clusters[m_top[i]];
+    const int64_t size = cluster.size;
+    _mu20 = size * cluster.xx - static_cast<int64_t>(cluster.x) * cluster.x;
+    _mu02 = size * cluster.yy - static_cast<int64_t>(cluster.y) * cluster.y;
+    _mu11 = size * cluster.xy - static_cast<int64_t>(cluster.x) * cluster.y;
+  }
 
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
     m_inImageDesc = _inImageDesc;
     m_outImageDesc = _outImageDesc;
 
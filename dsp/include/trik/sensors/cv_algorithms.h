@@ -10,9 +10,26 @@ extern "C" {
 #include <trik/sensors/cv_algorithm_args.h>
 #include <trik/sensors/video_format.h>
 
-int trik_init_cv_algorithm(enum trik_cv_algorithm algorithm, enum VideoFormat video_format, uint32_t line_length);
+/*
+  Selects primary algorithm drawing the preview and secondary ones, mask of TRIK_CV_ALGORITHM_BIT, running on the same frames.
+  All algorithms are set up when frame geometry changes, switching between them on the same geometry takes no setup.
+*/
+int trik_init_cv_algorithms(enum trik_cv_algorithm primary, uint32_t secondary, enum VideoFormat video_format, uint32_t width, uint32_t height,
+  uint32_t line_length);
+// set actually selected, primary is TRIK_CV_ALGORITHM_NONE if a rejected geometry change left none
+void trik_get_cv_algorithms(enum trik_cv_algorithm* primary, uint32_t* secondary);
+// new input frame, features computed for the previous one are dropped
+void trik_begin_cv_frame(void);
+// bytes of the working memory arena taken by the sensors, most ever taken and total
+void trik_get_cv_algorithm_arena(uint32_t* used, uint32_t* high_water, uint32_t* size);
+// byte range of the output buffer written by the last run of the algorithm, empty if nothing was drawn
+void trik_get_cv_algorithm_out_dirty(enum trik_cv_algorithm algorithm, uint32_t* offset, uint32_t* size);
 int trik_run_cv_algorithm(enum trik_cv_algorithm algorithm, struct buffer in_buffer, struct buffer out_buffer, struct trik_cv_algorithm_in_args in_args,
   struct trik_cv_algorithm_out_args* out_args);
+// statistics of the frame sensors run on, after conversion from the camera format
+int trik_get_cv_frame_stats(struct buffer in_buffer, struct trik_frame_stats* stats);
+// JPEG of the preview rows shown on the display, quality in [1..100], fails if it does not fit jpeg_buffer
+int trik_encode_cv_preview(struct buffer out_buffer, uint32_t quality, struct buffer jpeg_buffer, uint32_t* jpeg_size);
 
 #ifdef __cplusplus
 }
@@ -9,11 +9,13 @@
 #include <cassert>
 #include <cmath>
 #include <stdint.h>
+#include <string.h>
 
+#include "arena.hpp"
+#include "feature_cache.hpp"
 #include "image.hpp"
 #include <trik/sensors/video_format.h>
 #include <trik/sensors/cv_algorithm_args.h>
-#include <ti/sysbios/family/c64p/Cache.h>
 
 namespace trik {
 namespace sensors {
@@ -58,35 +60,390 @@ inline int makeValueWrap(int _val, int _adj, int _min, int _max) {
   return _val;
 }
 
+/*
+  YUV classifier: luma and the two chroma bytes of a YUYV pair quantized to 6, 5 and 5 bits
+  index a table of pixel classes. Bit N of a class is set if the bin center is in HSV range N,
+  the table is rebuilt only when a range changes and its 64KB stay in L2 cache while a frame
+  is classified. Ranges are owned by the sensors comparing pixels against them.
+*/
+#define YUV_CLASS_LUT_SIZE (1u << 16)
+#define YUV_CLASS_RANGES 8
+#define YUV_CLASS_OBJECT 0
+
 template <VideoFormat _inFormat, VideoFormat _outFormat>
 class CvAlgorithm {
 public:
   // CvAlgorithm(const CvAlgorithm& another) = delete;
   // CvAlgorithm& operator=(const CvAlgorithm& another) = delete;
 
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) = 0;
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) = 0;
   virtual bool run(const ImageBuffer& _inImage, ImageBuffer& _outImage, const trik_cv_algorithm_in_args& in_args, trik_cv_algorithm_out_args& out_args) = 0;
 
+  // Called when the sensor gets selected again after frames it did not run on
+  virtual void restart() {}
+
   virtual ~CvAlgorithm() {}
 
+  /*
+    Frame sized buffers are shared by all sensors set up on one arena, the first one to set up
+    allocates them. Called when the arena is reset, before setting up sensors for a new geometry.
+  */
+  static void releaseFrameBuffers() {
+    s_hsvFrame = NULL;
+    s_wi2wo = NULL;
+    s_hi2ho = NULL;
+    s_classLut = NULL;
+    s_classFrame = NULL;
+    s_classRangesUsed = 0;
+    s_classLutValid = false;
+    s_featureCache.drop();
+  }
+
+  // Called by the server before every run, nothing of the preview is dirty yet
+  void resetOutputDirty() {
+    m_outDirtyTop = m_outImageDesc.m_height;
+    m_outDirtyBottom = 0;
+  }
+
+  // Byte range of the preview written by the last run, the server writes back only that
+  void getOutputDirty(uint32_t& _offset, uint32_t& _size) const {
+    if (m_outDirtyTop >= m_outDirtyBottom) {
+      _offset = 0;
+      _size = 0;
+      return;
+    }
+    _offset = m_outDirtyTop * m_outImageDesc.m_lineLength;
+    _size = (m_outDirtyBottom - m_outDirtyTop) * m_outImageDesc.m_lineLength;
+  }
+
 protected:
   typedef void (CvAlgorithm::*ConvertFuncPtr)(const ImageBuffer&);
   ConvertFuncPtr convertImageFormatToHSV = nullptr;
+  ConvertFuncPtr convertImageFormatToHSVFull = nullptr;
+  ConvertFuncPtr convertImageFormatToHSVDecimated = nullptr;
+
+  typedef void (CvAlgorithm::*ClassifyFuncPtr)(const ImageBuffer&, const FeatureWindow&);
+  ClassifyFuncPtr classifyImageFormat = nullptr;
 
   ImageDesc m_inImageDesc;
   ImageDesc m_outImageDesc;
 
-  static uint64_t s_rgb888hsv[IMG_WIDTH * IMG_HEIGHT];
-  static uint32_t s_wi2wo[IMG_WIDTH];
-  static uint32_t s_hi2ho[IMG_HEIGHT];
+  // frame sized buffers are carved from the arena in setup, HSV frame only by sensors which convert to it
+  static uint32_t* restrict s_hsvFrame;
+  static uint32_t* restrict s_wi2wo;
+  static uint32_t* restrict s_hi2ho;
 
   static uint16_t* restrict s_mult43_div;
   static uint16_t* restrict s_mult255_div;
 
-  static void __attribute__((always_inline)) writeOutputPixel(uint16_t* restrict _rgb565ptr, const uint32_t _rgb888) {
-    *_rgb565ptr = ((_rgb888 >> 3) & 0x001f) | ((_rgb888 >> 5) & 0x07e0) | ((_rgb888 >> 8) & 0xf800);
+  // YUV classifier table and class frame, carved from the arena only by sensors which classify
+  static uint8_t* restrict s_classLut;
+  static uint8_t* restrict s_classFrame;
+  static uint64_t s_classRange[YUV_CLASS_RANGES];
+  static uint32_t s_classExpected[YUV_CLASS_RANGES];
+  static uint32_t s_classRangesUsed;
+  static bool s_classLutValid;
+  static uint32_t s_classLutVersion;
+
+  // processing window in source pixels, [left..right) x [top..bottom), every m_roiRowStep row
+  uint32_t m_roiLeft;
+  uint32_t m_roiTop;
+  uint32_t m_roiRight;
+  uint32_t m_roiBottom;
+  uint32_t m_roiRowStep;
+  // every m_decimation column of the window is processed, m_roiRowStep is a multiple of it
+  uint32_t m_decimation;
+
+  // preview rows written by the current run, [m_outDirtyTop..m_outDirtyBottom); overlays are drawn from const methods
+  mutable uint32_t m_outDirtyTop;
+  mutable uint32_t m_outDirtyBottom;
+
+  // sampled source column drawn on every preview column, for m_previewStep; carved from the arena in setup
+  uint16_t* m_wo2wi = NULL;
+  uint32_t m_previewStep;
+
+  void __attribute__((always_inline)) markOutputRows(const uint32_t _dstTop, const uint32_t _dstBottom) const {
+    if (_dstTop < m_outDirtyTop)
+      m_outDirtyTop = _dstTop;
+    if (_dstBottom > m_outDirtyBottom)
+      m_outDirtyBottom = _dstBottom;
+  }
+
+  // Preview of source rows [_srcTop.._srcBottom) lands on these output rows
+  void markOutputSourceRows(const uint32_t _srcTop, const uint32_t _srcBottom) const {
+    if (_srcTop < _srcBottom)
+      markOutputRows(s_hi2ho[_srcTop], s_hi2ho[_srcBottom - 1] + 1);
+  }
+
+  bool isRoiFullFrame() const {
+    return m_roiLeft == 0 && m_roiTop == 0 && m_roiRight == m_inImageDesc.m_width && m_roiBottom == m_inImageDesc.m_height && m_roiRowStep == 1;
+  }
+
+  /*
+    Takes processing window from in args. Columns are aligned to 32 and rows to 4, so the window
+    keeps loop trip counts of the full frame. Empty window means the whole frame; the whole frame
+    is also used while HSV auto detection is running, since it samples the frame center.
+    Row step is only honored if _rowStepAllowed, sensors which need adjacent rows pass false.
+    Decimation of 2 or 4 samples every 2nd or 4th column and row of the window, coordinates
+    stay in source pixels. It also selects the matching HSV converter.
+    Returns true if the window or decimation has changed since previous frame.
+  */
+  bool setupRoi(const trik_cv_algorithm_in_args& _inArgs, const bool _rowStepAllowed) {
+    const RoiParams& roi = _inArgs.roi;
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t height = m_inImageDesc.m_height;
+
+    uint32_t left = 0;
+    uint32_t top = 0;
+    uint32_t right = width;
+    uint32_t bottom = height;
+    uint32_t rowStep = 1;
+    uint32_t decimation = 1;
+
+    if (!_inArgs.auto_detect_hsv && (_inArgs.decimation == 2 || _inArgs.decimation == 4))
+      decimation = _inArgs.decimation;
+
+    if (!_inArgs.auto_detect_hsv && roi.left < roi.right && roi.top < roi.bottom) {
+      left = ((range<uint32_t>(0, roi.left, 100) * width / 100) / 32) * 32;
+      right = ((range<uint32_t>(0, roi.right, 100) * width / 100 + 31) / 32) * 32;
+      top = ((range<uint32_t>(0, roi.top, 100) * height / 100) / 4) * 4;
+      bottom = ((range<uint32_t>(0, roi.bottom, 100) * height / 100 + 3) / 4) * 4;
+      if (left >= right || top >= bottom) {
+        left = 0;
+        top = 0;
+        right = width;
+        bottom = height;
+      }
+      if (_rowStepAllowed && roi.row_step > 1)
+        rowStep = roi.row_step;
+    }
+
+    rowStep *= decimation;
+
+    const bool changed = left != m_roiLeft || top != m_roiTop || right != m_roiRight || bottom != m_roiBottom || rowStep != m_roiRowStep
+                         || decimation != m_decimation;
+    m_roiLeft = left;
+    m_roiTop = top;
+    m_roiRight = right;
+    m_roiBottom = bottom;
+    m_roiRowStep = rowStep;
+    m_decimation = decimation;
+    convertImageFormatToHSV = decimation > 1 ? convertImageFormatToHSVDecimated : convertImageFormatToHSVFull;
+    return changed;
+  }
+
+  // Source row is the last one of the sampled ones [.._srcRowTop) drawn on its preview row
+  bool isOutputSourceRow(const uint32_t _srcRow, const uint32_t _rowStep, const uint32_t _srcRowTop) const {
+    return _srcRow + _rowStep >= _srcRowTop || s_hi2ho[_srcRow + _rowStep] != s_hi2ho[_srcRow];
+  }
+
+  /*
+    Preview row writer shared by sensors. Preview is written by its own pixels rather than by
+    source ones: every preview pixel of the row is converted once, from the last sampled source
+    column drawn on it or the nearest one left of it when decimation leaves it without one, and
+    is stored along with 3 others. Downscaled preview thus costs what is shown, not what is read.
+    _pixel(srcCol) gives RGB888 of a source pixel; columns are every m_decimation one of
+    [_srcColBot.._srcColTop), _srcColBot is a multiple of m_decimation.
+    Rows mapped to the same preview row are left to the caller, see isOutputSourceRow.
+  */
+  template <typename _Pixel>
+  void writeOutputRow(const ImageBuffer& _outImage, const uint32_t _srcRow, const uint32_t _srcColBot, const uint32_t _srcColTop, const _Pixel& _pixel) {
+    const uint32_t step = m_decimation;
+    assert(_srcColBot % step == 0);
+    if (_srcColBot >= _srcColTop)
+      return;
+    if (m_previewStep != step)
+      setupOutputColumns(step);
+
+    const uint32_t srcColLast = _srcColBot + ((_srcColTop - 1 - _srcColBot) / step) * step;
+    const uint32_t dstColBot = s_wi2wo[_srcColBot];
+    const uint32_t dstColTop = s_wi2wo[srcColLast] + 1;
+    const uint32_t dstRow = s_hi2ho[_srcRow];
+    uint16_t* restrict dstImageRow = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstRow * m_outImageDesc.m_lineLength);
+    const uint16_t* restrict wo2wi = m_wo2wi;
+    markOutputRows(dstRow, dstRow + 1);
+
+    // only the last preview column can be drawn from a sampled column past the last one
+    const uint32_t dstColLast = dstColTop - 1;
+    uint32_t dstCol = dstColBot;
+    for (; dstCol < dstColLast && reinterpret_cast<intptr_t>(dstImageRow + dstCol) % 8 != 0; ++dstCol)
+      dstImageRow[dstCol] = rgb888ToRgb565(_pixel(wo2wi[dstCol]));
+
+    for (; dstCol + 4 <= dstColLast; dstCol += 4) {
+      const uint32_t rgb565x01 = rgb888ToRgb565(_pixel(wo2wi[dstCol])) | (rgb888ToRgb565(_pixel(wo2wi[dstCol + 1])) << 16);
+      const uint32_t rgb565x23 = rgb888ToRgb565(_pixel(wo2wi[dstCol + 2])) | (rgb888ToRgb565(_pixel(wo2wi[dstCol + 3])) << 16);
+      *reinterpret_cast<uint64_t*>(dstImageRow + dstCol) = _itoll(rgb565x23, rgb565x01);
+    }
+
+    for (; dstCol < dstColLast; ++dstCol)
+      dstImageRow[dstCol] = rgb888ToRgb565(_pixel(wo2wi[dstCol]));
+    dstImageRow[dstColLast] = rgb888ToRgb565(_pixel(srcColLast));
+  }
+
+  // Row of a YUYV input frame as preview pixels
+  struct YuyvPixel {
+    const uint32_t* m_yuyv;
+    uint32_t operator()(const uint32_t _srcCol) const {
+      const uint64_t rgb2x = convert2xYuyvToRgb888(m_yuyv[_srcCol / 2]);
+      return _srcCol % 2 == 0 ? _loll(rgb2x) : _hill(rgb2x);
+    }
+  };
+
+  // Row of an NV16 input frame as preview pixels, chroma plane has V of a pair first
+  struct Nv16Pixel {
+    const uint16_t* m_yy;
+    const uint16_t* m_vu;
+    uint32_t operator()(const uint32_t _srcCol) const {
+      const uint32_t uv2x = _swap4(m_vu[_srcCol / 2]);
+      const uint64_t rgb2x = convert2xYuyvToRgb888(_unpklu4(m_yy[_srcCol / 2]) | (_unpklu4(uv2x) << 8));
+      return _srcCol % 2 == 0 ? _loll(rgb2x) : _hill(rgb2x);
+    }
+  };
+
+  // Pixels set in a row mask, MSB first as sensors build them, are drawn in the overlay colour
+  template <typename _Pixel>
+  struct MaskedPixel {
+    const uint32_t* m_mask;
+    uint32_t m_rgb888;
+    _Pixel m_pixel;
+    uint32_t operator()(const uint32_t _srcCol) const { return ((m_mask[_srcCol / 32] << (_srcCol % 32)) >> 31) != 0 ? m_rgb888 : m_pixel(_srcCol); }
+  };
+
+  // Mask is optional, the same row is drawn with or without it
+  template <typename _Pixel>
+  void writeInputRow(ImageBuffer& _outImage, const uint32_t _srcRow, const uint32_t _srcColBot, const uint32_t _srcColTop, const uint32_t* _mask,
+    const uint32_t _maskRgb888, const _Pixel& _pixel) {
+    if (_mask == NULL) {
+      writeOutputRow(_outImage, _srcRow, _srcColBot, _srcColTop, _pixel);
+    } else {
+      const MaskedPixel<_Pixel> pixel = { _mask, _maskRgb888, _pixel };
+      writeOutputRow(_outImage, _srcRow, _srcColBot, _srcColTop, pixel);
+    }
+  }
+
+  /*
+    Preview row converted straight from the input frame, so analysis never keeps RGB of a frame.
+    Only sampled pixels drawn on the preview are converted; pixels set in _mask, if any,
+    are drawn in the overlay colour instead. Overlays are drawn over it afterwards.
+  */
+  void writeInputRow(ImageBuffer& _outImage, const ImageBuffer& _inImage, const uint32_t _srcRow, const uint32_t _srcColBot, const uint32_t _srcColTop,
+    const uint32_t* _mask = NULL, const uint32_t _maskRgb888 = 0) {
+    const int8_t* srcImageRow = _inImage.m_ptr + _srcRow * m_inImageDesc.m_lineLength;
+    if (m_inImageDesc.m_format == VideoFormat::NV16) {
+      const int8_t* srcImageRowC = srcImageRow + m_inImageDesc.m_height * m_inImageDesc.m_lineLength;
+      const Nv16Pixel pixel = { reinterpret_cast<const uint16_t*>(srcImageRow), reinterpret_cast<const uint16_t*>(srcImageRowC) };
+      writeInputRow(_outImage, _srcRow, _srcColBot, _srcColTop, _mask, _maskRgb888, pixel);
+    } else {
+      const YuyvPixel pixel = { reinterpret_cast<const uint32_t*>(srcImageRow) };
+      writeInputRow(_outImage, _srcRow, _srcColBot, _srcColTop, _mask, _maskRgb888, pixel);
+    }
+  }
+
+  // Frame is scaled into the top rows of the preview, rows below are never drawn and stay blank
+  void clearOutputPreview(const ImageBuffer& _outImage) const {
+    const uint32_t rows = s_hi2ho[m_inImageDesc.m_height - 1] + 1;
+    memset(_outImage.m_ptr, 0, rows * m_outImageDesc.m_lineLength);
+    markOutputRows(0, rows);
+  }
+
+  // Pixels outside of the window are not drawn, so preview is blanked first
+  void clearOutputOutsideRoi(const ImageBuffer& _outImage) const {
+    if (!isRoiFullFrame())
+      clearOutputPreview(_outImage);
   }
 
+  // HSV frame is converted once per frame, later sensors of the same step reuse it
+  void convertFrameToHsv(const ImageBuffer& _inImage) {
+    const FeatureWindow window = { m_roiLeft, m_roiTop, m_roiRight, m_roiBottom, m_roiRowStep, m_decimation };
+    if (s_featureCache.hasHsv(window))
+      return;
+
+    (this->*convertImageFormatToHSV)(_inImage);
+    s_featureCache.setHsv(window);
+  }
+
+  /*
+    Converts a window at full resolution regardless of decimation, for refining what was found
+    on a decimated frame. Window must be aligned like the processing one; it is restored afterwards.
+  */
+  void convertWindowToHsvFull(const ImageBuffer& _inImage, const uint32_t _left, const uint32_t _top, const uint32_t _right, const uint32_t _bottom) {
+    assert(_left % 32 == 0 && _right % 32 == 0 && _top % 4 == 0 && _bottom % 4 == 0);
+    const uint32_t roiLeft = m_roiLeft;
+    const uint32_t roiTop = m_roiTop;
+    const uint32_t roiRight = m_roiRight;
+    const uint32_t roiBottom = m_roiBottom;
+    const uint32_t roiRowStep = m_roiRowStep;
+
+    m_roiLeft = _left;
+    m_roiTop = _top;
+    m_roiRight = _right;
+    m_roiBottom = _bottom;
+    m_roiRowStep = 1;
+    (this->*convertImageFormatToHSVFull)(_inImage);
+
+    m_roiLeft = roiLeft;
+    m_roiTop = roiTop;
+    m_roiRight = roiRight;
+    m_roiBottom = roiBottom;
+    m_roiRowStep = roiRowStep;
+  }
+
+  /*
+    Sets HSV range of a class, packed like for detectHsvPixel. Table is rebuilt before the
+    next classification if the range has changed.
+  */
+  static void setClassRange(const uint32_t _class, const uint64_t _hsvRange, const uint32_t _hsvExpect) {
+    const uint32_t bit = 1u << _class;
+    if ((s_classRangesUsed & bit) != 0 && s_classRange[_class] == _hsvRange && s_classExpected[_class] == _hsvExpect)
+      return;
+
+    s_classRange[_class] = _hsvRange;
+    s_classExpected[_class] = _hsvExpect;
+    s_classRangesUsed |= bit;
+    s_classLutValid = false;
+  }
+
+  // Class frame is classified once per frame and table, later sensors of the same step reuse it
+  void classifyFrame(const ImageBuffer& _inImage) {
+    buildClassLut();
+
+    const FeatureWindow window = { m_roiLeft, m_roiTop, m_roiRight, m_roiBottom, m_roiRowStep, m_decimation };
+    if (s_featureCache.hasClasses(window, s_classLutVersion))
+      return;
+
+    (this->*classifyImageFormat)(_inImage, window);
+    s_featureCache.setClasses(window, s_classLutVersion);
+  }
+
+  // Classifies a window at full resolution regardless of decimation, aligned like the processing one
+  void classifyWindowFull(const ImageBuffer& _inImage, const uint32_t _left, const uint32_t _top, const uint32_t _right, const uint32_t _bottom) {
+    assert(_left % 32 == 0 && _right % 32 == 0 && _top % 4 == 0 && _bottom % 4 == 0);
+    const FeatureWindow window = { _left, _top, _right, _bottom, 1, 1 };
+    (this->*classifyImageFormat)(_inImage, window);
+  }
+
+  // RGB of a source pixel, for drawing the preview a pixel at a time
+  uint32_t __attribute__((always_inline)) readInputRgb888(const ImageBuffer& _inImage, const uint32_t _srcRow, const uint32_t _srcCol) const {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    uint32_t yuyv;
+    if (m_inImageDesc.m_format == VideoFormat::NV16) {
+      const uint32_t yy2x = reinterpret_cast<const uint16_t*>(_inImage.m_ptr + _srcRow * srcLineLength)[_srcCol / 2];
+      const uint32_t uv2x = _swap4(reinterpret_cast<const uint16_t*>(_inImage.m_ptr + (m_inImageDesc.m_height + _srcRow) * srcLineLength)[_srcCol / 2]);
+      yuyv = _unpklu4(yy2x) | (_unpklu4(uv2x) << 8);
+    } else {
+      yuyv = reinterpret_cast<const uint32_t*>(_inImage.m_ptr + _srcRow * srcLineLength)[_srcCol / 2];
+    }
+
+    const uint64_t rgb2x = convert2xYuyvToRgb888(yuyv);
+    return _srcCol % 2 == 0 ? _loll(rgb2x) : _hill(rgb2x);
+  }
+
+  static uint32_t __attribute__((always_inline)) rgb888ToRgb565(const uint32_t _rgb888) {
+    return ((_rgb888 >> 3) & 0x001f) | ((_rgb888 >> 5) & 0x07e0) | ((_rgb888 >> 8) & 0xf800);
+  }
+
+  static void __attribute__((always_inline)) writeOutputPixel(uint16_t* restrict _rgb565ptr, const uint32_t _rgb888) { *_rgb565ptr = rgb888ToRgb565(_rgb888); }
+
   void __attribute__((always_inline)) drawOutputPixelBound(const int32_t _srcCol, const int32_t _srcRow, const int32_t _srcColBot, const int32_t _srcColTop,
     const int32_t _srcRowBot, const int32_t _srcRowTop, const ImageBuffer& _outImage, const uint32_t _rgb888) const {
     const int32_t srcCol = range<int32_t>(_srcColBot, _srcCol, _srcColTop);
@@ -97,72 +454,113 @@ protected:
 
     const uint32_t dstOfs = dstRow * m_outImageDesc.m_lineLength + dstCol * sizeof(uint16_t);
 
+    markOutputRows(dstRow, dstRow + 1);
     writeOutputPixel(reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstOfs), _rgb888);
   }
 
-  void __attribute__((always_inline)) drawFatPixel(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
+  // Output pixels [_dstColBegin.._dstColEnd) of a row, 4 at a time once they are aligned
+  static void fillOutputRow(uint16_t* restrict _dstRow, const uint32_t _dstColBegin, const uint32_t _dstColEnd, const uint32_t _rgb565) {
+    uint16_t* dst = _dstRow + _dstColBegin;
+    uint16_t* const dstEnd = _dstRow + _dstColEnd;
+    for (; dst < dstEnd && reinterpret_cast<intptr_t>(dst) % 8 != 0; ++dst)
+      *dst = _rgb565;
 
-    drawOutputPixelBound(_srcCol - 1, _srcRow - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol - 1, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol - 1, _srcRow + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol, _srcRow - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol, _srcRow + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol + 1, _srcRow - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol + 1, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol + 1, _srcRow + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-  }
+    const uint32_t rgb565x2 = _rgb565 | (_rgb565 << 16);
+    const uint64_t rgb565x4 = _itoll(rgb565x2, rgb565x2);
+    for (; dst + 4 <= dstEnd; dst += 4)
+      *reinterpret_cast<uint64_t*>(dst) = rgb565x4;
 
-  void __attribute__((always_inline))
-  drawRgbTargetCenterLine(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
+    for (; dst < dstEnd; ++dst)
+      *dst = _rgb565;
+  }
 
-    for (int adj = 0; adj < 100; ++adj) {
-      drawOutputPixelBound(_srcCol, _srcRow - adj, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol, _srcRow + adj, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+  // Last sampled source column drawn on every preview column, or the nearest one left of it
+  void setupOutputColumns(const uint32_t _step) {
+    const uint32_t width = m_inImageDesc.m_width;
+    uint32_t srcCol = 0;
+    for (uint32_t dstCol = 0; dstCol < m_outImageDesc.m_width; ++dstCol) {
+      while (srcCol + _step < width && s_wi2wo[srcCol + _step] <= dstCol)
+        srcCol += _step;
+      m_wo2wi[dstCol] = srcCol;
     }
+    m_previewStep = _step;
   }
 
-  void __attribute__((always_inline))
-  drawRgbTargetHorizontalCenterLine(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
-    const int32_t widthBot = 0;
+  /*
+    Overlays are rasterized as rectangles of source pixels, inclusive, lines being one pixel wide ones.
+    Corners are clamped to the frame, which covers the very pixels drawOutputPixelBound would clamp
+    every pixel of them to, so a rectangle only costs two lookups per corner. It is then filled
+    on all output rows and columns it maps to: with packed stores along the rows, or walking down
+    a single output column.
+  */
+  void fillOutputRect(const int32_t _srcLeft, const int32_t _srcTop, const int32_t _srcRight, const int32_t _srcBottom, const ImageBuffer& _outImage,
+    const uint32_t _rgb888) const {
     const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
     const int32_t heightTop = m_inImageDesc.m_height - 1;
 
-    for (int adj = 0; adj < 100; ++adj) {
-      drawOutputPixelBound(_srcCol - adj, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol + adj, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    const uint32_t dstColBegin = s_wi2wo[range<int32_t>(0, _srcLeft, widthTop)];
+    const uint32_t dstColEnd = s_wi2wo[range<int32_t>(0, _srcRight, widthTop)] + 1;
+    const uint32_t dstRowBegin = s_hi2ho[range<int32_t>(0, _srcTop, heightTop)];
+    const uint32_t dstRowEnd = s_hi2ho[range<int32_t>(0, _srcBottom, heightTop)] + 1;
+
+    const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
+    const uint32_t rgb565 = rgb888ToRgb565(_rgb888);
+    markOutputRows(dstRowBegin, dstRowEnd);
+
+    if (dstColEnd - dstColBegin == 1) {
+      int8_t* restrict dst = _outImage.m_ptr + dstRowBegin * dstLineLength + dstColBegin * sizeof(uint16_t);
+      for (uint32_t dstRow = dstRowBegin; dstRow < dstRowEnd; ++dstRow) {
+        *reinterpret_cast<uint16_t*>(dst) = rgb565;
+        dst += dstLineLength;
+      }
+    } else {
+      for (uint32_t dstRow = dstRowBegin; dstRow < dstRowEnd; ++dstRow)
+        fillOutputRow(reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstRow * dstLineLength), dstColBegin, dstColEnd, rgb565);
     }
   }
 
+  void __attribute__((always_inline)) drawFatPixel(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
+    fillOutputRect(_srcCol - 1, _srcRow - 1, _srcCol + 1, _srcRow + 1, _outImage, _rgb888);
+  }
+
   void __attribute__((always_inline))
-  drawOutputCircle(const int32_t _srcCol, const int32_t _srcRow, const int32_t _srcRadius, const ImageBuffer& _outImage, const uint32_t _rgb888) const {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
+  drawRgbTargetCenterLine(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
+    fillOutputRect(_srcCol, _srcRow - 99, _srcCol, _srcRow + 99, _outImage, _rgb888);
+  }
+
+  void __attribute__((always_inline))
+  drawRgbTargetHorizontalCenterLine(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
+    fillOutputRect(_srcCol - 99, _srcRow, _srcCol + 99, _srcRow, _outImage, _rgb888);
+  }
 
+  /*
+    Midpoint circle, drawn as runs: while x of the octant stays the same, its points make
+    a column run right and left of the center and a row run above and below it.
+  */
+  void drawOutputCircleRuns(const int32_t _srcCol, const int32_t _srcRow, const int32_t _x, const int32_t _yBegin, const int32_t _yEnd,
+    const ImageBuffer& _outImage, const uint32_t _rgb888) const {
+    fillOutputRect(_srcCol + _x, _srcRow + _yBegin, _srcCol + _x, _srcRow + _yEnd, _outImage, _rgb888);
+    fillOutputRect(_srcCol + _x, _srcRow - _yEnd, _srcCol + _x, _srcRow - _yBegin, _outImage, _rgb888);
+    fillOutputRect(_srcCol - _x, _srcRow + _yBegin, _srcCol - _x, _srcRow + _yEnd, _outImage, _rgb888);
+    fillOutputRect(_srcCol - _x, _srcRow - _yEnd, _srcCol - _x, _srcRow - _yBegin, _outImage, _rgb888);
+    fillOutputRect(_srcCol + _yBegin, _srcRow + _x, _srcCol + _yEnd, _srcRow + _x, _outImage, _rgb888);
+    fillOutputRect(_srcCol - _yEnd, _srcRow + _x, _srcCol - _yBegin, _srcRow + _x, _outImage, _rgb888);
+    fillOutputRect(_srcCol + _yBegin, _srcRow - _x, _srcCol + _yEnd, _srcRow - _x, _outImage, _rgb888);
+    fillOutputRect(_srcCol - _yEnd, _srcRow - _x, _srcCol - _yBegin, _srcRow - _x, _outImage, _rgb888);
+  }
+
+  void drawOutputCircle(const int32_t _srcCol, const int32_t _srcRow, const int32_t _srcRadius, const ImageBuffer& _outImage, const uint32_t _rgb888) const {
     int32_t circleError = 1 - _srcRadius;
     int32_t circleErrorY = 1;
     int32_t circleErrorX = -2 * _srcRadius;
     int32_t circleX = _srcRadius;
     int32_t circleY = 0;
-
-    drawOutputPixelBound(_srcCol, _srcRow + _srcRadius, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol, _srcRow - _srcRadius, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol + _srcRadius, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol - _srcRadius, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    int32_t runY = 0;
 
     while (circleY < circleX) {
       if (circleError >= 0) {
+        drawOutputCircleRuns(_srcCol, _srcRow, circleX, runY, circleY, _outImage, _rgb888);
+        runY = circleY + 1;
         circleX -= 1;
         circleErrorX += 2;
         circleError += circleErrorX;
@@ -170,101 +568,44 @@ protected:
       circleY += 1;
       circleErrorY += 2;
       circleError += circleErrorY;
-
-      drawOutputPixelBound(_srcCol + circleX, _srcRow + circleY, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol + circleX, _srcRow - circleY, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol - circleX, _srcRow + circleY, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol - circleX, _srcRow - circleY, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol + circleY, _srcRow + circleX, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol + circleY, _srcRow - circleX, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol - circleY, _srcRow + circleX, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_srcCol - circleY, _srcRow - circleX, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
     }
+    drawOutputCircleRuns(_srcCol, _srcRow, circleX, runY, circleY, _outImage, _rgb888);
   }
 
   void __attribute__((always_inline)) drawRgbThinLine(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
-
-#pragma MUST_ITERATE(4, , 4)
-    for (int adj = 0; adj < m_inImageDesc.m_height; ++adj)
-      drawOutputPixelBound(_srcCol, _srcRow + adj, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    fillOutputRect(_srcCol, _srcRow, _srcCol, _srcRow + m_inImageDesc.m_height - 1, _outImage, _rgb888);
   }
 
   void __attribute__((always_inline))
   drawRgbHorizontalLine(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
-
-#pragma MUST_ITERATE(32, , 32)
-    for (int adj = 0; adj < m_inImageDesc.m_width; ++adj)
-      drawOutputPixelBound(_srcCol + adj, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    fillOutputRect(_srcCol, _srcRow, _srcCol + m_inImageDesc.m_width - 1, _srcRow, _outImage, _rgb888);
   }
 
   void __attribute__((always_inline)) drawCornerHighlight(const int32_t _srcCol, const int32_t _srcRow, const ImageBuffer& _outImage, const uint32_t _rgb888) {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
-
-    drawOutputPixelBound(_srcCol - 1, _srcRow - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol - 1, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol - 1, _srcRow + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol, _srcRow - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol, _srcRow + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol + 1, _srcRow - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol + 1, _srcRow, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-    drawOutputPixelBound(_srcCol + 1, _srcRow + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    fillOutputRect(_srcCol - 1, _srcRow - 1, _srcCol + 1, _srcRow + 1, _outImage, _rgb888);
   }
 
   void __attribute__((always_inline)) drawOutputFatRectangle(const int32_t _x1, const int32_t _x2, const int32_t _y1, const int32_t _y2,
     const ImageBuffer& _outImage, const uint32_t _rgb888) const {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
-
-    for (int32_t c = _x1; c < _x2; c++) {
-      drawOutputPixelBound(c, _y1 - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(c, _y1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(c, _y1 + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-
-      drawOutputPixelBound(c, _y2 - 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(c, _y2, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(c, _y2 + 1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    if (_x1 < _x2) {
+      fillOutputRect(_x1, _y1 - 1, _x2 - 1, _y1 + 1, _outImage, _rgb888);
+      fillOutputRect(_x1, _y2 - 1, _x2 - 1, _y2 + 1, _outImage, _rgb888);
     }
-
-    for (int32_t r = _y1; r < _y2; r++) {
-      drawOutputPixelBound(_x1 - 1, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_x1, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_x1 + 1, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-
-      drawOutputPixelBound(_x2 - 1, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_x2, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_x2 + 1, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    if (_y1 < _y2) {
+      fillOutputRect(_x1 - 1, _y1, _x1 + 1, _y2 - 1, _outImage, _rgb888);
+      fillOutputRect(_x2 - 1, _y1, _x2 + 1, _y2 - 1, _outImage, _rgb888);
     }
   }
 
   void __attribute__((always_inline))
   drawOutputRectangle(const int32_t _x1, const int32_t _x2, const int32_t _y1, const int32_t _y2, const ImageBuffer& _outImage, const uint32_t _rgb888) const {
-    const int32_t widthBot = 0;
-    const int32_t widthTop = m_inImageDesc.m_width - 1;
-    const int32_t heightBot = 0;
-    const int32_t heightTop = m_inImageDesc.m_height - 1;
-
-    for (int32_t c = _x1; c < _x2; c++) {
-      drawOutputPixelBound(c, _y1, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(c, _y2, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    if (_x1 < _x2) {
+      fillOutputRect(_x1, _y1, _x2 - 1, _y1, _outImage, _rgb888);
+      fillOutputRect(_x1, _y2, _x2 - 1, _y2, _outImage, _rgb888);
     }
-
-    for (int32_t r = _y1; r < _y2; r++) {
-      drawOutputPixelBound(_x1, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
-      drawOutputPixelBound(_x2, r, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    if (_y1 < _y2) {
+      fillOutputRect(_x1, _y1, _x1, _y2 - 1, _outImage, _rgb888);
+      fillOutputRect(_x2, _y1, _x2, _y2 - 1, _outImage, _rgb888);
     }
   }
 
@@ -330,30 +671,27 @@ protected:
 
     void convertImageNV16ToHsv(const ImageBuffer& _inImage)
     {
-      const uint32_t srcImageRowEffectiveSize       = m_inImageDesc.m_width;
-      const uint32_t srcImageRowEffectiveToFullSize = m_inImageDesc.m_lineLength - srcImageRowEffectiveSize;
-      const int8_t* restrict srcImageRowY     = _inImage.m_ptr;
-      const int8_t* restrict srcImageRowC     = _inImage.m_ptr + m_inImageDesc.m_lineLength*m_inImageDesc.m_height;
-      const int8_t* restrict srcImageToY      = srcImageRowY + m_inImageDesc.m_lineLength*m_inImageDesc.m_height;
-      uint64_t* restrict rgb888hsvptr         = s_rgb888hsv;
-
-      assert(m_inImageDesc.m_height % 4 == 0); // verified in setup
-#pragma MUST_ITERATE(4, ,4)
-      while (srcImageRowY != srcImageToY)
+      const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+      const int8_t* restrict srcImageY  = _inImage.m_ptr + m_roiLeft;
+      const int8_t* restrict srcImageC  = _inImage.m_ptr + srcLineLength*m_inImageDesc.m_height + m_roiLeft;
+      uint32_t* restrict hsvFrame       = s_hsvFrame + m_roiLeft;
+
+      // only rows and columns of the processing window are converted, the rest of s_hsvFrame is left intact
+#pragma MUST_ITERATE(1, , )
+      for (uint32_t srcRow = m_roiTop; srcRow < m_roiBottom; srcRow += m_roiRowStep)
       {
+        const int8_t* restrict srcImageRowY = srcImageY + srcRow*srcLineLength;
         assert(reinterpret_cast<intptr_t>(srcImageRowY) % 8 == 0); // let's pray...
-        assert(reinterpret_cast<intptr_t>(srcImageRowC) % 8 == 0); // let's pray...
+        assert(reinterpret_cast<intptr_t>(srcImageC + srcRow*srcLineLength) % 8 == 0); // let's pray...
         const uint32_t* restrict srcImageColY4 = reinterpret_cast<const uint32_t*>(srcImageRowY);
-        const uint32_t* restrict srcImageColC4 = reinterpret_cast<const uint32_t*>(srcImageRowC);
-        srcImageRowY += srcImageRowEffectiveSize;
-        srcImageRowC += srcImageRowEffectiveSize;
+        const uint32_t* restrict srcImageColC4 = reinterpret_cast<const uint32_t*>(srcImageC + srcRow*srcLineLength);
+        const int8_t* restrict srcImageRowYEnd = srcImageRowY + (m_roiRight - m_roiLeft);
+        uint64_t* restrict hsv2xptr = reinterpret_cast<uint64_t*>(hsvFrame + srcRow*m_inImageDesc.m_width);
 
-        assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
+        assert((m_roiRight - m_roiLeft) % 32 == 0); // verified in setupRoi
 #pragma MUST_ITERATE(32/4, ,32/4)
-        while (reinterpret_cast<const int8_t*>(srcImageColY4) != srcImageRowY)
+        while (reinterpret_cast<const int8_t*>(srcImageColY4) != srcImageRowYEnd)
         {
-          assert(reinterpret_cast<const int8_t*>(srcImageColC4) != srcImageRowC);
-
           const uint32_t yy4x = *srcImageColY4++;
           const uint32_t uv4x = _swap4(*srcImageColC4++);
 
@@ -361,16 +699,11 @@ protected:
           const uint32_t yuyv34 = (_unpkhu4(yy4x)) | (_unpkhu4(uv4x) << 8);
 
           const uint64_t rgb12 = convert2xYuyvToRgb888(yuyv12);
-          *rgb888hsvptr++ = _itoll(_loll(rgb12), convertRgb888ToHsv(_loll(rgb12)));
-          *rgb888hsvptr++ = _itoll(_hill(rgb12), convertRgb888ToHsv(_hill(rgb12)));
+          *hsv2xptr++ = _itoll(convertRgb888ToHsv(_hill(rgb12)), convertRgb888ToHsv(_loll(rgb12)));
 
           const uint64_t rgb34 = convert2xYuyvToRgb888(yuyv34);
-          *rgb888hsvptr++ = _itoll(_loll(rgb34), convertRgb888ToHsv(_loll(rgb34)));
-          *rgb888hsvptr++ = _itoll(_hill(rgb34), convertRgb888ToHsv(_hill(rgb34)));
+          *hsv2xptr++ = _itoll(convertRgb888ToHsv(_hill(rgb34)), convertRgb888ToHsv(_loll(rgb34)));
         }
-
-        srcImageRowY += srcImageRowEffectiveToFullSize;
-        srcImageRowC += srcImageRowEffectiveToFullSize;
       }
     }
 
@@ -379,37 +712,73 @@ protected:
   // check it later in assembler.
   void convertImageYuyvToHsv(const ImageBuffer& _inImage)
     {
-      const uint32_t srcImageRowEffectiveSize       = m_inImageDesc.m_width*sizeof(uint16_t);
-      const uint32_t srcImageRowEffectiveToFullSize = m_inImageDesc.m_lineLength - srcImageRowEffectiveSize;
-      const int8_t* restrict srcImageRowY     = _inImage.m_ptr;
-      const int8_t* restrict srcImageToY      = srcImageRowY + m_inImageDesc.m_lineLength*m_inImageDesc.m_height;
-      uint64_t* restrict rgb888hsvptr         = s_rgb888hsv;
-
-      assert(m_inImageDesc.m_height % 4 == 0); // verified in setup
-#pragma MUST_ITERATE(4, ,4)
-      while (srcImageRowY != srcImageToY)
+      const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+      const int8_t* restrict srcImage = _inImage.m_ptr + m_roiLeft*sizeof(uint16_t);
+      uint32_t* restrict hsvFrame     = s_hsvFrame + m_roiLeft;
+
+      // only rows and columns of the processing window are converted, the rest of s_hsvFrame is left intact
+#pragma MUST_ITERATE(1, , )
+      for (uint32_t srcRow = m_roiTop; srcRow < m_roiBottom; srcRow += m_roiRowStep)
       {
-        assert(reinterpret_cast<intptr_t>(srcImageRowY) % 8 == 0); // let's pray...
-        const uint64_t* restrict srcImageCol4 = reinterpret_cast<const uint64_t*>(srcImageRowY);
-        srcImageRowY += srcImageRowEffectiveSize;
+        const int8_t* restrict srcImageRow = srcImage + srcRow*srcLineLength;
+        assert(reinterpret_cast<intptr_t>(srcImageRow) % 8 == 0); // let's pray...
+        const uint64_t* restrict srcImageCol4 = reinterpret_cast<const uint64_t*>(srcImageRow);
+        const int8_t* restrict srcImageRowEnd = srcImageRow + (m_roiRight - m_roiLeft)*sizeof(uint16_t);
+        uint64_t* restrict hsv2xptr = reinterpret_cast<uint64_t*>(hsvFrame + srcRow*m_inImageDesc.m_width);
 
-        assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
+        assert((m_roiRight - m_roiLeft) % 32 == 0); // verified in setupRoi
 #pragma MUST_ITERATE(32/4, ,32/4)
-        while (reinterpret_cast<const int8_t*>(srcImageCol4) != srcImageRowY)
+        while (reinterpret_cast<const int8_t*>(srcImageCol4) != srcImageRowEnd)
         {
           const uint64_t yuyv2x = *srcImageCol4++;
           const uint64_t rgb12 = convert2xYuyvToRgb888(_loll(yuyv2x));
-          *rgb888hsvptr++ = _itoll(_loll(rgb12), convertRgb888ToHsv(_loll(rgb12)));
-          *rgb888hsvptr++ = _itoll(_hill(rgb12), convertRgb888ToHsv(_hill(rgb12)));
+          *hsv2xptr++ = _itoll(convertRgb888ToHsv(_hill(rgb12)), convertRgb888ToHsv(_loll(rgb12)));
 
           const uint64_t rgb34 = convert2xYuyvToRgb888(_hill(yuyv2x));
-          *rgb888hsvptr++ = _itoll(_loll(rgb34), convertRgb888ToHsv(_loll(rgb34)));
-          *rgb888hsvptr++ = _itoll(_hill(rgb34), convertRgb888ToHsv(_hill(rgb34)));
+          *hsv2xptr++ = _itoll(convertRgb888ToHsv(_hill(rgb34)), convertRgb888ToHsv(_loll(rgb34)));
         }
+      }
+    }
 
-        srcImageRowY += srcImageRowEffectiveToFullSize;
+  // Converts every m_decimation pixel of the window, only the first pixel of a YUYV pair is used
+  void convertImageYuyvToHsvDecimated(const ImageBuffer& _inImage) {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t decimation = m_decimation;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t srcRow = m_roiTop; srcRow < m_roiBottom; srcRow += m_roiRowStep) {
+      const uint32_t* restrict srcImageRow = reinterpret_cast<const uint32_t*>(_inImage.m_ptr + srcRow * srcLineLength);
+      uint32_t* restrict hsvRow = s_hsvFrame + srcRow * width;
+
+      assert((m_roiRight - m_roiLeft) % 32 == 0); // verified in setupRoi
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t srcCol = m_roiLeft; srcCol < m_roiRight; srcCol += decimation)
+        hsvRow[srcCol] = convertRgb888ToHsv(_loll(convert2xYuyvToRgb888(srcImageRow[srcCol / 2])));
+    }
+  }
+
+  void convertImageNV16ToHsvDecimated(const ImageBuffer& _inImage) {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t decimation = m_decimation;
+    const int8_t* restrict srcImageC = _inImage.m_ptr + srcLineLength * m_inImageDesc.m_height;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t srcRow = m_roiTop; srcRow < m_roiBottom; srcRow += m_roiRowStep) {
+      const uint16_t* restrict srcImageRowY = reinterpret_cast<const uint16_t*>(_inImage.m_ptr + srcRow * srcLineLength);
+      const uint16_t* restrict srcImageRowC = reinterpret_cast<const uint16_t*>(srcImageC + srcRow * srcLineLength);
+      uint32_t* restrict hsvRow = s_hsvFrame + srcRow * width;
+
+      assert((m_roiRight - m_roiLeft) % 32 == 0); // verified in setupRoi
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t srcCol = m_roiLeft; srcCol < m_roiRight; srcCol += decimation) {
+        const uint32_t yy2x = srcImageRowY[srcCol / 2];
+        const uint32_t uv2x = _swap4(srcImageRowC[srcCol / 2]);
+        hsvRow[srcCol] = convertRgb888ToHsv(_loll(convert2xYuyvToRgb888(_unpklu4(yy2x) | (_unpklu4(uv2x) << 8))));
       }
     }
+  }
 
 //   void convertImageYuyvToHsv(const ImageBuffer& _inImage) {
 //     const uint64_t* restrict src = reinterpret_cast<const uint64_t*>(_inImage.m_ptr);
@@ -427,20 +796,152 @@ protected:
 //     }
 //   }
 
-  bool commonSetup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
+  // Table index of the first pixel of a YUYV pair; the second one has luma in byte 2 instead of 0
+  static uint32_t __attribute__((always_inline)) yuvClassKey(const uint32_t _yuyv) {
+    return ((_yuyv << 8) & 0xfc00) | ((_yuyv >> 6) & 0x03e0) | (_yuyv >> 27);
+  }
+
+  static uint32_t __attribute__((always_inline)) yuvClassKey2(const uint32_t _yuyv) {
+    return ((_yuyv >> 8) & 0xfc00) | ((_yuyv >> 6) & 0x03e0) | (_yuyv >> 27);
+  }
+
+  // Every bin center goes through the same conversions the HSV frame does
+  static void buildClassLut() {
+    if (s_classLutValid)
+      return;
+
+    const uint32_t used = s_classRangesUsed;
+    uint8_t* restrict lut = s_classLut;
+    for (uint32_t key = 0; key < YUV_CLASS_LUT_SIZE; ++key) {
+      const uint32_t y = ((key >> 10) << 2) + 2;
+      const uint32_t c1 = (((key >> 5) & 0x1f) << 3) + 4;
+      const uint32_t c3 = ((key & 0x1f) << 3) + 4;
+      const uint32_t hsv = convertRgb888ToHsv(_loll(convert2xYuyvToRgb888(y | (c1 << 8) | (y << 16) | (c3 << 24))));
+
+      uint32_t cls = 0;
+      for (uint32_t c = 0; c < YUV_CLASS_RANGES; ++c)
+        if ((used & (1u << c)) != 0 && detectHsvPixel(hsv, s_classRange[c], s_classExpected[c]))
+          cls |= 1u << c;
+      lut[key] = cls;
+    }
+
+    ++s_classLutVersion;
+    s_classLutValid = true;
+  }
+
+  // Only rows and columns of the window are classified, the rest of s_classFrame is left intact
+  void classifyImageYuyv(const ImageBuffer& _inImage, const FeatureWindow& _window) {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t decimation = _window.m_decimation;
+    const uint8_t* restrict lut = s_classLut;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t srcRow = _window.m_top; srcRow < _window.m_bottom; srcRow += _window.m_rowStep) {
+      const uint32_t* restrict srcImageRow = reinterpret_cast<const uint32_t*>(_inImage.m_ptr + srcRow * srcLineLength);
+      uint8_t* restrict classRow = s_classFrame + srcRow * width;
+
+      assert((_window.m_right - _window.m_left) % 32 == 0); // verified in setupRoi
+      if (decimation == 1) {
+#pragma MUST_ITERATE(16, , 16)
+        for (uint32_t srcCol = _window.m_left; srcCol < _window.m_right; srcCol += 2) {
+          const uint32_t yuyv = srcImageRow[srcCol / 2];
+          classRow[srcCol] = lut[yuvClassKey(yuyv)];
+          classRow[srcCol + 1] = lut[yuvClassKey2(yuyv)];
+        }
+      } else {
+#pragma MUST_ITERATE(8, , 8)
+        for (uint32_t srcCol = _window.m_left; srcCol < _window.m_right; srcCol += decimation)
+          classRow[srcCol] = lut[yuvClassKey(srcImageRow[srcCol / 2])];
+      }
+    }
+  }
+
+  void classifyImageNV16(const ImageBuffer& _inImage, const FeatureWindow& _window) {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t decimation = _window.m_decimation;
+    const int8_t* restrict srcImageC = _inImage.m_ptr + srcLineLength * m_inImageDesc.m_height;
+    const uint8_t* restrict lut = s_classLut;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t srcRow = _window.m_top; srcRow < _window.m_bottom; srcRow += _window.m_rowStep) {
+      const uint16_t* restrict srcImageRowY = reinterpret_cast<const uint16_t*>(_inImage.m_ptr + srcRow * srcLineLength);
+      const uint16_t* restrict srcImageRowC = reinterpret_cast<const uint16_t*>(srcImageC + srcRow * srcLineLength);
+      uint8_t* restrict classRow = s_classFrame + srcRow * width;
+
+      assert((_window.m_right - _window.m_left) % 32 == 0); // verified in setupRoi
+      if (decimation == 1) {
+#pragma MUST_ITERATE(16, , 16)
+        for (uint32_t srcCol = _window.m_left; srcCol < _window.m_right; srcCol += 2) {
+          const uint32_t yuyv = _unpklu4(srcImageRowY[srcCol / 2]) | (_unpklu4(_swap4(srcImageRowC[srcCol / 2])) << 8);
+          classRow[srcCol] = lut[yuvClassKey(yuyv)];
+          classRow[srcCol + 1] = lut[yuvClassKey2(yuyv)];
+        }
+      } else {
+#pragma MUST_ITERATE(8, , 8)
+        for (uint32_t srcCol = _window.m_left; srcCol < _window.m_right; srcCol += decimation) {
+          const uint32_t yuyv = _unpklu4(srcImageRowY[srcCol / 2]) | (_unpklu4(_swap4(srcImageRowC[srcCol / 2])) << 8);
+          classRow[srcCol] = lut[yuvClassKey(yuyv)];
+        }
+      }
+    }
+  }
+
+  bool setupClassFrame(Arena& _arena) {
+    if (s_classLut == NULL)
+      s_classLut = _arena.alloc<uint8_t>(YUV_CLASS_LUT_SIZE);
+    if (s_classFrame == NULL)
+      s_classFrame = _arena.alloc<uint8_t>(m_inImageDesc.m_width * m_inImageDesc.m_height);
+    return s_classLut != NULL && s_classFrame != NULL;
+  }
+
+  bool setupHsvFrame(Arena& _arena) {
+    if (s_hsvFrame == NULL)
+      s_hsvFrame = _arena.alloc<uint32_t>(m_inImageDesc.m_width * m_inImageDesc.m_height);
+    return s_hsvFrame != NULL;
+  }
+
+  bool commonSetup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
     m_inImageDesc = _inImageDesc;
     m_outImageDesc = _outImageDesc;
 
     if (m_inImageDesc.m_width % 32 != 0 || m_inImageDesc.m_height % 4 != 0)
       return false;
-    
+    if (m_inImageDesc.m_width > IMG_WIDTH_MAX || m_inImageDesc.m_height > IMG_HEIGHT_MAX)
+      return false;
+
+    if (s_wi2wo == NULL)
+      s_wi2wo = _arena.alloc<uint32_t>(m_inImageDesc.m_width);
+    if (s_hi2ho == NULL)
+      s_hi2ho = _arena.alloc<uint32_t>(m_inImageDesc.m_height);
+    if (s_wi2wo == NULL || s_hi2ho == NULL)
+      return false;
+    m_wo2wi = _arena.alloc<uint16_t>(m_outImageDesc.m_width);
+    if (m_wo2wi == NULL)
+      return false;
+    m_previewStep = 0;
+
+    m_roiLeft = 0;
+    m_roiTop = 0;
+    m_roiRight = m_inImageDesc.m_width;
+    m_roiBottom = m_inImageDesc.m_height;
+    m_roiRowStep = 1;
+    m_decimation = 1;
+    resetOutputDirty();
+
     if (_inImageDesc.m_format == VideoFormat::YUV422) {
-      convertImageFormatToHSV = &CvAlgorithm::convertImageYuyvToHsv;
+      convertImageFormatToHSVFull = &CvAlgorithm::convertImageYuyvToHsv;
+      convertImageFormatToHSVDecimated = &CvAlgorithm::convertImageYuyvToHsvDecimated;
+      classifyImageFormat = &CvAlgorithm::classifyImageYuyv;
     } else if (_inImageDesc.m_format == VideoFormat::NV16) {
-      convertImageFormatToHSV = &CvAlgorithm::convertImageNV16ToHsv;
+      convertImageFormatToHSVFull = &CvAlgorithm::convertImageNV16ToHsv;
+      convertImageFormatToHSVDecimated = &CvAlgorithm::convertImageNV16ToHsvDecimated;
+      classifyImageFormat = &CvAlgorithm::classifyImageNV16;
     } else { 
       return false;
     }
+    convertImageFormatToHSV = convertImageFormatToHSVFull;
 
 #define min(x, y) x < y ? x : y;
     const double srcToDstShift =
@@ -481,11 +982,18 @@ protected:
   CvAlgorithm() {}
 };
 
-uint64_t restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_rgb888hsv[IMG_WIDTH * IMG_HEIGHT];
-uint32_t restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_wi2wo[IMG_WIDTH];
-uint32_t restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_hi2ho[IMG_HEIGHT];
+uint32_t* restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_hsvFrame = NULL;
+uint32_t* restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_wi2wo = NULL;
+uint32_t* restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_hi2ho = NULL;
 uint16_t* restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_mult43_div = NULL;
 uint16_t* restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_mult255_div = NULL;
+uint8_t* restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_classLut = NULL;
+uint8_t* restrict CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_classFrame = NULL;
+uint64_t CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_classRange[YUV_CLASS_RANGES];
+uint32_t CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_classExpected[YUV_CLASS_RANGES];
+uint32_t CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_classRangesUsed = 0;
+bool CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_classLutValid = false;
+uint32_t CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::s_classLutVersion = 0;
 
 }
 }
@@ -21,30 +21,53 @@
 #include <cassert>
 #include <cmath>
 
+#include "hough_line_fitter.hpp"
+
 extern "C" {
-#include <ti/imglib/src/IMG_sobel_3x3_8/IMG_sobel_3x3_8.h>
-#include <ti/imglib/src/IMG_thr_gt2max_8/IMG_thr_gt2max_8.h>
-#include <ti/imglib/src/IMG_ycbcr422pl_to_rgb565/IMG_ycbcr422pl_to_rgb565.h>
+#include <ti/imglib/src/IMG_conv_3x3_i16s_c16s/IMG_conv_3x3_i16s_c16s.h>
+#include <ti/imglib/src/IMG_corr_3x3_i8_c16s/IMG_corr_3x3_i8_c16s.h>
 }
 
 namespace trik {
 namespace sensors {
 
-static uint8_t s_y[320 * 240];
-static uint8_t s_y2[320 * 240];
-static uint8_t s_cb[320 * 240];
-static uint8_t s_cr[320 * 240];
-
-static int16_t s_xGrad[320 * 240 + 1];
-static int16_t s_yGrad[320 * 240 + 1];
-static int16_t s_gradMag[320 * 240 + 1];
-static uint16_t s_harrisScore_el[320 * 240];
-
-static int8_t s_corners_el[320 * 240];
-
-static uint8_t s_buffer_el[200]; // 200
+// rows are frame width apart, buffers are carved from the arena in setup
+static uint8_t* restrict s_edgeLumaRows = NULL;
+
+/*
+  Harris corner detector state, everything is kept per row.
+  Gradient, gradient products and corner score rows live in 3-row rings; a ring slot
+  of row r is r % 3.
+*/
+static int32_t* restrict s_cornerIx = NULL;
+static int32_t* restrict s_cornerIy = NULL;
+static int16_t* restrict s_cornerIxx = NULL;
+static int16_t* restrict s_cornerIyy = NULL;
+static int16_t* restrict s_cornerIxy = NULL;
+static int16_t* restrict s_cornerSxx = NULL;
+static int16_t* restrict s_cornerSyy = NULL;
+static int16_t* restrict s_cornerSxy = NULL;
+static int16_t* restrict s_cornerScore = NULL;
+static int16_t* restrict s_cornerColMax = NULL;
+
+/*
+  Sobel masks for IMG_corr_3x3_i8_c16s, one per position of the top row in the luma ring.
+  With luma used in place rows are in natural order and the first mask is used.
+*/
+static const int16_t s_cornerMaskX[3][9] = {
+  { -1, 0, 1, -2, 0, 2, -1, 0, 1 },
+  { -1, 0, 1, -1, 0, 1, -2, 0, 2 },
+  { -2, 0, 2, -1, 0, 1, -1, 0, 1 },
+};
+static const int16_t s_cornerMaskY[3][9] = {
+  { -1, -2, -1, 0, 0, 0, 1, 2, 1 },
+  { 1, 2, 1, -1, -2, -1, 0, 0, 0 },
+  { 0, 0, 0, 1, 2, 1, -1, -2, -1 },
+};
+static const int16_t s_cornerBoxMask[9] = { 1, 1, 1, 1, 1, 1, 1, 1, 1 };
 
-static const short s_coeff_el[5] = { 0x2000, 0x2BDD, -0x0AC5, -0x1658, 0x3770 };
+// sum of bit indices for every 4-bit detection mask
+static const uint8_t s_edgeMaskColSum[16] = { 0, 0, 1, 1, 2, 2, 3, 3, 3, 3, 4, 4, 5, 5, 6, 6 };
 
 class EdgeLineSensorCvAlgorithm : public CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X> {
 private:
@@ -69,253 +92,373 @@ private:
       ----------------
   */
 
-  uint64_t m_detectRange;
-  uint32_t m_detectExpected;
-  double m_srcToDstShift;
+  // |Gx|+|Gy| above this value marks an edge pixel
+  static const int32_t m_edgeThreshold = 50;
+  // columns closer than that to the frame border are not analyzed
+  static const uint32_t m_edgeBorder = 16;
+
+  // gradient products are scaled down to fit 16 bits: (4*255)^2 >> 5 < 2^15
+  static const uint32_t m_cornerProductShift = 5;
+  // 3x3 sums of products are scaled down to fit 16 bits
+  static const uint32_t m_cornerBoxShift = 4;
+  // Harris response R = det - trace^2/16 is reported as R >> m_cornerScoreShift, zero or negative score is not a corner
+  static const uint32_t m_cornerScoreShift = 12;
+  static const uint32_t m_cornerBorder = 4;
+  static const uint32_t m_maxCorners = TRIK_MAX_TARGET_COUNT - 1;
 
   int32_t m_targetX;
   int32_t m_targetY;
   uint32_t m_targetPoints;
 
-  typedef void (EdgeLineSensorCvAlgorithm::*ConvertFuncPtr)(const ImageBuffer&, ImageBuffer&);
-  ConvertFuncPtr convertImageFormatToHSV = nullptr;
-
-  void convertImageNV16ToRgb(const ImageBuffer& _inImage, ImageBuffer& _outImage)
-    {
-      const uint32_t width          = m_inImageDesc.m_width;
-      const uint32_t height         = m_inImageDesc.m_height;
-      const uint32_t imgSize        = width*height;
-      
-      uint16_t targetPointsPerRow;
-      uint16_t targetPointsCol;
-      
-//separate Cb Cr
-      uint8_t* restrict cb   = reinterpret_cast<uint8_t*>(s_cb);
-      uint8_t* restrict cr   = reinterpret_cast<uint8_t*>(s_cr);
-      const uint16_t* restrict CbCr = reinterpret_cast<const uint16_t*>(_inImage.m_ptr + 
-                                                                    m_inImageDesc.m_lineLength*m_inImageDesc.m_height);
-      #pragma MUST_ITERATE(8, ,8)
-      for(int i = 0; i < imgSize; i++) {
-          *(cb++) = static_cast<uint8_t>(*CbCr);
-          *(cr++) = static_cast<uint8_t>((*CbCr) >> 8);
-          CbCr++;
-      }
+  bool m_lumaInPlace;
+  // distance between luma samples of adjacent source pixels in a row
+  uint32_t m_lumaPixelStride;
+  /*
+    With decimation everything below works on a smaller image made of every m_decimation
+    pixel and row; rows, columns and window bounds are in its coordinates.
+  */
+  uint32_t m_workWidth;
+  uint32_t m_workHeight;
+  // luma columns fetched for the window, with a margin for 3x3 neighbourhoods
+  uint32_t m_lumaLeft;
+  uint32_t m_lumaRight;
+  // first row of the window which gets a full 3x3 neighbourhood
+  uint32_t m_firstRow;
+
+  HoughLineFitter m_lineFitter;
+
+  // strongest corners, sorted by descending score
+  uint32_t m_cornerCount;
+  int16_t m_cornerScores[TRIK_MAX_TARGET_COUNT - 1];
+  int16_t m_cornerCols[TRIK_MAX_TARGET_COUNT - 1];
+  int16_t m_cornerRows[TRIK_MAX_TARGET_COUNT - 1];
+
+  typedef const uint8_t* (EdgeLineSensorCvAlgorithm::*FetchLumaFuncPtr)(const ImageBuffer&, uint32_t);
+  FetchLumaFuncPtr fetchLumaRow = nullptr;
+  FetchLumaFuncPtr fetchLumaRowFull = nullptr;
+
+  // YUYV keeps luma in even bytes; row is unpacked into one of three rotating row buffers
+  const uint8_t* fetchLumaRowYuyv(const ImageBuffer& _inImage, uint32_t _srcRow) {
+    const uint64_t* restrict srcYuyv = reinterpret_cast<const uint64_t*>(_inImage.m_ptr + _srcRow * m_inImageDesc.m_lineLength);
+    uint8_t* lumaRow = s_edgeLumaRows + (_srcRow % 3) * m_inImageDesc.m_width;
+    uint64_t* restrict dstY = reinterpret_cast<uint64_t*>(lumaRow);
+
+    srcYuyv += m_lumaLeft / 4;
+    dstY += m_lumaLeft / 8;
+
+    assert((m_lumaRight - m_lumaLeft) % 8 == 0); // window is aligned to 32 with 8 column margin
+#pragma MUST_ITERATE(4, , )
+    for (uint32_t c = m_lumaLeft; c < m_lumaRight; c += 8) {
+      const uint64_t yuyv01 = *srcYuyv++;
+      const uint64_t yuyv23 = *srcYuyv++;
+      *dstY++ = _itoll(_packl4(_hill(yuyv23), _loll(yuyv23)), _packl4(_hill(yuyv01), _loll(yuyv01)));
+    }
 
+    return lumaRow;
+  }
 
-//Sobel edge detection
-      const unsigned char* restrict y_in_sobel  = reinterpret_cast<const unsigned char*>(_inImage.m_ptr);
-      unsigned char* restrict   sobel_out = reinterpret_cast<unsigned char*>(s_y);
-      IMG_sobel_3x3_8(y_in_sobel, sobel_out, width, height);
-
-      IMG_thr_gt2max_8(reinterpret_cast<const unsigned char*>(s_y), 
-                       reinterpret_cast<unsigned char*>(s_y),
-                       width, height, 50);
-
-//detect line
-      const uint8_t* restrict sobelBin = reinterpret_cast<unsigned char*>(s_y);
-      assert(m_inImageDesc.m_height % 4 == 0); // verified in setup
-      #pragma MUST_ITERATE(4, ,4)
-      for(int r = 0; r < height; r++) {
-        targetPointsPerRow = 0;
-        targetPointsCol = 0;
-
-        assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
-#pragma MUST_ITERATE(32, ,32)
-        for(int c = 0; c < width; c++) {
-          if(c > 15 && c < width - 15) {
-            const bool det = (*sobelBin == 0xFF);
-            targetPointsPerRow += det;
-            targetPointsCol += det?c:0;
-          }
-          sobelBin++;
-        }
-        m_targetX      += targetPointsCol;
-        m_targetPoints += targetPointsPerRow;
-      }
+  // Every m_decimation luma sample of every m_decimation row, for both formats; _row is a decimated row
+  const uint8_t* fetchLumaRowDecimated(const ImageBuffer& _inImage, uint32_t _row) {
+    const uint32_t sampleStride = m_decimation * m_lumaPixelStride;
+    const uint8_t* restrict srcY = reinterpret_cast<const uint8_t*>(_inImage.m_ptr + _row * m_decimation * m_inImageDesc.m_lineLength);
+    uint8_t* lumaRow = s_edgeLumaRows + (_row % 3) * m_inImageDesc.m_width;
+    uint8_t* restrict dstY = lumaRow;
 
-#ifdef CORNERS
-//Harris corner detector
-      VLIB_xyGradientsAndMagnitude(reinterpret_cast<const uint8_t*>(_inImage.m_ptr), 
-                                   reinterpret_cast<int16_t*>(s_xGrad), 
-                                   reinterpret_cast<int16_t*>(s_yGrad),
-                                   reinterpret_cast<int16_t*>(s_gradMag), width, height);
-
-      VLIB_harrisScore_7x7(reinterpret_cast<const int16_t*>(s_xGrad),
-                           reinterpret_cast<const int16_t*>(s_yGrad),
-                           width, height,
-                           reinterpret_cast<int16_t*>(s_harrisScore),
-                           1500, 
-                           reinterpret_cast<uint8_t*>(s_buffer));
-
-      VLIB_nonMaxSuppress_7x7_S16(reinterpret_cast<const int16_t*>(s_harrisScore), 
-                                  width, height, 7000, 
-                                  reinterpret_cast<uint8_t*>(s_corners));
-#endif
+    srcY += m_lumaLeft * sampleStride;
 
-//in_img to rgb565
-      const short* restrict coeff = s_coeff_el;
-      const unsigned char* restrict res_in = reinterpret_cast<const unsigned char*>(s_y);
-      const unsigned char* restrict cb_in  = reinterpret_cast<const unsigned char*>(s_cb);
-      const unsigned char* restrict cr_in  = reinterpret_cast<const unsigned char*>(s_cr);
-      unsigned short* rgb565_out           = reinterpret_cast<unsigned short*>(s_gradMag);
-      IMG_ycbcr422pl_to_rgb565(coeff, res_in, cb_in, cr_in, rgb565_out, width*height);
-
-
-//lets try scaling out // & highlight corners
-      const uint16_t* restrict imgRgb565ptr  = reinterpret_cast<uint16_t*>(s_gradMag);
-      const uint32_t dstLineLength  = m_outImageDesc.m_lineLength;
-      const uint32_t* restrict p_hi2ho = s_hi2ho;
-      #pragma MUST_ITERATE(8, ,8)
-      for(int r = 0; r < height; r++) {
-        const uint32_t dR = *(p_hi2ho++);
-        uint16_t* restrict dIR = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dR*dstLineLength);
-        const uint32_t* restrict p_wi2wo = s_wi2wo;
-        #pragma MUST_ITERATE(8, ,8)
-        for(int c = 0; c < width; c++) {
-          const uint32_t dC = *(p_wi2wo++);
-          *(dIR+dC) = *(imgRgb565ptr++);
-        }
-      }
+#pragma MUST_ITERATE(8, , 8)
+    for (uint32_t c = m_lumaLeft; c < m_lumaRight; ++c) {
+      dstY[c] = *srcY;
+      srcY += sampleStride;
+    }
 
-#ifdef CORNERS
-      const uint8_t* restrict corners  = reinterpret_cast<uint8_t*>(s_corners);      
-      p_hi2ho = s_hi2ho;
-      for(int r = 0; r < height; r++) {
-        const uint32_t dR = *(p_hi2ho++);
-        uint16_t* dIR = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dR*dstLineLength);
-        const uint32_t* restrict p_wi2wo = s_wi2wo;
-        for(int c = 0; c < width; c++) {
-          const uint32_t dC = *(p_wi2wo++);
-          if(c > 5 && c < 315 && r > 5 && r < 235)
-            if (*corners != 0)
-              drawCornerHighlight(c, r, _outImage, 0xff0000);
-          corners++;
-        }
-      }
-#endif
+    return lumaRow;
+  }
 
-    }
+  // NV16 luma plane is used in place
+  const uint8_t* fetchLumaRowNV16(const ImageBuffer& _inImage, uint32_t _srcRow) {
+    return reinterpret_cast<const uint8_t*>(_inImage.m_ptr + _srcRow * m_inImageDesc.m_lineLength);
+  }
 
-  void convertImageYuyvToRgb(const ImageBuffer& _inImage, ImageBuffer& _outImage) {
-    const uint32_t width = m_inImageDesc.m_width;
-    const uint32_t height = m_inImageDesc.m_height;
-    const uint32_t imgSize = width * height;
-
-    uint16_t targetPointsPerRow;
-    uint16_t targetPointsCol;
-
-    // separate Cb Cr
-    uint8_t* restrict y2 = reinterpret_cast<uint8_t*>(s_y2);
-    uint8_t* restrict cb = reinterpret_cast<uint8_t*>(s_cb);
-    uint8_t* restrict cr = reinterpret_cast<uint8_t*>(s_cr);
-    const uint8_t* restrict CbCr = reinterpret_cast<const uint8_t*>(_inImage.m_ptr);
-    for (int i = 0; i < imgSize / 2; i++) {
-      *(y2++) = *CbCr;
-      CbCr++;
-      *(cb++) = *CbCr;
-      CbCr++;
-      *(y2++) = *CbCr;
-      CbCr++;
-      *(cr++) = *CbCr;
-      CbCr++;
-    }
+  static uint32_t __attribute__((always_inline)) sobelRowSum(const uint32_t _l, const uint32_t _c, const uint32_t _r) {
+    return _add2(_add2(_l, _r), _add2(_c, _c));
+  }
+
+  /*
+    Sobel magnitude of 4 pixels starting at _col, thresholded.
+    Returns 4-bit mask, bit i set if pixel _col+i is an edge.
+  */
+  static uint32_t __attribute__((always_inline))
+  detectEdge4(const uint8_t* restrict _top, const uint8_t* restrict _mid, const uint8_t* restrict _bot, const uint32_t _col) {
+    const uint32_t topL = _mem4_const(_top + _col - 1);
+    const uint32_t topC = _mem4_const(_top + _col);
+    const uint32_t topR = _mem4_const(_top + _col + 1);
+    const uint32_t midL = _mem4_const(_mid + _col - 1);
+    const uint32_t midR = _mem4_const(_mid + _col + 1);
+    const uint32_t botL = _mem4_const(_bot + _col - 1);
+    const uint32_t botC = _mem4_const(_bot + _col);
+    const uint32_t botR = _mem4_const(_bot + _col + 1);
+
+    const uint32_t threshold = _pack2(m_edgeThreshold, m_edgeThreshold);
+
+    const uint32_t gxLo = _sub2(sobelRowSum(_unpklu4(topR), _unpklu4(midR), _unpklu4(botR)), sobelRowSum(_unpklu4(topL), _unpklu4(midL), _unpklu4(botL)));
+    const uint32_t gxHi = _sub2(sobelRowSum(_unpkhu4(topR), _unpkhu4(midR), _unpkhu4(botR)), sobelRowSum(_unpkhu4(topL), _unpkhu4(midL), _unpkhu4(botL)));
+    const uint32_t gyLo = _sub2(sobelRowSum(_unpklu4(botL), _unpklu4(botC), _unpklu4(botR)), sobelRowSum(_unpklu4(topL), _unpklu4(topC), _unpklu4(topR)));
+    const uint32_t gyHi = _sub2(sobelRowSum(_unpkhu4(botL), _unpkhu4(botC), _unpkhu4(botR)), sobelRowSum(_unpkhu4(topL), _unpkhu4(topC), _unpkhu4(topR)));
+
+    const uint32_t magLo = _add2(_abs2(gxLo), _abs2(gyLo));
+    const uint32_t magHi = _add2(_abs2(gxHi), _abs2(gyHi));
+
+    return _cmpgt2(magLo, threshold) | (_cmpgt2(magHi, threshold) << 2);
+  }
 
-    // Sobel edge detection
-    const unsigned char* restrict y_in_sobel = reinterpret_cast<const unsigned char*>(s_y2);
-    unsigned char* restrict sobel_out = reinterpret_cast<unsigned char*>(s_y);
-    IMG_sobel_3x3_8(y_in_sobel, sobel_out, width, height);
+  /*
+    Single pass over the processing window: luma rows are fetched once into a 3-row window,
+    Sobel magnitude is thresholded and column sums are accumulated on the fly.
+  */
+  void proceedImage(const ImageBuffer& _inImage, ImageBuffer& _outImage, const bool _preview) {
+    const uint32_t decimation = m_decimation;
+    const uint32_t width = m_workWidth;
+    const uint32_t height = m_workHeight;
+    const uint32_t border = m_edgeBorder / decimation;
+    const uint32_t roiLeft = m_roiLeft / decimation;
+    const uint32_t roiRight = m_roiRight / decimation;
+    const uint32_t roiTop = m_roiTop / decimation;
+    const uint32_t roiBottom = m_roiBottom / decimation;
+    // columns [border..width - border] are analyzed, the last one in a group of its own
+    const uint32_t lastCol = width - border;
+    const uint32_t colBot = roiLeft > border ? roiLeft : border;
+    const uint32_t colTop = roiRight < lastCol ? roiRight : lastCol + 4;
+    const uint32_t rowBot = roiTop > 1 ? roiTop : 1;
+    const uint32_t rowTop = roiBottom < height - 1 ? roiBottom : height - 1;
+    const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
 
-    IMG_thr_gt2max_8(reinterpret_cast<const unsigned char*>(s_y), reinterpret_cast<unsigned char*>(s_y), width, height, 50);
+    if (_preview)
+      clearOutputPreview(_outImage);
 
-    // detect line
-    const uint8_t* restrict sobelBin = reinterpret_cast<unsigned char*>(s_y);
-    assert(m_inImageDesc.m_height % 4 == 0); // verified in setup
-    for (int r = 0; r < height; r++) {
-      targetPointsPerRow = 0;
-      targetPointsCol = 0;
+    if (colBot >= colTop || rowBot >= rowTop)
+      return;
 
-      assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
-#pragma MUST_ITERATE(2, , 2)
-      for (int c = 0; c < width; c++) {
-        if (c > 15 && c < width - 15) {
-          const bool det = (*sobelBin == 0xFF);
-          targetPointsPerRow += det;
-          targetPointsCol += det ? c : 0;
+    m_lumaLeft = roiLeft > 8 ? roiLeft - 8 : 0;
+    m_lumaRight = roiRight < width - 8 ? roiRight + 8 : width;
+    m_firstRow = rowBot;
+
+    const uint8_t* top = (this->*fetchLumaRow)(_inImage, rowBot - 1);
+    const uint8_t* mid = (this->*fetchLumaRow)(_inImage, rowBot);
+
+    uint32_t rowMask[IMG_WIDTH_MAX / 32];
+
+    for (uint32_t r = rowBot; r < rowTop; ++r) {
+      const uint8_t* bot = (this->*fetchLumaRow)(_inImage, r + 1);
+      uint16_t* restrict dstImageRow = reinterpret_cast<uint16_t*>(_outImage.m_ptr + s_hi2ho[r * decimation] * dstLineLength);
+
+      uint32_t targetPointsPerRow = 0;
+      uint32_t targetPointsCol = 0;
+      memset(rowMask, 0, sizeof(rowMask));
+
+      assert((colTop - colBot) % 4 == 0); // window is aligned to 32 source columns
+#pragma MUST_ITERATE(1, , )
+      for (uint32_t c = colBot; c < colTop; c += 4) {
+        const uint32_t det = detectEdge4(top, mid, bot, c) & (c == lastCol ? 0x1 : 0xf);
+        rowMask[c / 32] |= _bitr(det) >> (c % 32);
+        const uint32_t detPoints = _bitc4(det);
+        targetPointsPerRow += detPoints;
+        targetPointsCol += detPoints * c + s_edgeMaskColSum[det];
+
+        if (_preview && det != 0) {
+          const uint32_t* restrict p_wi2wo = s_wi2wo + c * decimation;
+          dstImageRow[p_wi2wo[0]] = (det & 0x1) ? 0xffff : 0;
+          dstImageRow[p_wi2wo[decimation]] = (det & 0x2) ? 0xffff : 0;
+          dstImageRow[p_wi2wo[2 * decimation]] = (det & 0x4) ? 0xffff : 0;
+          dstImageRow[p_wi2wo[3 * decimation]] = (det & 0x8) ? 0xffff : 0;
         }
-        sobelBin++;
       }
+
       m_targetX += targetPointsCol;
       m_targetPoints += targetPointsPerRow;
+
+      m_lineFitter.voteRow(rowMask, (width + 31) / 32, r);
+
+      detectCornersRow(top, r);
+
+      top = mid;
+      mid = bot;
     }
+  }
 
-#ifdef CORNERS
-    // Harris corner detector
-    VLIB_xyGradientsAndMagnitude(reinterpret_cast<const uint8_t*>(_inImage.m_ptr), reinterpret_cast<int16_t*>(s_xGrad), reinterpret_cast<int16_t*>(s_yGrad),
-      reinterpret_cast<int16_t*>(s_gradMag), width, height);
+  void __attribute__((always_inline)) insertCorner(const int16_t _score, const int16_t _col, const int16_t _row) {
+    uint32_t idx = m_cornerCount;
+    if (idx == m_maxCorners) {
+      if (_score <= m_cornerScores[idx - 1])
+        return;
+      --idx;
+    } else {
+      ++m_cornerCount;
+    }
 
-    VLIB_harrisScore_7x7(reinterpret_cast<const int16_t*>(s_xGrad), reinterpret_cast<const int16_t*>(s_yGrad), width, height,
-      reinterpret_cast<int16_t*>(s_harrisScore_el), 1500, reinterpret_cast<uint8_t*>(s_buffer_el));
+    for (; idx > 0 && m_cornerScores[idx - 1] < _score; --idx) {
+      m_cornerScores[idx] = m_cornerScores[idx - 1];
+      m_cornerCols[idx] = m_cornerCols[idx - 1];
+      m_cornerRows[idx] = m_cornerRows[idx - 1];
+    }
+    m_cornerScores[idx] = _score;
+    m_cornerCols[idx] = _col;
+    m_cornerRows[idx] = _row;
+  }
 
-    VLIB_nonMaxSuppress_7x7_S16(reinterpret_cast<const int16_t*>(s_harrisScore_el), width, height, 7000, reinterpret_cast<uint8_t*>(s_corners_el));
-#endif
+  // 3x3 non-maximum suppression of score row _row, packed over pairs of columns
+  void suppressCornersRow(const uint32_t _row) {
+    const uint32_t lumaLeft = m_lumaLeft;
+    const uint32_t lumaRight = m_lumaRight;
+    const uint32_t stride = m_inImageDesc.m_width;
+    const int16_t* restrict score = s_cornerScore + (_row % 3) * stride;
 
-    // in_img to rgb565
-    const short* restrict coeff = s_coeff_el;
-    const unsigned char* restrict res_in = reinterpret_cast<const unsigned char*>(s_y);
-    const unsigned char* restrict cb_in = reinterpret_cast<const unsigned char*>(s_cb);
-    const unsigned char* restrict cr_in = reinterpret_cast<const unsigned char*>(s_cr);
-    unsigned short* rgb565_out = reinterpret_cast<unsigned short*>(s_gradMag);
-    IMG_ycbcr422pl_to_rgb565(coeff, res_in, cb_in, cr_in, rgb565_out, width * height);
+    const uint64_t* restrict score0 = reinterpret_cast<const uint64_t*>(s_cornerScore + lumaLeft);
+    const uint64_t* restrict score1 = reinterpret_cast<const uint64_t*>(s_cornerScore + stride + lumaLeft);
+    const uint64_t* restrict score2 = reinterpret_cast<const uint64_t*>(s_cornerScore + 2 * stride + lumaLeft);
+    uint64_t* restrict colMax = reinterpret_cast<uint64_t*>(s_cornerColMax + lumaLeft);
 
-    // lets try scaling out // & highlight corners
-    const uint16_t* restrict imgRgb565ptr = reinterpret_cast<uint16_t*>(s_gradMag);
-    const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
-    const uint32_t* restrict p_hi2ho = s_hi2ho;
-    for (int r = 0; r < height; r++) {
-      const uint32_t dR = *(p_hi2ho++);
-      uint16_t* restrict dIR = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dR * dstLineLength);
-      const uint32_t* restrict p_wi2wo = s_wi2wo;
 #pragma MUST_ITERATE(2, , 2)
-      for (int c = 0; c < width; c++) {
-        const uint32_t dC = *(p_wi2wo++);
-        *(dIR + dC) = *(imgRgb565ptr++);
-      }
+    for (uint32_t c = lumaLeft; c < lumaRight; c += 4) {
+      const uint64_t s0 = *score0++;
+      const uint64_t s1 = *score1++;
+      const uint64_t s2 = *score2++;
+      *colMax++ = _itoll(_max2(_max2(_hill(s0), _hill(s1)), _hill(s2)), _max2(_max2(_loll(s0), _loll(s1)), _loll(s2)));
     }
 
-#ifdef CORNERS
-    const uint8_t* restrict corners = reinterpret_cast<uint8_t*>(s_corners_el);
-    p_hi2ho = s_hi2ho;
-    for (int r = 0; r < height; r++) {
-      const uint32_t dR = *(p_hi2ho++);
-      uint16_t* dIR = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dR * dstLineLength);
-      const uint32_t* restrict p_wi2wo = s_wi2wo;
-      for (int c = 0; c < width; c++) {
-        const uint32_t dC = *(p_wi2wo++);
-        if (c > 5 && c < 315 && r > 5 && r < 235)
-          if (*corners != 0)
-            drawCornerHighlight(c, r, _outImage, 0xff0000);
-        corners++;
-      }
+    // scores are only valid two columns inside of fetched luma, neighbours of a tested column must be valid too
+    const uint32_t colBot = lumaLeft + m_cornerBorder;
+    const uint32_t colTop = lumaRight - m_cornerBorder;
+
+#pragma MUST_ITERATE(4, , 2)
+    for (uint32_t c = colBot; c < colTop; c += 2) {
+      const uint32_t center = _amem4_const(score + c);
+      const uint32_t localMax = _max2(_max2(_mem4_const(s_cornerColMax + c - 1), _amem4_const(s_cornerColMax + c)), _mem4_const(s_cornerColMax + c + 1));
+      const uint32_t det = _cmpeq2(center, localMax) & _cmpgt2(center, 0);
+
+      if (det & 0x1)
+        insertCorner(score[c], c, _row);
+      if (det & 0x2)
+        insertCorner(score[c + 1], c + 1, _row);
     }
-#endif
+  }
+
+  /*
+    Harris corner response, fed with one luma row window per call.
+    _top points to luma row _row-1; rows are either consecutive in the input or in the luma ring.
+    Only fetched luma columns [m_lumaLeft..m_lumaRight) are used; rings keep frame column indexing.
+  */
+  void detectCornersRow(const uint8_t* _top, const uint32_t _row) {
+    const uint32_t lumaLeft = m_lumaLeft;
+    const uint32_t width = m_lumaRight - lumaLeft;
+
+    // gradients of row _row, entry i is column lumaLeft+i+1
+    if (m_lumaInPlace) {
+      IMG_corr_3x3_i8_c16s(_top + lumaLeft, s_cornerIx, width - 2, m_inImageDesc.m_lineLength, s_cornerMaskX[0]);
+      IMG_corr_3x3_i8_c16s(_top + lumaLeft, s_cornerIy, width - 2, m_inImageDesc.m_lineLength, s_cornerMaskY[0]);
+    } else {
+      const uint32_t topSlot = (_row - 1) % 3;
+      IMG_corr_3x3_i8_c16s(s_edgeLumaRows + lumaLeft, s_cornerIx, width - 2, m_inImageDesc.m_width, s_cornerMaskX[topSlot]);
+      IMG_corr_3x3_i8_c16s(s_edgeLumaRows + lumaLeft, s_cornerIy, width - 2, m_inImageDesc.m_width, s_cornerMaskY[topSlot]);
+    }
+
+    const uint32_t slot = (_row % 3) * m_inImageDesc.m_width + lumaLeft;
+    const int32_t* restrict ix = s_cornerIx;
+    const int32_t* restrict iy = s_cornerIy;
+    int16_t* restrict ixx = s_cornerIxx + slot;
+    int16_t* restrict iyy = s_cornerIyy + slot;
+    int16_t* restrict ixy = s_cornerIxy + slot;
+
+#pragma MUST_ITERATE(8, , 2)
+    for (uint32_t i = 0; i < width - 2; ++i) {
+      const int32_t gx = *ix++;
+      const int32_t gy = *iy++;
+      *ixx++ = (gx * gx) >> m_cornerProductShift;
+      *iyy++ = (gy * gy) >> m_cornerProductShift;
+      *ixy++ = (gx * gy) >> m_cornerProductShift;
+    }
+
+    // products of rows _row-2.._row are ready, box filter does not care about their order in the ring
+    if (_row < m_firstRow + 2)
+      return;
+
+    IMG_conv_3x3_i16s_c16s(s_cornerIxx + lumaLeft, s_cornerSxx, width - 4, m_inImageDesc.m_width, s_cornerBoxMask, m_cornerBoxShift);
+    IMG_conv_3x3_i16s_c16s(s_cornerIyy + lumaLeft, s_cornerSyy, width - 4, m_inImageDesc.m_width, s_cornerBoxMask, m_cornerBoxShift);
+    IMG_conv_3x3_i16s_c16s(s_cornerIxy + lumaLeft, s_cornerSxy, width - 4, m_inImageDesc.m_width, s_cornerBoxMask, m_cornerBoxShift);
+
+    // score of row _row-1, entry k of S is column lumaLeft+k+2
+    const int16_t* restrict sxx = s_cornerSxx;
+    const int16_t* restrict syy = s_cornerSyy;
+    const int16_t* restrict sxy = s_cornerSxy;
+    int16_t* restrict score = s_cornerScore + ((_row - 1) % 3) * m_inImageDesc.m_width + lumaLeft + 2;
+
+#pragma MUST_ITERATE(8, , 2)
+    for (uint32_t k = 0; k < width - 4; ++k) {
+      const int32_t a = *sxx++;
+      const int32_t b = *syy++;
+      const int32_t c = *sxy++;
+      const uint32_t trace = a + b;
+      const int32_t response = (a * b - c * c - static_cast<int32_t>((trace * trace) >> 4)) >> m_cornerScoreShift;
+      *score++ = range<int32_t>(0, response, 0x7fff);
+    }
+
+    // scores of rows _row-3.._row-1 are ready
+    if (_row < m_firstRow + 4)
+      return;
+
+    suppressCornersRow(_row - 2);
+  }
+
+  // Luma source and work image size for current decimation and window
+  void setupDecimation() {
+    m_workWidth = m_inImageDesc.m_width / m_decimation;
+    m_workHeight = m_inImageDesc.m_height / m_decimation;
+    m_lumaInPlace = m_decimation == 1 && m_lumaPixelStride == 1;
+    fetchLumaRow = m_decimation == 1 ? fetchLumaRowFull : &EdgeLineSensorCvAlgorithm::fetchLumaRowDecimated;
+    m_lineFitter.setCoordShift(m_decimation == 4 ? 2 : (m_decimation == 2 ? 1 : 0));
+    // score borders are never written, and stale ones of previous window must not win suppression
+    memset(s_cornerScore, 0, 3 * m_inImageDesc.m_width * sizeof(*s_cornerScore));
   }
 
 public:
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
-    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize))
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
+    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize, _arena))
       return false;
 
-    // Edge sensor has its own conversion, think about the level 
-    // of abstraction of how to combine it all in cv_algorithms.hpp.
+    // Edge sensor works on luma only and does not need HSV conversion
     if (_inImageDesc.m_format == VideoFormat::YUV422) {
-      convertImageFormatToHSV = &EdgeLineSensorCvAlgorithm::convertImageYuyvToRgb;
+      fetchLumaRowFull = &EdgeLineSensorCvAlgorithm::fetchLumaRowYuyv;
+      m_lumaPixelStride = 2;
     } else if (_inImageDesc.m_format == VideoFormat::NV16) {
-      convertImageFormatToHSV = &EdgeLineSensorCvAlgorithm::convertImageNV16ToRgb;
-    } else { 
+      fetchLumaRowFull = &EdgeLineSensorCvAlgorithm::fetchLumaRowNV16;
+      m_lumaPixelStride = 1;
+    } else {
       return false;
     }
 
-    return true;
+    const uint32_t width = m_inImageDesc.m_width;
+    // last column group of a decimated row may read a byte past it
+    s_edgeLumaRows = _arena.alloc<uint8_t>(3 * width + 4);
+    s_cornerIx = _arena.alloc<int32_t>(width);
+    s_cornerIy = _arena.alloc<int32_t>(width);
+    s_cornerIxx = _arena.alloc<int16_t>(3 * width);
+    s_cornerIyy = _arena.alloc<int16_t>(3 * width);
+    s_cornerIxy = _arena.alloc<int16_t>(3 * width);
+    s_cornerSxx = _arena.alloc<int16_t>(width);
+    s_cornerSyy = _arena.alloc<int16_t>(width);
+    s_cornerSxy = _arena.alloc<int16_t>(width);
+    s_cornerScore = _arena.alloc<int16_t>(3 * width);
+    s_cornerColMax = _arena.alloc<int16_t>(width);
+    if (s_edgeLumaRows == NULL || s_cornerIx == NULL || s_cornerIy == NULL || s_cornerIxx == NULL || s_cornerIyy == NULL || s_cornerIxy == NULL
+        || s_cornerSxx == NULL || s_cornerSyy == NULL || s_cornerSxy == NULL || s_cornerScore == NULL || s_cornerColMax == NULL)
+      return false;
+
+    m_lumaLeft = 0;
+    m_lumaRight = width;
+    m_firstRow = 1;
+    setupDecimation();
+
+    return m_lineFitter.setup(m_inImageDesc.m_width, m_inImageDesc.m_height, m_inImageDesc.m_height / 8, _arena);
   }
 
   virtual bool run(const ImageBuffer& _inImage, ImageBuffer& _outImage, const trik_cv_algorithm_in_args& _inArgs, trik_cv_algorithm_out_args& _outArgs) {
@@ -328,18 +471,19 @@ public:
     m_targetX = 0;
     m_targetY = 0;
     m_targetPoints = 0;
-
-    uint32_t detectValFrom = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_val_from) * 255) / 100, 255); // scaling 0..100 to 0..255
-    uint32_t detectValTo = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_val_to) * 255) / 100, 255);     // scaling 0..100 to 0..255
-
-    m_detectRange = _itoll((detectValFrom << 16) | (0 << 8) | 0, (detectValTo << 16) | (0 << 8) | 0);
-    m_detectExpected = 0x0;
+    m_cornerCount = 0;
+    m_lineFitter.reset();
+    // Sobel and Harris need adjacent rows, so row step is not used here
+    if (setupRoi(_inArgs, false))
+      setupDecimation();
+    m_lineFitter.setMinSupport((m_roiBottom - m_roiTop) / (8 * m_decimation));
 
 #ifdef DEBUG_REPEAT
     for (unsigned repeat = 0; repeat < DEBUG_REPEAT; ++repeat) {
 #endif
-      if (m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0)
-        (this->*convertImageFormatToHSV)(_inImage, _outImage);
+      if (m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0) {
+        proceedImage(_inImage, _outImage, _inArgs.video_out);
+      }
 #ifdef DEBUG_REPEAT
     } // repeat
 #endif
@@ -347,13 +491,15 @@ public:
     int32_t drawY = m_inImageDesc.m_height / 2;
 
     if (m_targetPoints > 0) {
-      const int32_t targetX = m_targetX / m_targetPoints;
-      const int32_t targetY = m_targetY / m_targetPoints;
+      const int32_t targetX = (m_targetX * static_cast<int32_t>(m_decimation)) / m_targetPoints;
+      const int32_t targetY = (m_targetY * static_cast<int32_t>(m_decimation)) / m_targetPoints;
 
       assert(m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0); // more or less safe since no target points would be detected otherwise
-      const uint32_t targetRadius = std::ceil(std::sqrt(static_cast<float>(m_targetPoints) / 3.1415927f));
+      // edges are thin, so a decimated edge pixel stands for m_decimation source ones
+      const uint32_t targetRadius = std::ceil(std::sqrt(static_cast<float>(m_targetPoints * m_decimation) / 3.1415927f));
 
-      drawRgbTargetCenterLine(targetX, drawY, _outImage, 0xff0000);
+      if (_inArgs.video_out)
+        drawRgbTargetCenterLine(targetX, drawY, _outImage, 0xff0000);
 
       _outArgs.targets[0].out_target.targetLocation.x = ((targetX - static_cast<int32_t>(m_inImageDesc.m_width) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_width);
       _outArgs.targets[0].out_target.targetLocation.y = ((targetY - static_cast<int32_t>(m_inImageDesc.m_height) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_height);
@@ -365,7 +511,27 @@ public:
       _outArgs.targets[0].out_target.targetLocation.size = 0;
     }
 
-    Cache_wbInv(_outImage.m_ptr, _outImage.m_size, Cache_Type_ALL, TRUE);
+    m_lineFitter.findLines();
+    m_lineFitter.report(_outArgs);
+
+    // targets[1..] are corners, size is corner strength clamped to 0..100
+    for (uint32_t i = 0; i < m_maxCorners; ++i) {
+      TargetLocation& corner = _outArgs.targets[i + 1].out_target.targetLocation;
+      if (i < m_cornerCount) {
+        const int32_t cornerX = m_cornerCols[i] * static_cast<int32_t>(m_decimation);
+        const int32_t cornerY = m_cornerRows[i] * static_cast<int32_t>(m_decimation);
+        if (_inArgs.video_out)
+          drawCornerHighlight(cornerX, cornerY, _outImage, 0xff0000);
+
+        corner.x = ((cornerX - static_cast<int32_t>(m_inImageDesc.m_width) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_width);
+        corner.y = ((cornerY - static_cast<int32_t>(m_inImageDesc.m_height) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_height);
+        corner.size = range<int32_t>(0, m_cornerScores[i] >> 4, 100);
+      } else {
+        corner.x = 0;
+        corner.y = 0;
+        corner.size = 0;
+      }
+    }
 
     return true;
   }
@@ -0,0 +1,89 @@
+#ifndef TRIK_SENSORS_FEATURE_CACHE_HPP_
+#define TRIK_SENSORS_FEATURE_CACHE_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <stdint.h>
+
+namespace trik {
+namespace sensors {
+
+// Processing window a feature was computed over, in source pixels
+struct FeatureWindow {
+  uint32_t m_left;
+  uint32_t m_top;
+  uint32_t m_right;
+  uint32_t m_bottom;
+  uint32_t m_rowStep;
+  uint32_t m_decimation;
+};
+
+/*
+  Bookkeeping of features of the current frame shared by sensors running on it.
+  Server starts a new frame before every step; a feature is computed by the first sensor
+  asking for it and reused by the next ones as long as they ask for a window it covers.
+  Feature buffers themselves belong to the sensors and are carved from the arena.
+*/
+class FeatureCache {
+private:
+  uint32_t m_frame;
+
+  uint32_t m_hsvFrame;
+  FeatureWindow m_hsvWindow;
+
+  uint32_t m_classFrame;
+  FeatureWindow m_classWindow;
+  uint32_t m_classLutVersion;
+
+  static bool covers(const FeatureWindow& _cached, const FeatureWindow& _window) {
+    return _cached.m_left == _window.m_left && _cached.m_top == _window.m_top && _cached.m_right == _window.m_right && _cached.m_bottom == _window.m_bottom
+           && _cached.m_decimation == _window.m_decimation && _window.m_rowStep % _cached.m_rowStep == 0;
+  }
+
+public:
+  FeatureCache() {
+    m_frame = 1;
+    m_hsvFrame = 0;
+    m_classFrame = 0;
+    m_classLutVersion = 0;
+  }
+
+  void nextFrame() {
+    if (++m_frame == 0)
+      m_frame = 1;
+  }
+
+  // Buffers were released, nothing computed so far is valid
+  void drop() {
+    m_hsvFrame = 0;
+    m_classFrame = 0;
+  }
+
+  // Same window and decimation, rows converted with a step dividing the requested one
+  bool hasHsv(const FeatureWindow& _window) const { return m_hsvFrame == m_frame && covers(m_hsvWindow, _window); }
+
+  void setHsv(const FeatureWindow& _window) {
+    m_hsvFrame = m_frame;
+    m_hsvWindow = _window;
+  }
+
+  // Class frame is only valid for the lookup table it was classified with
+  bool hasClasses(const FeatureWindow& _window, const uint32_t _lutVersion) const {
+    return m_classFrame == m_frame && m_classLutVersion == _lutVersion && covers(m_classWindow, _window);
+  }
+
+  void setClasses(const FeatureWindow& _window, const uint32_t _lutVersion) {
+    m_classFrame = m_frame;
+    m_classWindow = _window;
+    m_classLutVersion = _lutVersion;
+  }
+};
+
+static FeatureCache s_featureCache;
+
+}
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef TRIK_SENSORS_FRAME_STATS_HPP_
+#define TRIK_SENSORS_FRAME_STATS_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <c6x.h>
+#include <cassert>
+
+#include "image.hpp"
+#include <trik/buffer.h>
+#include <trik/sensors/cv_algorithm_args.h>
+#include <trik/sensors/video_format.h>
+
+namespace trik {
+namespace sensors {
+
+/*
+  Statistics of the frame sensors run on, for exposure control on ARM.
+  Pixel 0 of every 4 in every 4th row is sampled, which keeps them under a percent of
+  a frame conversion and still counts thousands of pixels on the smallest frame.
+  Frame is YUYV or NV16, chroma is that of the sampled pair.
+*/
+#define FRAME_STATS_STEP 4
+
+class FrameStats {
+private:
+  uint16_t m_lumaHist[256];
+  uint32_t m_samples;
+  uint32_t m_lumaSum;
+  uint32_t m_uSum;
+  uint32_t m_vSum;
+  uint32_t m_chromaSum;
+
+  void __attribute__((always_inline)) addSample(const uint32_t _y, const uint32_t _u, const uint32_t _v) {
+    ++m_lumaHist[_y];
+    m_lumaSum += _y;
+    m_uSum += _u;
+    m_vSum += _v;
+    const uint32_t du = _u >= 128 ? _u - 128 : 128 - _u;
+    const uint32_t dv = _v >= 128 ? _v - 128 : 128 - _v;
+    m_chromaSum += du > dv ? du : dv;
+  }
+
+  // Y0 U Y1 V
+  void collectYuyv(const ImageDesc& _desc, const ImageBuffer& _image) {
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t row = 0; row < _desc.m_height; row += FRAME_STATS_STEP) {
+      const uint32_t* restrict yuyv = reinterpret_cast<const uint32_t*>(_image.m_ptr + row * _desc.m_lineLength);
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < _desc.m_width; col += FRAME_STATS_STEP) {
+        const uint32_t pair = yuyv[col / 2];
+        addSample(pair & 0xff, (pair >> 8) & 0xff, pair >> 24);
+      }
+    }
+  }
+
+  // luma plane, then chroma plane with V of a pair first
+  void collectNV16(const ImageDesc& _desc, const ImageBuffer& _image) {
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t row = 0; row < _desc.m_height; row += FRAME_STATS_STEP) {
+      const uint32_t* restrict y4 = reinterpret_cast<const uint32_t*>(_image.m_ptr + row * _desc.m_lineLength);
+      const uint32_t* restrict vu4 = reinterpret_cast<const uint32_t*>(_image.m_ptr + (_desc.m_height + row) * _desc.m_lineLength);
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < _desc.m_width; col += FRAME_STATS_STEP) {
+        const uint32_t vu = *vu4++;
+        addSample(*y4++ & 0xff, (vu >> 8) & 0xff, vu & 0xff);
+      }
+    }
+  }
+
+  // Lowest luma with more than the given share of samples at or below it
+  uint32_t percentile(const uint32_t _percent) const {
+    const uint32_t needed = (m_samples * _percent) / 100;
+    uint32_t count = 0;
+    for (uint32_t y = 0; y < 256; ++y) {
+      count += m_lumaHist[y];
+      if (count > needed)
+        return y;
+    }
+    return 255;
+  }
+
+public:
+  bool collect(const ImageDesc& _desc, const ImageBuffer& _image, trik_frame_stats& _stats) {
+    memset(&_stats, 0, sizeof(_stats));
+    memset(m_lumaHist, 0, sizeof(m_lumaHist));
+    m_lumaSum = 0;
+    m_uSum = 0;
+    m_vSum = 0;
+    m_chromaSum = 0;
+
+    if (_desc.m_format == VideoFormat::YUV422)
+      collectYuyv(_desc, _image);
+    else if (_desc.m_format == VideoFormat::NV16)
+      collectNV16(_desc, _image);
+    else
+      return false;
+
+    m_samples = (_desc.m_height / FRAME_STATS_STEP) * (_desc.m_width / FRAME_STATS_STEP);
+    if (m_samples == 0)
+      return false;
+
+    for (uint32_t bin = 0; bin < TRIK_LUMA_HIST_BINS; ++bin) {
+      uint32_t count = 0;
+      for (uint32_t y = bin * (256 / TRIK_LUMA_HIST_BINS); y < (bin + 1) * (256 / TRIK_LUMA_HIST_BINS); ++y)
+        count += m_lumaHist[y];
+      _stats.luma_hist[bin] = (count * 255 + m_samples / 2) / m_samples;
+    }
+    _stats.luma_mean = m_lumaSum / m_samples;
+    _stats.luma_low = percentile(5);
+    _stats.luma_median = percentile(50);
+    _stats.luma_high = percentile(95);
+    _stats.u_mean = m_uSum / m_samples;
+    _stats.v_mean = m_vSum / m_samples;
+    _stats.chroma_mean = m_chromaSum / m_samples;
+    _stats.samples = m_samples;
+    return true;
+  }
+};
+
+}
+}
+
+#endif
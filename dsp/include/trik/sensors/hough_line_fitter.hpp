@@ -0,0 +1,275 @@
+#ifndef TRIK_SENSORS_HOUGH_LINE_FITTER_HPP_
+#define TRIK_SENSORS_HOUGH_LINE_FITTER_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <c6x.h>
+#include <cassert>
+#include <cmath>
+
+#include "arena.hpp"
+#include <trik/buffer.h>
+#include <trik/sensors/cv_algorithm_args.h>
+
+namespace trik {
+namespace sensors {
+
+/*
+  Coarse Hough transform for straight lines.
+  Line is x*cos(t) + y*sin(t) = rho, x and y are relative to the image center.
+  Angle t goes from -90 to 90 degrees in HOUGH_THETA_STEP steps, 0 means vertical line.
+  Rho goes from minus to plus half of the frame diagonal, so accumulator size follows frame size.
+  Points voting are centers of horizontal runs of detected pixels in every row and of vertical
+  runs in every column, so a line gets about as many votes as it is long at any angle.
+*/
+#define HOUGH_THETA_STEP 5
+#define HOUGH_THETA_BINS (180 / HOUGH_THETA_STEP)
+#define HOUGH_TRIG_SHIFT 14
+#define HOUGH_RHO_SHIFT 1
+#define HOUGH_NMS_RHO 4 // peaks closer than that many rho bins on adjacent angles are merged
+
+// packed (sin << 16 | cos) in Q14, to be used with _dotp2 against (y << 16 | x), same for every fitter
+static uint32_t s_houghCosSin[HOUGH_THETA_BINS];
+
+class HoughLineFitter {
+private:
+  int32_t m_centerX;
+  int32_t m_centerY;
+  uint32_t m_minSupport;
+  // votes come in decimated coordinates, shifted left by that to get image ones
+  uint32_t m_coordShift;
+  int32_t m_rhoMax;
+  uint32_t m_rhoBins;
+  // every fitter has its own, arena is reset before the sensors are set up again
+  uint16_t* m_acc;
+
+  // detected pixels of the last row passed and rows their vertical runs started at
+  uint32_t m_prevMask[IMG_WIDTH_MAX / 32];
+  uint32_t m_prevWords;
+  int32_t m_prevRow;
+  int16_t m_colRunStart[IMG_WIDTH_MAX];
+
+  uint32_t m_lineCount;
+  uint16_t m_lineSupport[TRIK_MAX_TARGET_COUNT];
+  int16_t m_lineTheta[TRIK_MAX_TARGET_COUNT];
+  int16_t m_lineRho[TRIK_MAX_TARGET_COUNT];
+
+  void insertLine(const uint16_t _support, const int16_t _theta, const int16_t _rho) {
+    uint32_t idx = m_lineCount;
+    if (idx == TRIK_MAX_TARGET_COUNT) {
+      if (_support <= m_lineSupport[idx - 1])
+        return;
+      --idx;
+    } else {
+      ++m_lineCount;
+    }
+
+    for (; idx > 0 && m_lineSupport[idx - 1] < _support; --idx) {
+      m_lineSupport[idx] = m_lineSupport[idx - 1];
+      m_lineTheta[idx] = m_lineTheta[idx - 1];
+      m_lineRho[idx] = m_lineRho[idx - 1];
+    }
+    m_lineSupport[idx] = _support;
+    m_lineTheta[idx] = _theta;
+    m_lineRho[idx] = _rho;
+  }
+
+  // Votes for centers of vertical runs which ended on the last row passed, bit per column of mask word _w
+  void voteColRunEnds(const uint32_t _w, uint32_t _ended) {
+    while (_ended != 0) {
+      const uint32_t pos = _lmbd(1, _ended);
+      const int32_t col = _w * 32 + pos;
+      vote(col, (m_colRunStart[col] + m_prevRow) / 2);
+      _ended &= ~(0x80000000u >> pos);
+    }
+  }
+
+  bool isLocalMax(const uint32_t _theta, const uint32_t _rho, const uint16_t _votes) const {
+    const uint32_t thetaBot = _theta > 0 ? _theta - 1 : 0;
+    const uint32_t thetaTop = _theta < HOUGH_THETA_BINS - 1 ? _theta + 1 : HOUGH_THETA_BINS - 1;
+    const uint32_t rhoBot = _rho > HOUGH_NMS_RHO ? _rho - HOUGH_NMS_RHO : 0;
+    const uint32_t rhoTop = _rho < m_rhoBins - 1 - HOUGH_NMS_RHO ? _rho + HOUGH_NMS_RHO : m_rhoBins - 1;
+
+    for (uint32_t t = thetaBot; t <= thetaTop; ++t) {
+      const uint16_t* acc = m_acc + t * m_rhoBins;
+      for (uint32_t r = rhoBot; r <= rhoTop; ++r) {
+        // ties are resolved in favor of the first cell in scan order
+        const bool before = t < _theta || (t == _theta && r < _rho);
+        if (acc[r] > _votes || (before && acc[r] == _votes))
+          return false;
+      }
+    }
+    return true;
+  }
+
+public:
+  bool setup(const uint32_t _width, const uint32_t _height, const uint32_t _minSupport, Arena& _arena) {
+    m_centerX = _width / 2;
+    m_centerY = _height / 2;
+    m_minSupport = _minSupport;
+    m_coordShift = 0;
+    m_rhoMax = static_cast<int32_t>(std::ceil(std::sqrt(static_cast<float>(m_centerX * m_centerX + m_centerY * m_centerY))));
+    m_rhoBins = (2 * m_rhoMax) >> HOUGH_RHO_SHIFT;
+
+    m_acc = _arena.alloc<uint16_t>(HOUGH_THETA_BINS * m_rhoBins);
+    if (m_acc == NULL)
+      return false;
+
+    for (uint32_t t = 0; t < HOUGH_THETA_BINS; ++t) {
+      const float theta = static_cast<float>(static_cast<int32_t>(t * HOUGH_THETA_STEP) - 90) * 3.1415927f / 180.0f;
+      const int32_t cosQ = static_cast<int32_t>(std::floor(std::cos(theta) * (1 << HOUGH_TRIG_SHIFT) + 0.5f));
+      const int32_t sinQ = static_cast<int32_t>(std::floor(std::sin(theta) * (1 << HOUGH_TRIG_SHIFT) + 0.5f));
+      s_houghCosSin[t] = _pack2(sinQ, cosQ);
+    }
+    return true;
+  }
+
+  // line needs at least that many votes, about its length in mask pixels; callers scale it with the window
+  void setMinSupport(const uint32_t _minSupport) { m_minSupport = _minSupport; }
+
+  void setCoordShift(const uint32_t _coordShift) { m_coordShift = _coordShift; }
+
+  void reset() {
+    memset(m_acc, 0, HOUGH_THETA_BINS * m_rhoBins * sizeof(*m_acc));
+    memset(m_prevMask, 0, sizeof(m_prevMask));
+    m_prevWords = 0;
+    m_prevRow = 0;
+    m_lineCount = 0;
+  }
+
+  void __attribute__((always_inline)) vote(const int32_t _col, const int32_t _row) {
+    const uint32_t xy = _pack2((_row << m_coordShift) - m_centerY, (_col << m_coordShift) - m_centerX);
+    const int32_t rhoOffset = m_rhoMax << HOUGH_TRIG_SHIFT;
+    const uint32_t rhoBins = m_rhoBins;
+    uint16_t* restrict acc = m_acc;
+
+#pragma MUST_ITERATE(HOUGH_THETA_BINS, HOUGH_THETA_BINS, HOUGH_THETA_BINS)
+    for (uint32_t t = 0; t < HOUGH_THETA_BINS; ++t) {
+      const uint32_t bin = static_cast<uint32_t>(_dotp2(xy, s_houghCosSin[t]) + rhoOffset) >> (HOUGH_TRIG_SHIFT + HOUGH_RHO_SHIFT);
+      if (bin < rhoBins)
+        ++acc[bin];
+      acc += rhoBins;
+    }
+  }
+
+  /*
+    Votes for the centers of every run of detected pixels in a row and of vertical runs ended
+    above it. Every row of the window is passed, empty ones too, in increasing order; vertical
+    runs span skipped rows. Mask is MSB-first: column 0 of the row is bit 31 of _mask[0].
+  */
+  void voteRow(const uint32_t* restrict _mask, const uint32_t _words, const int32_t _row) {
+    bool inRun = false;
+    int32_t runStart = 0;
+
+    assert(_words <= IMG_WIDTH_MAX / 32);
+    for (uint32_t w = 0; w < _words; ++w) {
+      const uint32_t bits = _mask[w];
+      const uint32_t prevBits = m_prevMask[w];
+      if (bits == prevBits)
+        continue;
+
+      voteColRunEnds(w, prevBits & ~bits);
+      uint32_t started = bits & ~prevBits;
+      while (started != 0) {
+        const uint32_t pos = _lmbd(1, started);
+        m_colRunStart[w * 32 + pos] = _row;
+        started &= ~(0x80000000u >> pos);
+      }
+      m_prevMask[w] = bits;
+    }
+    m_prevWords = _words;
+    m_prevRow = _row;
+
+    for (uint32_t w = 0; w < _words; ++w) {
+      const uint32_t bits = _mask[w];
+      const int32_t base = w * 32;
+
+      if (!inRun && bits == 0)
+        continue;
+      if (inRun && bits == 0xffffffff)
+        continue;
+
+      uint32_t pos = 0;
+      while (pos < 32) {
+        if (inRun) {
+          pos += _lmbd(0, bits << pos);
+          if (pos >= 32)
+            break;
+          vote((runStart + base + static_cast<int32_t>(pos) - 1) / 2, _row);
+          inRun = false;
+        } else {
+          pos += _lmbd(1, bits << pos);
+          if (pos >= 32)
+            break;
+          runStart = base + pos;
+          inRun = true;
+        }
+      }
+    }
+
+    if (inRun)
+      vote((runStart + static_cast<int32_t>(_words * 32) - 1) / 2, _row);
+  }
+
+  void findLines() {
+    // vertical runs still open end on the last row
+    for (uint32_t w = 0; w < m_prevWords; ++w)
+      voteColRunEnds(w, m_prevMask[w]);
+    memset(m_prevMask, 0, sizeof(m_prevMask));
+
+    for (uint32_t t = 0; t < HOUGH_THETA_BINS; ++t) {
+      const uint16_t* restrict acc = m_acc + t * m_rhoBins;
+      for (uint32_t r = 0; r < m_rhoBins; ++r) {
+        const uint16_t votes = acc[r];
+        if (votes < m_minSupport)
+          continue;
+        if (m_lineCount == TRIK_MAX_TARGET_COUNT && votes <= m_lineSupport[TRIK_MAX_TARGET_COUNT - 1])
+          continue;
+        if (isLocalMax(t, r, votes))
+          insertLine(votes, t, r);
+      }
+    }
+  }
+
+  uint32_t lineCount() const { return m_lineCount; }
+
+  void lineAt(const uint32_t _idx, int32_t& _angle, int32_t& _rho, uint32_t& _support) const {
+    _angle = static_cast<int32_t>(m_lineTheta[_idx] * HOUGH_THETA_STEP) - 90;
+    _rho = static_cast<int32_t>((m_lineRho[_idx] << HOUGH_RHO_SHIFT) + (1 << HOUGH_RHO_SHIFT) / 2) - m_rhoMax;
+    _support = m_lineSupport[_idx];
+  }
+
+  /*
+    Fills out args lines, offset is scaled like target x: rho of a vertical line at the
+    image border is +-100.
+  */
+  void report(trik_cv_algorithm_out_args& _outArgs) const {
+    for (uint32_t i = 0; i < TRIK_MAX_TARGET_COUNT; ++i) {
+      TargetLine& line = _outArgs.lines[i];
+      if (i < m_lineCount) {
+        int32_t angle;
+        int32_t rho;
+        uint32_t support;
+        lineAt(i, angle, rho, support);
+        line.angle = angle;
+        line.offset = (rho * 100) / m_centerX;
+        line.support = support;
+      } else {
+        line.angle = 0;
+        line.offset = 0;
+        line.support = 0;
+      }
+    }
+  }
+};
+
+}
+}
+
+#endif
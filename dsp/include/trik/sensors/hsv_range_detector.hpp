@@ -14,6 +14,8 @@
 #include <cassert>
 #include <cmath>
 
+#include "integral_image.hpp"
+
 namespace trik {
 namespace sensors {
 
@@ -74,6 +76,9 @@ private:
   static const int pos_shift = 0;    // 1 == 2^0
 
   static int32_t s_hsvClusters[cstrs_max];
+  // penalized clusters, a range is scored with one sum whatever its width
+  static int32_t s_hsvPenalties[(cstrs_max + 1) * 2];
+  IntegralImage<int32_t> m_penalties;
   ImageData m_image;
   Roi m_roi;
   Cluster m_maxFillCluster;
@@ -123,12 +128,21 @@ private:
     return newC;
   }
 
+  void sumPenalties() {
+    int32_t row[cstrs_max];
+    for (int v = 0; v < cstrs_max; v++)
+      row[v] = s_hsvClusters[v] != 0 ? s_hsvClusters[v] : -K0;
+
+    m_penalties.reset();
+    m_penalties.addRow(row);
+  }
+
   uint64_t F(ColorRange C) {
     //      ColorRange* C = _C;
     int64_t res = 0;
 
-    for (int v = C.v0; v <= C.v1; v++)
-      res += s_hsvClusters[v] != 0 ? s_hsvClusters[v] : -K0;
+    if (C.v0 <= C.v1)
+      res += m_penalties.sum(C.v0, 0, C.v1 + 1, 1);
     /*
           if (C.h0 <= C.h1)
             for(int h = C.h0; h <= C.h1; h++)
@@ -174,13 +188,15 @@ private:
   }
 
 public:
-  HsvRangeDetector(int _imgWidth, int _imgHeight, int _detectZoneScale) { initImg(_imgWidth, _imgHeight, _detectZoneScale); }
+  HsvRangeDetector(int _imgWidth, int _imgHeight, int _detectZoneScale) : m_penalties(s_hsvPenalties, cstrs_max, 1) {
+    initImg(_imgWidth, _imgHeight, _detectZoneScale);
+  }
 
-  void detect(uint16_t& _hFrom, uint16_t& _hTo, uint8_t& _sFrom, uint8_t& _sTo, uint8_t& _vFrom, uint8_t& _vTo, uint64_t* _rgb888hsv) {
+  void detect(uint16_t& _hFrom, uint16_t& _hTo, uint8_t& _sFrom, uint8_t& _sTo, uint8_t& _vFrom, uint8_t& _vTo, uint32_t* _hsv) {
     // initialize stuff
     srand(time(NULL));
 
-    const uint64_t* restrict img = _rgb888hsv;
+    const uint32_t* restrict img = _hsv;
 
     // initialize Clusters
     memset(s_hsvClusters, 0, cstrs_max * sizeof(int32_t));
@@ -195,7 +211,7 @@ public:
 
     for (int row = 0; row < m_image.height; row++) {
       for (int col = 0; col < m_image.width; col++) {
-        pixel.whole = _loll(*(img)++);
+        pixel.whole = *(img)++;
         /*
                   currCluster.h = (pixel.parts.h >> pos_shift);
                   currCluster.s = (pixel.parts.s >> pos_shift);
@@ -231,6 +247,7 @@ public:
     */
     C.v0 = C.v1 = m_maxFillCluster.v;
 
+    sumPenalties();
     int64_t L = F(C);
     int64_t newL = 0;
     double T = 150;
@@ -286,6 +303,7 @@ public:
 };
 
 int32_t restrict HsvRangeDetector::s_hsvClusters[HsvRangeDetector::cstrs_max];
+int32_t restrict HsvRangeDetector::s_hsvPenalties[(HsvRangeDetector::cstrs_max + 1) * 2];
 
 }
 }
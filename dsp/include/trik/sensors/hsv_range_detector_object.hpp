@@ -14,6 +14,7 @@
 #include <cassert>
 #include <cmath>
 
+#include "integral_image.hpp"
 
 
 /* **** **** **** **** **** */ namespace trik /* **** **** **** **** **** */ {
@@ -33,6 +34,9 @@ class HsvRangeDetectorObject
     static const int pos_shift = 4; // 16 == 2^4
     */
     static int32_t s_hs_clasters[cstrs_max_num][cstrs_max_num];
+    //penalized clasters summed over hue rows and saturation columns
+    static int32_t s_hs_penalties[(cstrs_max_num + 1) * (cstrs_max_num + 1)];
+    IntegralImage<int32_t> m_penalties;
     int width;
     int height;
     
@@ -101,47 +105,38 @@ class HsvRangeDetectorObject
         return res;
     }
 
-    uint64_t m_foo(int h1, int h2, int s1, int s2)
+    //empty clasters are penalized, every range is scored with at most two rectangle sums
+    void sumPenalties()
     {
-        int64_t res = 0;
-        int32_t val = 0;
+        int32_t row[cstrs_max_num];
 
-        if (h1 <= h2)
+        m_penalties.reset();
+        for(int h_pos = 0; h_pos < cstrs_max_num; h_pos++)
         {
-
-            for(int h_pos = h1; h_pos <= h2; h_pos++)
+            for(int s_pos = 0; s_pos < cstrs_max_num; s_pos++)
             {
-                for(int s_pos = s1; s_pos <= s2; s_pos++)
-                {
-                    val = s_hs_clasters[h_pos][s_pos];
-                    res += val != 0 ? val : -K0;
-
-                    //res += s_hs_clasters[h_pos][s_pos];
-                }
+                const int32_t val = s_hs_clasters[h_pos][s_pos];
+                row[s_pos] = val != 0 ? val : -K0;
             }
+            m_penalties.addRow(row);
+        }
+    }
+
+    uint64_t m_foo(int h1, int h2, int s1, int s2)
+    {
+        int64_t res = 0;
+
+        if (s1 > s2)
+            return res;
 
+        if (h1 <= h2)
+        {
+            res += m_penalties.sum(s1, h1, s2 + 1, h2 + 1);
         }
         else // h1 > h2
         {
-            for(int h_pos = h1; h_pos < cstrs_max_num; h_pos++)
-            {
-                for(int s_pos = s1; s_pos <= s2; s_pos++)
-                {
-                    val = s_hs_clasters[h_pos][s_pos];
-                    res += val != 0 ? val : -K0;
-
-                    //res += s_hs_clasters[h_pos][s_pos];
-                }
-            }
-            for(int h_pos = 0; h_pos <= h2; h_pos++)
-            {
-                for(int s_pos = s1; s_pos <= s2; s_pos++)
-                {
-                    val = s_hs_clasters[h_pos][s_pos];
-                    res += val != 0 ? val : -K0;
-
-                }
-            }
+            res += m_penalties.sum(s1, h1, s2 + 1, cstrs_max_num);
+            res += m_penalties.sum(s1, 0, s2 + 1, h2 + 1);
         }
 
         return res;
@@ -149,6 +144,7 @@ class HsvRangeDetectorObject
 
   public:
     HsvRangeDetectorObject(int _imgWidth, int _imgHeight, int _detectZoneScale)
+      : m_penalties(s_hs_penalties, cstrs_max_num, cstrs_max_num)
     {
       width = _imgWidth;
       height = _imgHeight;
@@ -169,11 +165,11 @@ class HsvRangeDetectorObject
       neg_b = hHeight + 2*step;
     }
 
-    void detect(uint16_t& _hFrom, uint16_t& _hTo, uint8_t& _sFrom, uint8_t& _sTo, uint8_t& _vFrom, uint8_t& _vTo, uint64_t* _rgb888hsv) 
+    void detect(uint16_t& _hFrom, uint16_t& _hTo, uint8_t& _sFrom, uint8_t& _sTo, uint8_t& _vFrom, uint8_t& _vTo, uint32_t* _hsv) 
     {
     //initialize stuff
       srand(time(NULL));
-      const uint64_t* restrict img = _rgb888hsv;
+      const uint32_t* restrict img = _hsv;
       int h1;
       int h2;
       int s1;
@@ -196,7 +192,7 @@ class HsvRangeDetectorObject
       {
         for (int col = 0; col < width; col++)
         {
-          pixel.whole = _loll(*(img)++);
+          pixel.whole = *(img)++;
           h_pos = (pixel.parts.h >> pos_shift);
           s_pos = (pixel.parts.s >> pos_shift);
 
@@ -229,6 +225,7 @@ class HsvRangeDetectorObject
       s1 = s_max_pos;
       s2 = s_max_pos;
 
+      sumPenalties();
       int64_t L = m_foo(h1, h2, s1, s2);
 
       double T = 150;
@@ -299,6 +296,7 @@ class HsvRangeDetectorObject
 };
 
 int32_t restrict HsvRangeDetectorObject::s_hs_clasters[HsvRangeDetectorObject::cstrs_max_num][HsvRangeDetectorObject::cstrs_max_num];
+int32_t restrict HsvRangeDetectorObject::s_hs_penalties[(HsvRangeDetectorObject::cstrs_max_num + 1) * (HsvRangeDetectorObject::cstrs_max_num + 1)];
 
 
 } /* **** **** **** **** **** * namespace sensors * **** **** **** **** **** */
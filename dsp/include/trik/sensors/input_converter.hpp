@@ -0,0 +1,223 @@
+#ifndef TRIK_SENSORS_INPUT_CONVERTER_HPP_
+#define TRIK_SENSORS_INPUT_CONVERTER_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <c6x.h>
+#include <cassert>
+
+#include "arena.hpp"
+#include "image.hpp"
+#include <trik/buffer.h>
+#include <trik/sensors/video_format.h>
+
+namespace trik {
+namespace sensors {
+
+/*
+  Sensors read YUYV and NV16 only. Other formats cameras emit natively are converted once
+  per frame into an NV16 frame carved from the arena, which all sensors of the set then run on.
+  NV16 is kept with the chroma byte order sensors expect: V of a pair first, then U.
+  RGB is converted to BT.601 studio swing YUV, the inverse of what sensors convert back with;
+  chroma of a pair is taken from the average of its two pixels.
+*/
+class InputConverter {
+private:
+  typedef void (InputConverter::*ConvertFuncPtr)(const ImageBuffer&);
+
+  ImageDesc m_inImageDesc;
+  ImageDesc m_outImageDesc;
+  ConvertFuncPtr m_convert;
+  int8_t* restrict m_frame;
+
+  // pixel words hold R, G and B in bytes 0, 1 and 2
+  static uint32_t __attribute__((always_inline)) rgbToY(const uint32_t _rgb) { return (_dotpu4(_rgb, 0x00198142) + 128 + (16 << 8)) >> 8; }
+
+  // V and U of the pair in bytes 0 and 1
+  static uint32_t __attribute__((always_inline)) rgbPairToVu(const uint32_t _rgb1, const uint32_t _rgb2) {
+    const uint32_t rgb = _avgu4(_rgb1, _rgb2);
+    const uint32_t v = (_dotpus4(rgb, 0x00eea270) + 128 + (128 << 8)) >> 8;
+    const uint32_t u = (_dotpus4(rgb, 0x0070b6da) + 128 + (128 << 8)) >> 8;
+    return v | (u << 8);
+  }
+
+  static uint32_t __attribute__((always_inline)) rgb565ToRgb(const uint32_t _rgb565) {
+    const uint32_t r = (_rgb565 >> 11) & 0x1f;
+    const uint32_t g = (_rgb565 >> 5) & 0x3f;
+    const uint32_t b = _rgb565 & 0x1f;
+    return ((r << 3) | (r >> 2)) | (((g << 2) | (g >> 4)) << 8) | (((b << 3) | (b >> 2)) << 16);
+  }
+
+  static void __attribute__((always_inline)) storeRgb4(const uint32_t _rgb1, const uint32_t _rgb2, const uint32_t _rgb3, const uint32_t _rgb4,
+    uint32_t* restrict _y4, uint32_t* restrict _vu4) {
+    *_y4 = rgbToY(_rgb1) | (rgbToY(_rgb2) << 8) | (rgbToY(_rgb3) << 16) | (rgbToY(_rgb4) << 24);
+    *_vu4 = rgbPairToVu(_rgb1, _rgb2) | (rgbPairToVu(_rgb3, _rgb4) << 16);
+  }
+
+  int8_t* rowY(const uint32_t _row) const { return m_frame + _row * m_outImageDesc.m_lineLength; }
+  int8_t* rowVu(const uint32_t _row) const { return m_frame + (m_outImageDesc.m_height + _row) * m_outImageDesc.m_lineLength; }
+
+  // RGB565 little endian, RGB565X is the same with bytes of every pixel swapped
+  template <bool _swapped>
+  void convertRgb565(const ImageBuffer& _inImage) {
+    const uint32_t width = m_inImageDesc.m_width;
+
+#pragma MUST_ITERATE(4, , 4)
+    for (uint32_t row = 0; row < m_inImageDesc.m_height; ++row) {
+      const uint64_t* restrict src4 = reinterpret_cast<const uint64_t*>(_inImage.m_ptr + row * m_inImageDesc.m_lineLength);
+      uint32_t* restrict y4 = reinterpret_cast<uint32_t*>(rowY(row));
+      uint32_t* restrict vu4 = reinterpret_cast<uint32_t*>(rowVu(row));
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < width; col += 4) {
+        const uint64_t rgb565x4 = *src4++;
+        const uint32_t rgb565x12 = _swapped ? _swap4(_loll(rgb565x4)) : _loll(rgb565x4);
+        const uint32_t rgb565x34 = _swapped ? _swap4(_hill(rgb565x4)) : _hill(rgb565x4);
+        storeRgb4(rgb565ToRgb(rgb565x12), rgb565ToRgb(rgb565x12 >> 16), rgb565ToRgb(rgb565x34), rgb565ToRgb(rgb565x34 >> 16), y4++, vu4++);
+      }
+    }
+  }
+
+  // RGB24, bytes R, G, B of four pixels span three words
+  void convertRgb888(const ImageBuffer& _inImage) {
+    const uint32_t width = m_inImageDesc.m_width;
+
+#pragma MUST_ITERATE(4, , 4)
+    for (uint32_t row = 0; row < m_inImageDesc.m_height; ++row) {
+      const uint32_t* restrict src = reinterpret_cast<const uint32_t*>(_inImage.m_ptr + row * m_inImageDesc.m_lineLength);
+      uint32_t* restrict y4 = reinterpret_cast<uint32_t*>(rowY(row));
+      uint32_t* restrict vu4 = reinterpret_cast<uint32_t*>(rowVu(row));
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < width; col += 4) {
+        const uint32_t w1 = *src++;
+        const uint32_t w2 = *src++;
+        const uint32_t w3 = *src++;
+        storeRgb4(w1, (w1 >> 24) | (w2 << 8), (w2 >> 16) | (w3 << 16), w3 >> 8, y4++, vu4++);
+      }
+    }
+  }
+
+  // YUV32, bytes A, Y, U, V of every pixel
+  void convertYuv444(const ImageBuffer& _inImage) {
+    const uint32_t width = m_inImageDesc.m_width;
+
+#pragma MUST_ITERATE(4, , 4)
+    for (uint32_t row = 0; row < m_inImageDesc.m_height; ++row) {
+      const uint64_t* restrict src2 = reinterpret_cast<const uint64_t*>(_inImage.m_ptr + row * m_inImageDesc.m_lineLength);
+      uint32_t* restrict y4 = reinterpret_cast<uint32_t*>(rowY(row));
+      uint32_t* restrict vu4 = reinterpret_cast<uint32_t*>(rowVu(row));
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < width; col += 4) {
+        const uint64_t ayuv12 = *src2++;
+        const uint64_t ayuv34 = *src2++;
+        // V, Y of each pixel, then Y of all four
+        const uint32_t vy12 = _packh4(_hill(ayuv12), _loll(ayuv12));
+        const uint32_t vy34 = _packh4(_hill(ayuv34), _loll(ayuv34));
+        *y4++ = _packl4(vy34, vy12);
+        // U, V of the pair average in the high halfword
+        *vu4++ = _swap4(_packh2(_avgu4(_hill(ayuv34), _loll(ayuv34)), _avgu4(_hill(ayuv12), _loll(ayuv12))));
+      }
+    }
+  }
+
+  // Luma plane is the same, U and V planes of half width are interleaved
+  void convertYuv422p(const ImageBuffer& _inImage) {
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t height = m_inImageDesc.m_height;
+    const uint32_t lineLength = m_inImageDesc.m_lineLength;
+    const int8_t* restrict srcU = _inImage.m_ptr + lineLength * height;
+    const int8_t* restrict srcV = srcU + (lineLength / 2) * height;
+
+#pragma MUST_ITERATE(4, , 4)
+    for (uint32_t row = 0; row < height; ++row) {
+      const uint64_t* restrict srcY8 = reinterpret_cast<const uint64_t*>(_inImage.m_ptr + row * lineLength);
+      const uint32_t* restrict srcU4 = reinterpret_cast<const uint32_t*>(srcU + row * (lineLength / 2));
+      const uint32_t* restrict srcV4 = reinterpret_cast<const uint32_t*>(srcV + row * (lineLength / 2));
+      uint64_t* restrict y8 = reinterpret_cast<uint64_t*>(rowY(row));
+      uint64_t* restrict vu8 = reinterpret_cast<uint64_t*>(rowVu(row));
+
+#pragma MUST_ITERATE(4, , 4)
+      for (uint32_t col = 0; col < width; col += 8) {
+        *y8++ = *srcY8++;
+        const uint32_t u4 = *srcU4++;
+        const uint32_t v4 = *srcV4++;
+        *vu8++ = _itoll(_unpkhu4(v4) | (_unpkhu4(u4) << 8), _unpklu4(v4) | (_unpklu4(u4) << 8));
+      }
+    }
+  }
+
+public:
+  InputConverter() {
+    m_convert = NULL;
+    m_frame = NULL;
+  }
+
+  // Formats sensors read themselves
+  static bool isNative(const VideoFormat _format) { return _format == VideoFormat::YUV422 || _format == VideoFormat::NV16; }
+
+  /*
+    Picks a converter for the camera format and carves the NV16 frame. Frame of the camera format
+    has to fit in the input buffer shared with ARM. Sensors are to be set up with outDesc.
+  */
+  bool setup(const ImageDesc& _inImageDesc, Arena& _arena) {
+    m_inImageDesc = _inImageDesc;
+    m_outImageDesc.m_width = _inImageDesc.m_width;
+    m_outImageDesc.m_height = _inImageDesc.m_height;
+    m_outImageDesc.m_lineLength = _inImageDesc.m_width;
+    m_outImageDesc.m_format = VideoFormat::NV16;
+    m_convert = NULL;
+    m_frame = NULL;
+
+    uint32_t bytesPerPixel;
+    uint32_t planes = 1;
+    if (_inImageDesc.m_format == VideoFormat::RGB565) {
+      m_convert = &InputConverter::convertRgb565<false>;
+      bytesPerPixel = 2;
+    } else if (_inImageDesc.m_format == VideoFormat::RGB565X) {
+      m_convert = &InputConverter::convertRgb565<true>;
+      bytesPerPixel = 2;
+    } else if (_inImageDesc.m_format == VideoFormat::RGB888) {
+      m_convert = &InputConverter::convertRgb888;
+      bytesPerPixel = 3;
+    } else if (_inImageDesc.m_format == VideoFormat::YUV444) {
+      m_convert = &InputConverter::convertYuv444;
+      bytesPerPixel = 4;
+    } else if (_inImageDesc.m_format == VideoFormat::YUV422P) {
+      m_convert = &InputConverter::convertYuv422p;
+      bytesPerPixel = 1;
+      planes = 2;
+    } else {
+      return false;
+    }
+
+    if (_inImageDesc.m_width % 32 != 0 || _inImageDesc.m_lineLength < _inImageDesc.m_width * bytesPerPixel || _inImageDesc.m_lineLength % 8 != 0)
+      return false;
+    if (_inImageDesc.m_lineLength * _inImageDesc.m_height * planes > BUFFER_SIZE)
+      return false;
+
+    m_frame = _arena.alloc<int8_t>(m_outImageDesc.m_lineLength * m_outImageDesc.m_height * 2);
+    return m_frame != NULL;
+  }
+
+  const ImageDesc& outDesc() const { return m_outImageDesc; }
+
+  // Converts the whole camera frame, returns the NV16 one
+  ImageBuffer convert(const ImageBuffer& _inImage) {
+    (this->*m_convert)(_inImage);
+
+    const ImageBuffer frame = { m_frame, m_outImageDesc.m_lineLength * m_outImageDesc.m_height * 2u };
+    return frame;
+  }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef TRIK_SENSORS_INTEGRAL_IMAGE_HPP_
+#define TRIK_SENSORS_INTEGRAL_IMAGE_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <cassert>
+
+namespace trik {
+namespace sensors {
+
+/*
+  Summed-area table: entry (x, y) holds the sum of values in [0..x) x [0..y), so the sum over
+  any rectangle takes four lookups however large it is. Table is (width + 1) x (height + 1)
+  with zero first row and column, it is owned by the caller and filled once row by row.
+  _Sum has to hold the sum of the whole image, 16 bits do for small histograms and masks.
+*/
+template <typename _Sum>
+class IntegralImage {
+private:
+  _Sum* m_table;
+  uint32_t m_width;
+  uint32_t m_height;
+  uint32_t m_rows;
+
+  _Sum at(const uint32_t _x, const uint32_t _y) const { return m_table[_y * (m_width + 1) + _x]; }
+
+public:
+  static uint32_t tableSize(const uint32_t _width, const uint32_t _height) { return (_width + 1) * (_height + 1); }
+
+  IntegralImage(_Sum* _table, const uint32_t _width, const uint32_t _height) {
+    m_table = _table;
+    m_width = _width;
+    m_height = _height;
+    reset();
+  }
+
+  // Table is filled again from the first row
+  void reset() {
+    m_rows = 0;
+    memset(m_table, 0, (m_width + 1) * sizeof(_Sum));
+  }
+
+  // Appends the next row of values, width of them
+  template <typename _Value>
+  void addRow(const _Value* restrict _values) {
+    assert(m_rows < m_height);
+    const _Sum* restrict above = m_table + m_rows * (m_width + 1);
+    _Sum* restrict row = m_table + (m_rows + 1) * (m_width + 1);
+    _Sum rowSum = 0;
+
+    row[0] = 0;
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t x = 0; x < m_width; ++x) {
+      rowSum += _values[x];
+      row[x + 1] = above[x + 1] + rowSum;
+    }
+    ++m_rows;
+  }
+
+  // Sum of values in [_left.._right) x [_top.._bottom) of the rows added so far
+  _Sum sum(const uint32_t _left, const uint32_t _top, const uint32_t _right, const uint32_t _bottom) const {
+    assert(_left <= _right && _right <= m_width && _top <= _bottom && _bottom <= m_rows);
+    return at(_right, _bottom) - at(_right, _top) - at(_left, _bottom) + at(_left, _top);
+  }
+};
+
+}
+}
+
+#endif
@@ -11,6 +11,7 @@
 #include <cmath>
 #include <xdc/runtime/Diags.h>
 #include <xdc/runtime/Log.h>
+#include "hough_line_fitter.hpp"
 #include "hsv_range_detector.hpp"
 
 namespace trik {
@@ -33,13 +34,176 @@ private:
   int32_t m_targetY;
   uint32_t m_targetPoints;
 
-  void proceedImageHsv(ImageBuffer& _outImage) {
-    const uint64_t* restrict rgb888hsvptr = s_rgb888hsv;
+  HoughLineFitter m_lineFitter;
+
+  // luma range equivalent to the value range, bytes replicated for packed compares
+  uint32_t m_lumaValFrom;
+  uint32_t m_lumaValTo;
+  uint32_t m_lumaFrom4;
+  uint32_t m_lumaTo4;
+  // sum of positions of set bits in a byte, MSB is position 0
+  uint8_t m_bitColSum[256];
+
+  /*
+    With hue and saturation unrestricted only V = max(R, G, B) is thresholded.
+    For a gray pixel V grows monotonically with Y, so the value range is mapped to a luma range
+    through the same YUV to HSV conversion the other paths use. For colored pixels max(R, G, B)
+    is above the gray level of the same luma, so strongly saturated dark colors pass as dark.
+  */
+  void calibrateLuma(const uint32_t _valFrom, const uint32_t _valTo) {
+    if (_valFrom == m_lumaValFrom && _valTo == m_lumaValTo)
+      return;
+
+    int32_t lumaFrom = 256;
+    int32_t lumaTo = -1;
+    for (int32_t y = 0; y < 256; ++y) {
+      const uint32_t hsv = convertRgb888ToHsv(_loll(convert2xYuyvToRgb888(y | (0x80 << 8) | (y << 16) | (0x80 << 24))));
+      const uint32_t val = (hsv >> 16) & 0xff;
+      if (val >= _valFrom && lumaFrom > y)
+        lumaFrom = y;
+      if (val <= _valTo)
+        lumaTo = y;
+    }
+    // empty range, no byte is both at least 255 and at most 0
+    if (lumaFrom > lumaTo) {
+      lumaFrom = 255;
+      lumaTo = 0;
+    }
+
+    m_lumaValFrom = _valFrom;
+    m_lumaValTo = _valTo;
+    m_lumaFrom4 = static_cast<uint32_t>(lumaFrom) * 0x01010101u;
+    m_lumaTo4 = static_cast<uint32_t>(lumaTo) * 0x01010101u;
+  }
+
+  // Bit N is set if luma of pixel N of the eight is in range, byte N of a word is pixel N
+  uint32_t __attribute__((always_inline)) lumaInRange8(const uint32_t _y0123, const uint32_t _y4567) const {
+    const uint32_t out0123 = _cmpltu4(_y0123, m_lumaFrom4) | _cmpgtu4(_y0123, m_lumaTo4);
+    const uint32_t out4567 = _cmpltu4(_y4567, m_lumaFrom4) | _cmpgtu4(_y4567, m_lumaTo4);
+    return (out0123 | (out4567 << 4)) ^ 0xff;
+  }
+
+  // MSB-first mask of pixels with luma in range, 32 pixels per word from _colBot to _colTop
+  void lumaRowMask(const ImageBuffer& _inImage, const uint32_t _srcRow, const uint32_t _colBot, const uint32_t _colTop, uint32_t* restrict _mask) const {
+    const int8_t* restrict srcImageRow = _inImage.m_ptr + _srcRow * m_inImageDesc.m_lineLength;
+
+    if (m_inImageDesc.m_format == VideoFormat::NV16) {
+      // luma plane comes first, one byte per pixel
+      const uint64_t* restrict y8ptr = reinterpret_cast<const uint64_t*>(srcImageRow + _colBot);
+#pragma MUST_ITERATE(1, , )
+      for (uint32_t col = _colBot; col < _colTop; col += 32) {
+        uint32_t bits = 0;
+#pragma MUST_ITERATE(4, 4, 4)
+        for (uint32_t shift = 0; shift < 32; shift += 8) {
+          const uint64_t y8 = *y8ptr++;
+          bits |= lumaInRange8(_loll(y8), _hill(y8)) << shift;
+        }
+        _mask[col / 32] = _bitr(bits);
+      }
+    } else {
+      // Y0 U Y1 V, luma bytes are gathered by packing low bytes of halfwords
+      const uint64_t* restrict yuyv4ptr = reinterpret_cast<const uint64_t*>(srcImageRow + _colBot * 2);
+#pragma MUST_ITERATE(1, , )
+      for (uint32_t col = _colBot; col < _colTop; col += 32) {
+        uint32_t bits = 0;
+#pragma MUST_ITERATE(4, 4, 4)
+        for (uint32_t shift = 0; shift < 32; shift += 8) {
+          const uint64_t yuyv0123 = *yuyv4ptr++;
+          const uint64_t yuyv4567 = *yuyv4ptr++;
+          bits |= lumaInRange8(_packl4(_hill(yuyv0123), _loll(yuyv0123)), _packl4(_hill(yuyv4567), _loll(yuyv4567))) << shift;
+        }
+        _mask[col / 32] = _bitr(bits);
+      }
+    }
+  }
+
+  /*
+    Same as proceedImageHsv for the value-only range the sensor uses, detection works on luma 8 pixels at a time.
+    Preview is converted only for the source pixels which end up in it when downscaled.
+  */
+  void proceedImageLuma(const ImageBuffer& _inImage, ImageBuffer& _outImage, const bool _preview) {
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t colBot = m_roiLeft;
+    const uint32_t colTop = m_roiRight;
+    const uint32_t colStep = m_decimation;
+    const uint32_t rowStep = m_roiRowStep;
+    // columns outside of 5..width-5 are never detected nor drawn
+    const uint32_t firstWordMask = ~0u >> 5;
+    const uint32_t lastWordMask = ~0xfu;
+    const uint32_t previewBot = colBot >= 5 ? colBot : ((5 + colStep - 1) / colStep) * colStep;
+    const uint32_t previewTop = colTop <= width - 4 ? colTop : width - 4;
+
+    uint32_t sampleMask = 0;
+    for (uint32_t col = 0; col < 32; col += colStep)
+      sampleMask |= 0x80000000u >> col;
+
+    int32_t sum_targetX = 0;
+    int32_t sum_targetY = 0;
+    uint32_t sum_targetPoints = 0;
+
+    uint32_t local_hStart = m_hStart;
+    uint32_t local_hStop = m_hStop;
+    uint32_t sum_crossPoints = 0;
+
+    uint32_t rowMask[IMG_WIDTH_MAX / 32];
+    // words outside of the roi are never written
+    memset(rowMask, 0, sizeof(rowMask));
+
+    assert((colTop - colBot) % 32 == 0); // verified in setupRoi
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t srcRow = m_roiTop; srcRow < m_roiBottom; srcRow += rowStep) {
+      lumaRowMask(_inImage, srcRow, colBot, colTop, rowMask);
+
+      uint32_t targetPointsPerRow = 0;
+      uint32_t targetPointsCol = 0;
+#pragma MUST_ITERATE(1, , )
+      for (uint32_t w = colBot / 32; w < colTop / 32; ++w) {
+        uint32_t bits = rowMask[w] & sampleMask;
+        if (w == 0)
+          bits &= firstWordMask;
+        if (w == width / 32 - 1)
+          bits &= lastWordMask;
+
+        const uint32_t bytePoints = _bitc4(bits);
+        const uint32_t points = _dotpu4(bytePoints, 0x01010101);
+        targetPointsPerRow += points;
+        targetPointsCol += points * w * 32 + _dotpu4(bytePoints, 0x00081018) + m_bitColSum[bits >> 24] + m_bitColSum[(bits >> 16) & 0xff]
+                           + m_bitColSum[(bits >> 8) & 0xff] + m_bitColSum[bits & 0xff];
+
+        // detected sample stands for colStep mask bits, so runs stay contiguous when decimated
+        uint32_t runs = bits;
+        for (uint32_t s = 1; s < colStep; ++s)
+          runs |= bits >> s;
+        rowMask[w] = runs;
+      }
+
+      // rows mapped to the same preview row are drawn once, the last one wins as elsewhere
+      if (_preview && isOutputSourceRow(srcRow, rowStep, m_roiBottom))
+        writeInputRow(_outImage, _inImage, srcRow, previewBot, previewTop, rowMask, 0x00ffff);
+
+      sum_targetX += targetPointsCol;
+      sum_targetY += srcRow * targetPointsPerRow;
+      sum_targetPoints += targetPointsPerRow;
+      if (srcRow >= local_hStart && srcRow <= local_hStop)
+        sum_crossPoints += targetPointsPerRow * rowStep * colStep;
+
+      m_lineFitter.voteRow(rowMask, width / 32, srcRow);
+    }
+    m_targetX = sum_targetX;
+    m_targetY = sum_targetY;
+    m_targetPoints = sum_targetPoints;
+    m_crossPoints = sum_crossPoints;
+  }
+
+  void proceedImageHsv(const ImageBuffer& _inImage, ImageBuffer& _outImage, const bool _preview) {
     const uint32_t width = m_inImageDesc.m_width;
-    const uint32_t height = m_inImageDesc.m_height;
-    const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
     const uint64_t u64_hsv_range = m_detectRange;
     const uint32_t u32_hsv_expect = m_detectExpected;
+    const uint32_t colBot = m_roiLeft;
+    const uint32_t colTop = m_roiRight;
+    const uint32_t colStep = m_decimation;
+    // detected sample stands for colStep mask bits, so runs stay contiguous when decimated
+    const uint32_t runMask = ~0u << (32 - colStep);
     uint32_t targetPointsPerRow;
     uint32_t targetPointsCol;
 
@@ -51,46 +215,53 @@ private:
     uint32_t local_hStop = m_hStop;
     uint32_t sum_crossPoints = 0;
 
-    const uint32_t* restrict p_hi2ho = s_hi2ho;
-    assert(m_inImageDesc.m_height % 4 == 0); // verified in setup
-#pragma MUST_ITERATE(4, , 4)
-    for (uint32_t srcRow = 0; srcRow < height; ++srcRow) {
-      const uint32_t dstRow = *(p_hi2ho++);
-      uint16_t* restrict dstImageRow = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstRow * dstLineLength);
+    uint32_t rowMask[IMG_WIDTH_MAX / 32];
+    const uint32_t previewBot = colBot >= 5 ? colBot : ((5 + colStep - 1) / colStep) * colStep;
+    const uint32_t previewTop = colTop <= width - 4 ? colTop : width - 4;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t srcRow = m_roiTop; srcRow < m_roiBottom; srcRow += m_roiRowStep) {
+      const uint32_t* restrict hsvptr = s_hsvFrame + srcRow * width + colBot;
 
       targetPointsPerRow = 0;
       targetPointsCol = 0;
-      const uint32_t* restrict p_wi2wo = s_wi2wo;
-      assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
-#pragma MUST_ITERATE(16, , 16)
-      for (uint32_t srcCol = 0; srcCol < width;) {
-        const uint32_t dstCol = *(p_wi2wo++);
-        const uint64_t rgb888hsv = *rgb888hsvptr++;
+      memset(rowMask, 0, sizeof(rowMask));
+      assert((colTop - colBot) % 32 == 0); // verified in setupRoi
+#pragma MUST_ITERATE(4, , 4)
+      for (uint32_t srcCol = colBot; srcCol < colTop;) {
+        const uint32_t hsv = *hsvptr;
+        hsvptr += colStep;
 
         bool det = false;
         if (srcCol >= 5 && srcCol <= width - 5) {
-          det = detectHsvPixel(_loll(rgb888hsv), u64_hsv_range, u32_hsv_expect);
+          det = detectHsvPixel(hsv, u64_hsv_range, u32_hsv_expect);
+          rowMask[srcCol / 32] |= (det ? runMask : 0) >> (srcCol % 32);
           targetPointsPerRow += det;
           targetPointsCol += det ? srcCol : 0;
-          writeOutputPixel(dstImageRow + dstCol, det ? 0x00ffff : _hill(rgb888hsv));
         }
-        srcCol++;
+        srcCol += colStep;
 
-        const uint32_t dstCol2 = *(p_wi2wo++);
-        const uint64_t rgb888hsv2 = *rgb888hsvptr++;
+        const uint32_t hsv2 = *hsvptr;
+        hsvptr += colStep;
         if (srcCol >= 5 && srcCol <= width - 5) {
-          det = detectHsvPixel(_loll(rgb888hsv2), u64_hsv_range, u32_hsv_expect);
+          det = detectHsvPixel(hsv2, u64_hsv_range, u32_hsv_expect);
+          rowMask[srcCol / 32] |= (det ? runMask : 0) >> (srcCol % 32);
           targetPointsPerRow += det;
           targetPointsCol += det ? srcCol : 0;
-          writeOutputPixel(dstImageRow + dstCol2, det ? 0x00ffff : _hill(rgb888hsv2));
         }
-        srcCol++;
+        srcCol += colStep;
       }
+
+      if (_preview && isOutputSourceRow(srcRow, m_roiRowStep, m_roiBottom))
+        writeInputRow(_outImage, _inImage, srcRow, previewBot, previewTop, rowMask, 0x00ffff);
+
       sum_targetX += targetPointsCol;
       sum_targetY += srcRow * targetPointsPerRow;
       sum_targetPoints += targetPointsPerRow;
       if (srcRow >= local_hStart && srcRow <= local_hStop)
-        sum_crossPoints += targetPointsPerRow;
+        sum_crossPoints += targetPointsPerRow * m_roiRowStep * colStep;
+
+      m_lineFitter.voteRow(rowMask, width / 32, srcRow);
     }
     m_targetX = sum_targetX;
     m_targetY = sum_targetY;
@@ -99,10 +270,24 @@ private:
   }
 
 public:
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
-    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize))
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
+    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize, _arena))
       return false;
-    return true;
+    if (!setupHsvFrame(_arena))
+      return false;
+
+    // out of range values force calibration on the first run
+    m_lumaValFrom = ~0u;
+    m_lumaValTo = ~0u;
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+      uint32_t sum = 0;
+      for (uint32_t pos = 0; pos < 8; ++pos)
+        if ((byte & (0x80 >> pos)) != 0)
+          sum += pos;
+      m_bitColSum[byte] = sum;
+    }
+
+    return m_lineFitter.setup(m_inImageDesc.m_width, m_inImageDesc.m_height, m_inImageDesc.m_height / 8, _arena);
   }
 
   virtual bool run(const ImageBuffer& _inImage, ImageBuffer& _outImage, const trik_cv_algorithm_in_args& _inArgs, trik_cv_algorithm_out_args& _outArgs) {
@@ -115,6 +300,9 @@ public:
     m_targetX = 0;
     m_targetPoints = 0;
     m_crossPoints = 0;
+    m_lineFitter.reset();
+    setupRoi(_inArgs, true);
+    m_lineFitter.setMinSupport(((m_roiBottom - m_roiTop + m_roiRowStep - 1) / m_roiRowStep) / 8);
 
     m_inImageFirstRow = m_inImageDesc.m_height - m_inImageDesc.m_height / m_imageScaleCoeff;
 
@@ -127,6 +315,7 @@ public:
     uint32_t detectValFrom = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_val_from) * 255) / 100, 255); // scaling 0..100 to 0..255
     uint32_t detectValTo = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_val_to) * 255) / 100, 255);     // scaling 0..100 to 0..255
     bool autoDetectHsv = static_cast<bool>(_inArgs.auto_detect_hsv); // true or false
+    const bool preview = _inArgs.video_out;
 
     if (detectHueFrom <= detectHueTo) {
       m_detectRange = _itoll((detectValFrom << 16) | (detectSatFrom << 8) | detectHueFrom, (detectValTo << 16) | (detectSatTo << 8) | detectHueTo);
@@ -147,51 +336,66 @@ public:
 #endif
 
       if (m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0) {
-        (this->*convertImageFormatToHSV)(_inImage);
+        if (preview)
+          clearOutputOutsideRoi(_outImage);
 
+        // range detection needs real HSV statistics, otherwise only luma is compared against the value range
         if (autoDetectHsv) {
+          convertFrameToHsv(_inImage);
           HsvRangeDetector rangeDetector = HsvRangeDetector(m_inImageDesc.m_width, m_inImageDesc.m_height, step);
           rangeDetector.detect(_outArgs.detect_hue_from, _outArgs.detect_hue_to, _outArgs.detect_sat_from, _outArgs.detect_sat_to, _outArgs.detect_val_from,
-            _outArgs.detect_val_to, s_rgb888hsv);
+            _outArgs.detect_val_to, s_hsvFrame);
+          proceedImageHsv(_inImage, _outImage, preview);
+        } else {
+          calibrateLuma(detectValFrom, detectValTo);
+          proceedImageLuma(_inImage, _outImage, preview);
         }
-
-        proceedImageHsv(_outImage);
+        if (preview)
+          markOutputSourceRows(m_roiTop, m_roiBottom);
       }
 
 #ifdef DEBUG_REPEAT
     } // repeat
 #endif
 
-    drawRgbThinLine(hWidth - step, drawY, _outImage, 0xff00ff);
-    drawRgbThinLine(hWidth + step, drawY, _outImage, 0xff00ff);
-    drawRgbThinLine(hWidth - 2 * step, drawY, _outImage, 0xff00ff);
-    drawRgbThinLine(hWidth + 2 * step, drawY, _outImage, 0xff00ff);
+    if (preview) {
+      drawRgbThinLine(hWidth - step, drawY, _outImage, 0xff00ff);
+      drawRgbThinLine(hWidth + step, drawY, _outImage, 0xff00ff);
+      drawRgbThinLine(hWidth - 2 * step, drawY, _outImage, 0xff00ff);
+      drawRgbThinLine(hWidth + 2 * step, drawY, _outImage, 0xff00ff);
+    }
 
     m_hStart = hHeight;
     m_hStop = hHeight + 2 * step;
 
     int crossSize = static_cast<uint32_t>(m_crossPoints * 100) / (m_inImageDesc.m_width * 2 * step);
 
-    drawRgbHorizontalLine(0, m_hStart, _outImage, 0xff0000);
-    drawRgbHorizontalLine(0, m_hStop, _outImage, 0xff0000);
+    if (preview) {
+      drawRgbHorizontalLine(0, m_hStart, _outImage, 0xff0000);
+      drawRgbHorizontalLine(0, m_hStop, _outImage, 0xff0000);
+    }
 
     _outArgs.targets[0].out_target.targetLocation.x = 0;
     _outArgs.targets[0].out_target.targetLocation.y = 0;
     _outArgs.targets[0].out_target.targetLocation.size = 0;
 
     if (m_targetPoints > 10) {
-      const int32_t inImagePixels = m_inImageDesc.m_height * m_inImageDesc.m_width;
+      // size is relative to the pixels actually looked at
+      const int32_t inImagePixels = ((m_roiBottom - m_roiTop + m_roiRowStep - 1) / m_roiRowStep) * ((m_roiRight - m_roiLeft) / m_decimation);
       const int32_t targetX = m_targetX / m_targetPoints;
 
       assert(m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0); // more or less safe since no target points would be detected otherwise
 
-      drawRgbTargetCenterLine(targetX, hHeight, _outImage, 0xff0000);
+      if (preview)
+        drawRgbTargetCenterLine(targetX, hHeight, _outImage, 0xff0000);
 
       _outArgs.targets[0].out_target.targetLocation.x = ((targetX - static_cast<int32_t>(m_inImageDesc.m_width) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_width);
       _outArgs.targets[0].out_target.targetLocation.y = crossSize;
       _outArgs.targets[0].out_target.targetLocation.size = static_cast<uint32_t>(m_targetPoints * 100 * m_imageScaleCoeff) / inImagePixels;
     }
-    Cache_wbInv(_outImage.m_ptr, _outImage.m_size, Cache_Type_ALL, TRUE);
+
+    m_lineFitter.findLines();
+    m_lineFitter.report(_outArgs);
 
     return true;
   }
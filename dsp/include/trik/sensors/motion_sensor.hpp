@@ -21,107 +21,243 @@
 #include <cassert>
 #include <cmath>
 
+extern "C" {
+#include <ti/imglib/src/IMG_sad_8x8/IMG_sad_8x8.h>
+}
+
 namespace trik {
 namespace sensors {
 
-#define CAMERA_NOISE_S16 0x0A00     /* SQ12.3 */
-#define THRESHOLD_FACTOR_S16 0x31ff /* SQ4.11 */
+#define MOTION_BLOCK_SIZE 8
+#define MOTION_BLOCK_PIXELS (MOTION_BLOCK_SIZE * MOTION_BLOCK_SIZE)
+
+/*
+  Both the reference frame and the current strip are stored block-major: every 8x8 luma block
+  occupies 64 consecutive bytes, so IMG_sad_8x8 runs with pitch 8 on both operands.
+  Buffers are sized for the frame and carved from the arena in setup.
+*/
+static uint8_t* restrict s_motionRefY = NULL;
+static uint8_t* restrict s_motionStripY = NULL;
+static uint8_t* restrict s_motionBitmap = NULL;
 
 class MotionSensorCvAlgorithm : public CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X> {
 private:
-  uint64_t m_detectRange;
-  uint32_t m_detectExpected;
-  uint32_t m_srcToDstShift;
+  // mean absolute luma difference per pixel which marks a block as moving
+  static const uint32_t m_blockDiffThreshold = 12;
+  // at least this many moving blocks are required to report a target
+  static const uint32_t m_minMotionBlocks = 2;
+
+  bool m_refValid;
+
+  // source pixels covered by a block side, blocks sample every m_decimation pixel
+  uint32_t m_blockSpan;
+  // distance between luma samples of adjacent source pixels in a row
+  uint32_t m_lumaPixelStride;
+
+  uint32_t m_blocksW;
+  uint32_t m_blocksH;
+
+  // block range of the processing window, [left..right) x [top..bottom)
+  uint32_t m_blockLeft;
+  uint32_t m_blockRight;
+  uint32_t m_blockTop;
+  uint32_t m_blockBottom;
 
   int32_t m_targetX;
   int32_t m_targetY;
   uint32_t m_targetPoints;
 
-  bool testifyRgbPixel(const uint32_t _rgb888, uint32_t& _out_rgb888) const {
-    const uint32_t u32_rgb_or16 = _unpkhu4(_rgb888);
-    const uint32_t u32_rgb_gb16 = _unpklu4(_rgb888);
-    const uint32_t u32_rgb_max2 = _maxu4(_rgb888, _rgb888 >> 8);
-    const uint32_t u32_rgb_max = _clr(_maxu4(u32_rgb_max2, u32_rgb_max2 >> 8), 8, 31); // top 3 bytes were non-zeroes!
-    const uint32_t u32_rgb_max_max = _pack2(u32_rgb_max, u32_rgb_max);
-
-    const uint32_t u32_hsv_ooo_val_x256 = u32_rgb_max << 8; // get max in 8..15 bits
-
-    const uint32_t u32_rgb_min2 = _minu4(_rgb888, _rgb888 >> 8);
-    const uint32_t u32_rgb_min = _minu4(u32_rgb_min2, u32_rgb_min2 >> 8); // top 3 bytes are zeroes
-    const uint32_t u32_rgb_delta = u32_rgb_max - u32_rgb_min;
-
-    /* optimized by table based multiplication with power-2 divisor, simulate 255*(max-min)/max */
-    const uint32_t u32_hsv_sat_x256 = s_mult255_div[u32_rgb_max] * u32_rgb_delta;
-
-    /* optimized by table based multiplication with power-2 divisor, simulate 43*(med-min)/(max-min) */
-    const uint32_t u32_hsv_hue_mult43_div = _pack2(s_mult43_div[u32_rgb_delta], s_mult43_div[u32_rgb_delta]);
-    int32_t s32_hsv_hue_x256;
-    const uint32_t u32_rgb_cmp = _cmpeq2(u32_rgb_max_max, u32_rgb_gb16);
-    if (u32_rgb_cmp == 0)
-      s32_hsv_hue_x256 = static_cast<int32_t>((0x10000 * 0) / 3) + static_cast<int32_t>(_dotpn2(u32_hsv_hue_mult43_div, _packhl2(u32_rgb_gb16, u32_rgb_gb16)));
-    else if (u32_rgb_cmp == 1)
-      s32_hsv_hue_x256 = static_cast<int32_t>((0x10000 * 2) / 3) + static_cast<int32_t>(_dotpn2(u32_hsv_hue_mult43_div, _packlh2(u32_rgb_or16, u32_rgb_gb16)));
-    else
-      s32_hsv_hue_x256 = static_cast<int32_t>((0x10000 * 1) / 3) + static_cast<int32_t>(_dotpn2(u32_hsv_hue_mult43_div, _pack2(u32_rgb_gb16, u32_rgb_or16)));
+  typedef void (MotionSensorCvAlgorithm::*GatherFuncPtr)(const ImageBuffer&, uint32_t);
+  GatherFuncPtr gatherStripY = nullptr;
+
+  // Collects luma of 8 source rows starting at _srcRow into s_motionStripY, block-major.
+  void gatherStripYuyv(const ImageBuffer& _inImage, uint32_t _srcRow) {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    const uint32_t blockLeft = m_blockLeft;
+    const uint32_t blockRight = m_blockRight;
+
+#pragma MUST_ITERATE(MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE)
+    for (uint32_t r = 0; r < MOTION_BLOCK_SIZE; ++r) {
+      const uint64_t* restrict srcYuyv = reinterpret_cast<const uint64_t*>(_inImage.m_ptr + (_srcRow + r) * srcLineLength) + blockLeft * 2;
+      uint64_t* restrict dstY = reinterpret_cast<uint64_t*>(s_motionStripY + blockLeft * MOTION_BLOCK_PIXELS + r * MOTION_BLOCK_SIZE);
+
+      assert((blockRight - blockLeft) % 4 == 0); // window is aligned to 32 columns
+#pragma MUST_ITERATE(4, , 4)
+      for (uint32_t b = blockLeft; b < blockRight; ++b) {
+        const uint64_t yuyv01 = *srcYuyv++;
+        const uint64_t yuyv23 = *srcYuyv++;
+        // YUYV keeps luma in the even bytes, _packl4 picks exactly those
+        *dstY = _itoll(_packl4(_hill(yuyv23), _loll(yuyv23)), _packl4(_hill(yuyv01), _loll(yuyv01)));
+        dstY += MOTION_BLOCK_PIXELS / sizeof(uint64_t);
+      }
+    }
+  }
 
-    const uint32_t u32_hsv_hue_x256 = static_cast<uint32_t>(s32_hsv_hue_x256);
-    const uint32_t u32_hsv_sat_hue_x256 = _pack2(u32_hsv_sat_x256, u32_hsv_hue_x256);
+  // Decimated variant for both formats, every m_decimation pixel and row is taken
+  void gatherStripDecimated(const ImageBuffer& _inImage, uint32_t _srcRow) {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    const uint32_t blockLeft = m_blockLeft;
+    const uint32_t blockRight = m_blockRight;
+    const uint32_t sampleStride = m_decimation * m_lumaPixelStride;
+
+#pragma MUST_ITERATE(MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE)
+    for (uint32_t r = 0; r < MOTION_BLOCK_SIZE; ++r) {
+      const uint8_t* restrict srcY = reinterpret_cast<const uint8_t*>(_inImage.m_ptr + (_srcRow + r * m_decimation) * srcLineLength)
+                                     + blockLeft * MOTION_BLOCK_SIZE * sampleStride;
+      uint8_t* restrict dstY = s_motionStripY + blockLeft * MOTION_BLOCK_PIXELS + r * MOTION_BLOCK_SIZE;
+
+#pragma MUST_ITERATE(1, , )
+      for (uint32_t b = blockLeft; b < blockRight; ++b) {
+#pragma MUST_ITERATE(MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE)
+        for (uint32_t c = 0; c < MOTION_BLOCK_SIZE; ++c) {
+          dstY[c] = *srcY;
+          srcY += sampleStride;
+        }
+        dstY += MOTION_BLOCK_PIXELS;
+      }
+    }
+  }
 
-    const uint32_t u32_hsv = _packh4(u32_hsv_ooo_val_x256, u32_hsv_sat_hue_x256);
-    const uint64_t u64_hsv_range = m_detectRange;
-    const uint32_t u32_hsv_det = _cmpltu4(u32_hsv, _hill(u64_hsv_range)) | _cmpgtu4(u32_hsv, _loll(u64_hsv_range));
+  void gatherStripNV16(const ImageBuffer& _inImage, uint32_t _srcRow) {
+    const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
+    const uint32_t blockLeft = m_blockLeft;
+    const uint32_t blockRight = m_blockRight;
+
+#pragma MUST_ITERATE(MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE)
+    for (uint32_t r = 0; r < MOTION_BLOCK_SIZE; ++r) {
+      const uint64_t* restrict srcY = reinterpret_cast<const uint64_t*>(_inImage.m_ptr + (_srcRow + r) * srcLineLength) + blockLeft;
+      uint64_t* restrict dstY = reinterpret_cast<uint64_t*>(s_motionStripY + blockLeft * MOTION_BLOCK_PIXELS + r * MOTION_BLOCK_SIZE);
+
+      assert((blockRight - blockLeft) % 4 == 0); // window is aligned to 32 columns
+#pragma MUST_ITERATE(4, , 4)
+      for (uint32_t b = blockLeft; b < blockRight; ++b) {
+        *dstY = *srcY++;
+        dstY += MOTION_BLOCK_PIXELS / sizeof(uint64_t);
+      }
+    }
+  }
 
-    // SCORE cf5dee: 2.541, 2.485, 2.526, 2.471, 2.514
-    if (u32_hsv_det != m_detectExpected)
-      return false;
+  // Compares the gathered strip against the reference, fills its row of the motion bitmap and
+  // replaces the reference blocks with the current ones.
+  void proceedStrip(uint32_t _blockRow) {
+    const uint32_t blocksW = m_blocksW;
+    const uint32_t blockLeft = m_blockLeft;
+    const uint32_t blockRight = m_blockRight;
+    const uint32_t threshold = m_blockDiffThreshold * MOTION_BLOCK_PIXELS;
+    const bool refValid = m_refValid;
+
+    uint64_t* restrict refY = reinterpret_cast<uint64_t*>(s_motionRefY + (_blockRow * blocksW + blockLeft) * MOTION_BLOCK_PIXELS);
+    const uint64_t* restrict curY = reinterpret_cast<const uint64_t*>(s_motionStripY + blockLeft * MOTION_BLOCK_PIXELS);
+    uint8_t* restrict bitmap = s_motionBitmap + _blockRow * blocksW + blockLeft;
+
+    uint32_t rowPoints = 0;
+    uint32_t rowCols = 0;
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t b = blockLeft; b < blockRight; ++b) {
+      const uint32_t sad = refValid ? IMG_sad_8x8(reinterpret_cast<const unsigned char*>(curY), reinterpret_cast<const unsigned char*>(refY), MOTION_BLOCK_SIZE) : 0;
+      const bool det = sad > threshold;
+      *bitmap++ = det;
+      rowPoints += det;
+      rowCols += det ? b : 0;
+
+#pragma MUST_ITERATE(MOTION_BLOCK_PIXELS / 8, MOTION_BLOCK_PIXELS / 8, MOTION_BLOCK_PIXELS / 8)
+      for (uint32_t i = 0; i < MOTION_BLOCK_PIXELS / sizeof(uint64_t); ++i)
+        *refY++ = *curY++;
+    }
 
-    _out_rgb888 = 0xffff00;
-    return true;
+    m_targetX += rowCols;
+    m_targetY += rowPoints * _blockRow;
+    m_targetPoints += rowPoints;
   }
 
-  void proceedRgbPixel(const uint32_t _srcRow, const uint32_t _srcCol, uint16_t* restrict _dstImagePix, const uint32_t _rgb888) {
-    uint32_t out_rgb888 = _rgb888;
-    if (testifyRgbPixel(_rgb888, out_rgb888)) {
-      m_targetX += _srcCol;
-      m_targetY += _srcRow;
-      ++m_targetPoints;
+  // Preview pixels of a strip row: luma of its blocks, moving blocks in the overlay colour
+  struct StripPixel {
+    const uint8_t* m_stripY;
+    const uint8_t* m_bitmap;
+    // block span and decimation are powers of 2
+    uint32_t m_blockShift;
+    uint32_t m_decimationShift;
+
+    uint32_t operator()(const uint32_t _srcCol) const {
+      const uint32_t block = _srcCol >> m_blockShift;
+      if (m_bitmap[block])
+        return 0xffff00;
+      const uint32_t y = m_stripY[block * MOTION_BLOCK_PIXELS + ((_srcCol & ((1u << m_blockShift) - 1)) >> m_decimationShift)];
+      return (y << 16) | (y << 8) | y;
+    }
+  };
+
+  void drawStrip(uint32_t _blockRow, ImageBuffer& _outImage) {
+    const uint32_t blockSpan = m_blockSpan;
+    const uint32_t decimation = m_decimation;
+    const uint32_t srcRowTop = (_blockRow + 1) * blockSpan;
+
+#pragma MUST_ITERATE(MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE, MOTION_BLOCK_SIZE)
+    for (uint32_t r = 0; r < MOTION_BLOCK_SIZE; ++r) {
+      const uint32_t srcRow = _blockRow * blockSpan + r * decimation;
+      if (!isOutputSourceRow(srcRow, decimation, srcRowTop))
+        continue;
+      const StripPixel pixel = { s_motionStripY + r * MOTION_BLOCK_SIZE, s_motionBitmap + _blockRow * m_blocksW, 31 - _lmbd(1, blockSpan),
+        31 - _lmbd(1, decimation) };
+      writeOutputRow(_outImage, srcRow, m_blockLeft * blockSpan, m_blockRight * blockSpan, pixel);
     }
-
-    writeOutputPixel(_dstImagePix, out_rgb888);
   }
 
-  void proceedTwoYuyvPixels(const uint32_t _srcRow, const uint32_t _srcCol1, const uint32_t _srcCol2, uint16_t* restrict _dstImagePix1,
-    uint16_t* restrict _dstImagePix2, const uint32_t _yuyv) {
-    const int64_t s64_yuyv1 = _mpyu4ll(_yuyv,
-      (static_cast<uint32_t>(static_cast<uint8_t>(409 / 4)) << 24) | (static_cast<uint32_t>(static_cast<uint8_t>(298 / 4)) << 16) |
-        (static_cast<uint32_t>(static_cast<uint8_t>(516 / 4)) << 8) | (static_cast<uint32_t>(static_cast<uint8_t>(298 / 4))));
-    const uint32_t u32_yuyv2 =
-      _dotpus4(_yuyv, (static_cast<uint32_t>(static_cast<uint8_t>(-208 / 4)) << 24) | (static_cast<uint32_t>(static_cast<uint8_t>(-100 / 4)) << 8));
-    const uint32_t u32_rgb_h = _add2(_packh2(0, _hill(s64_yuyv1)), (static_cast<uint32_t>(static_cast<uint16_t>(128 / 4 + (-128 * 409 - 16 * 298) / 4))));
-    const uint32_t u32_rgb_l = _add2(_packlh2(u32_yuyv2, _loll(s64_yuyv1)),
-      (static_cast<uint32_t>(static_cast<uint16_t>(128 / 4 + (+128 * 100 + 128 * 208 - 16 * 298) / 4) << 16)) |
-        (static_cast<uint32_t>(static_cast<uint16_t>(128 / 4 + (-128 * 516 - 16 * 298) / 4))));
-    const uint32_t u32_y1y1 = _pack2(_loll(s64_yuyv1), _loll(s64_yuyv1));
-    const uint32_t u32_y2y2 = _pack2(_hill(s64_yuyv1), _hill(s64_yuyv1));
-    const uint32_t u32_rgb_p1h = _clr(_shr2(_add2(u32_rgb_h, u32_y1y1), 6), 16, 31);
-    const uint32_t u32_rgb_p1l = _shr2(_add2(u32_rgb_l, u32_y1y1), 6);
-    const uint32_t u32_rgb_p2h = _clr(_shr2(_add2(u32_rgb_h, u32_y2y2), 6), 16, 31);
-    const uint32_t u32_rgb_p2l = _shr2(_add2(u32_rgb_l, u32_y2y2), 6);
-    const uint32_t u32_rgb_p1 = _spacku4(u32_rgb_p1h, u32_rgb_p1l);
-    const uint32_t u32_rgb_p2 = _spacku4(u32_rgb_p2h, u32_rgb_p2l);
-
-    proceedRgbPixel(_srcRow, _srcCol1, _dstImagePix1, u32_rgb_p1);
-
-    proceedRgbPixel(_srcRow, _srcCol2, _dstImagePix2, u32_rgb_p2);
+  // Block grid for current decimation and processing window; the last partial block row is dropped
+  void setupBlocks() {
+    m_blockSpan = MOTION_BLOCK_SIZE * m_decimation;
+    m_blocksW = m_inImageDesc.m_width / m_blockSpan;
+    m_blocksH = m_inImageDesc.m_height / m_blockSpan;
+
+    if (m_decimation > 1)
+      gatherStripY = &MotionSensorCvAlgorithm::gatherStripDecimated;
+    else if (m_lumaPixelStride == 2)
+      gatherStripY = &MotionSensorCvAlgorithm::gatherStripYuyv;
+    else
+      gatherStripY = &MotionSensorCvAlgorithm::gatherStripNV16;
+
+    m_blockLeft = m_roiLeft / m_blockSpan;
+    m_blockRight = m_roiRight / m_blockSpan;
+    m_blockTop = m_roiTop / m_blockSpan;
+    m_blockBottom = (m_roiBottom + m_blockSpan - 1) / m_blockSpan;
+    if (m_blockBottom > m_blocksH)
+      m_blockBottom = m_blocksH;
   }
 
 public:
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
-    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize))
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
+    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize, _arena))
       return false;
+
+    if (m_inImageDesc.m_height % MOTION_BLOCK_SIZE != 0)
+      return false;
+
+    const uint32_t width = m_inImageDesc.m_width;
+    const uint32_t height = m_inImageDesc.m_height;
+    s_motionRefY = _arena.alloc<uint8_t>(width * height);
+    s_motionStripY = _arena.alloc<uint8_t>(width * MOTION_BLOCK_SIZE);
+    s_motionBitmap = _arena.alloc<uint8_t>((width / MOTION_BLOCK_SIZE) * (height / MOTION_BLOCK_SIZE));
+    if (s_motionRefY == NULL || s_motionStripY == NULL || s_motionBitmap == NULL)
+      return false;
+
+    if (_inImageDesc.m_format == VideoFormat::YUV422) {
+      m_lumaPixelStride = 2;
+    } else if (_inImageDesc.m_format == VideoFormat::NV16) {
+      m_lumaPixelStride = 1;
+    } else {
+      return false;
+    }
+
+    setupBlocks();
+    m_refValid = false; // first frame only primes the reference
+
     return true;
   }
 
+  // reference is from the last frame the sensor ran on
+  virtual void restart() { m_refValid = false; }
+
   virtual bool run(const ImageBuffer& _inImage, ImageBuffer& _outImage, const trik_cv_algorithm_in_args& _inArgs, trik_cv_algorithm_out_args& _outArgs) {
     if (m_inImageDesc.m_height * m_inImageDesc.m_lineLength > _inImage.m_size)
       return false;
@@ -132,21 +268,12 @@ public:
     m_targetX = 0;
     m_targetY = 0;
     m_targetPoints = 0;
+    const bool preview = _inArgs.video_out;
 
-    uint32_t detectHueFrom = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_hue_from) * 255) / 359, 255); // scaling 0..359 to 0..255
-    uint32_t detectHueTo = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_hue_to) * 255) / 359, 255);     // scaling 0..359 to 0..255
-    uint32_t detectSatFrom = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_sat_from) * 255) / 100, 255); // scaling 0..100 to 0..255
-    uint32_t detectSatTo = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_sat_to) * 255) / 100, 255);     // scaling 0..100 to 0..255
-    uint32_t detectValFrom = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_val_from) * 255) / 100, 255); // scaling 0..100 to 0..255
-    uint32_t detectValTo = range<int32_t>(0, (static_cast<int32_t>(_inArgs.detect_val_to) * 255) / 100, 255);     // scaling 0..100 to 0..255
-
-    if (detectHueFrom <= detectHueTo) {
-      m_detectRange = _itoll((detectValFrom << 16) | (detectSatFrom << 8) | detectHueFrom, (detectValTo << 16) | (detectSatTo << 8) | detectHueTo);
-      m_detectExpected = 0x0;
-    } else {
-      assert(detectHueFrom > 0 && detectHueTo < 255);
-      m_detectRange = _itoll((detectValFrom << 16) | (detectSatFrom << 8) | (detectHueTo + 1), (detectValTo << 16) | (detectSatTo << 8) | (detectHueFrom - 1));
-      m_detectExpected = 0x1;
+    // blocks entering the window have no valid reference, and the block grid follows decimation
+    if (setupRoi(_inArgs, false)) {
+      m_refValid = false;
+      setupBlocks();
     }
 
 #ifdef DEBUG_REPEAT
@@ -154,45 +281,32 @@ public:
 #endif
 
       if (m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0) {
-        const uint32_t srcToDstShift = m_srcToDstShift;
-        const uint32_t width = m_inImageDesc.m_width;
-        const uint32_t height = m_inImageDesc.m_height;
-        const uint32_t srcLineLength = m_inImageDesc.m_lineLength;
-        const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
-
-        assert(m_inImageDesc.m_height % 4 == 0); // verified in setup
-        for (uint32_t srcRow = 0; srcRow < height; ++srcRow) {
-          const uint32_t dstRow = srcRow >> m_srcToDstShift;
-
-          const uint32_t srcRowOfs = srcRow * srcLineLength;
-          const uint32_t* restrict srcImage = reinterpret_cast<uint32_t*>(_inImage.m_ptr + srcRowOfs);
-
-          const uint32_t dstRowOfs = dstRow * dstLineLength;
-          uint16_t* restrict dstImageRow = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstRowOfs);
-
-          assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
-          for (uint32_t srcCol = 0; srcCol < width; srcCol += 2) {
-            const uint32_t dstCol1 = (srcCol + 0) >> srcToDstShift;
-            const uint32_t dstCol2 = (srcCol + 1) >> srcToDstShift;
-            uint16_t* restrict dstImagePix1 = &dstImageRow[dstCol1]; // even if they point the same place, we don't really care
-            uint16_t* restrict dstImagePix2 = &dstImageRow[dstCol2];
-            proceedTwoYuyvPixels(srcRow, srcCol + 0, srcCol + 1, dstImagePix1, dstImagePix2, *srcImage++);
-          }
+        if (preview)
+          clearOutputOutsideRoi(_outImage);
+        for (uint32_t blockRow = m_blockTop; blockRow < m_blockBottom; ++blockRow) {
+          (this->*gatherStripY)(_inImage, blockRow * m_blockSpan);
+          proceedStrip(blockRow);
+          if (preview)
+            drawStrip(blockRow, _outImage);
         }
+        if (preview)
+          markOutputSourceRows(m_blockTop * m_blockSpan, m_blockBottom * m_blockSpan);
+        m_refValid = true;
       }
 
 #ifdef DEBUG_REPEAT
     } // repeat
 #endif
 
-    if (m_targetPoints > 0) {
-      const int32_t targetX = m_targetX / m_targetPoints;
-      const int32_t targetY = m_targetY / m_targetPoints;
+    if (m_targetPoints >= m_minMotionBlocks) {
+      const int32_t targetX = (m_targetX * m_blockSpan) / m_targetPoints + m_blockSpan / 2;
+      const int32_t targetY = (m_targetY * m_blockSpan) / m_targetPoints + m_blockSpan / 2;
 
       assert(m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0); // more or less safe since no target points would be detected otherwise
-      const uint32_t targetRadius = std::ceil(std::sqrt(static_cast<float>(m_targetPoints) / 3.1415927f));
+      const uint32_t targetRadius = std::ceil(std::sqrt(static_cast<float>(m_targetPoints * m_blockSpan * m_blockSpan) / 3.1415927f));
 
-      drawOutputCircle(targetX, targetY, targetRadius, _outImage, 0xffff00);
+      if (preview)
+        drawOutputCircle(targetX, targetY, targetRadius, _outImage, 0xff0000);
 
       _outArgs.targets[0].out_target.targetLocation.x = ((targetX - static_cast<int32_t>(m_inImageDesc.m_width) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_width);
       _outArgs.targets[0].out_target.targetLocation.y = ((targetY - static_cast<int32_t>(m_inImageDesc.m_height) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_height);
@@ -203,8 +317,6 @@ public:
       _outArgs.targets[0].out_target.targetLocation.size = 0;
     }
 
-    Cache_wbInv(_outImage.m_ptr, _outImage.m_size, Cache_Type_ALL, TRUE);
-
     return true;
   }
 };
@@ -30,7 +30,7 @@ const int m_hueClsters = 256 / m_hueScale; // partition of axis h in 64 parts
 const int m_satClsters = 256 / m_satScale; // s in 4 parts
 const int m_valClsters = 256 / m_valScale; // v in 4 parts
 
-static int c_color[m_hueClsters][m_satClsters][m_valClsters]; // massiv of clusters 32x8x8
+static int (*c_color)[m_satClsters][m_valClsters] = NULL; // massiv of clusters 32x8x8, carved from the arena in setup
 
 class MxnSensorCvAlgorithm : public CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X> {
 private:
@@ -45,7 +45,7 @@ private:
   void clasterizePixel(const uint32_t _hsv) {}
 
   void clasterizeImage() {
-    const uint64_t* restrict rgb888hsvptr = s_rgb888hsv;
+    const uint32_t* restrict hsvptr = s_hsvFrame;
     const uint32_t width = m_inImageDesc.m_width;
     const uint32_t height = m_inImageDesc.m_height;
 
@@ -59,51 +59,31 @@ private:
       assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
 #pragma MUST_ITERATE(32, , 32)
       for (uint32_t srcCol = 0; srcCol < width; ++srcCol) {
-        const uint64_t rgb888hsv = *rgb888hsvptr++;
-        clasterizePixel(rgb888hsv);
-        const bool det = detectHsvPixel(_loll(rgb888hsv), u64_hsv_range, u32_hsv_expect);
+        const uint32_t hsv = *hsvptr++;
+        clasterizePixel(hsv);
+        const bool det = detectHsvPixel(hsv, u64_hsv_range, u32_hsv_expect);
       }
     }
   }
 
-  void proceedImageHsv(ImageBuffer& _outImage) {
-    const uint64_t* restrict rgb888hsvptr = s_rgb888hsv;
-    const uint32_t width = m_inImageDesc.m_width;
-    const uint32_t height = m_inImageDesc.m_height;
-    const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
+  void proceedImageHsv(const ImageBuffer& _inImage, ImageBuffer& _outImage) {
+    const uint32_t step = m_decimation;
 
-    const uint32_t* restrict p_hi2ho = s_hi2ho;
-    assert(m_inImageDesc.m_height % 4 == 0); // verified in setup
-#pragma MUST_ITERATE(4, , 4)
-    for (uint32_t srcRow = 0; srcRow < height; ++srcRow) {
-      const uint32_t dstRow = *(p_hi2ho++);
-      uint16_t* restrict dstImageRow = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstRow * dstLineLength);
-
-      const uint32_t* restrict p_wi2wo = s_wi2wo;
-      assert(m_inImageDesc.m_width % 32 == 0); // verified in setup
-#pragma MUST_ITERATE(32, , 32)
-      for (uint32_t srcCol = 0; srcCol < width; ++srcCol) {
-        const uint32_t dstCol = *(p_wi2wo++);
-        const uint64_t rgb888hsv = *rgb888hsvptr++;
-        writeOutputPixel(dstImageRow + dstCol, _hill(rgb888hsv));
-      }
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t srcRow = m_roiTop; srcRow < m_roiBottom; srcRow += step) {
+      if (!isOutputSourceRow(srcRow, step, m_roiBottom))
+        continue;
+      writeInputRow(_outImage, _inImage, srcRow, m_roiLeft, m_roiRight);
     }
   }
 
   void __attribute__((always_inline)) fillImage(uint16_t _row, uint16_t _col, const ImageBuffer& _outImage, const uint32_t _rgb888) {
-    const uint16_t widthBot = 0;
-    const uint16_t widthTop = m_inImageDesc.m_width - 1;
-    const uint16_t heightBot = 0;
-    const uint16_t heightTop = m_inImageDesc.m_height - 1;
-
-    for (int row = _row; row < _row + 20; ++row)
-      for (int col = _col; col < _col + 20; ++col)
-        drawOutputPixelBound(col, row, widthBot, widthTop, heightBot, heightTop, _outImage, _rgb888);
+    fillOutputRect(_col, _row, _col + 19, _row + 19, _outImage, _rgb888);
   }
 
   uint32_t __attribute__((always_inline)) GetImgColor(int _rowStart, int _heightStep, int _colStart, int _widthStep) {
     uint32_t rgbResult = 0;
-    const uint64_t* restrict img = s_rgb888hsv;
+    const uint32_t* restrict img = s_hsvFrame;
 
     int ch, cs, cv;
     memset(c_color, 0, sizeof(int) * m_hueClsters * m_satClsters * m_valClsters);
@@ -114,7 +94,7 @@ private:
     U_Hsv8x3 pixel;
     for (int row = _rowStart; row < _rowStart + _heightStep; row++) {
       for (int column = _colStart; column < _colStart + _widthStep; column++) {
-        pixel.whole = _loll(img[row * m_inImageDesc.m_width + column]);
+        pixel.whole = img[row * m_inImageDesc.m_width + column];
 
         ch = pixel.parts.h / m_hueScale;
         cs = pixel.parts.s / m_satScale;
@@ -141,7 +121,7 @@ private:
 
   uint32_t __attribute__((always_inline)) GetImgColor2(uint32_t _row, uint32_t _col, uint32_t _height, uint32_t _width) {
     const uint32_t width = m_inImageDesc.m_width;
-    const uint32_t gap = width - _width;
+    const uint32_t step = m_decimation;
     int ch, cs, cv;
     int ch_max = 0;
     int cs_max = 0;
@@ -151,11 +131,14 @@ private:
 
     memset(c_color, 0, sizeof(int) * m_hueClsters * m_satClsters * m_valClsters);
 
-    uint64_t* restrict subImg = s_rgb888hsv + _row * width + _col;
+    // only converted pixels are looked at, cell origin is aligned to the decimation step
+    const uint32_t rowBot = ((_row + step - 1) / step) * step;
+    const uint32_t colBot = ((_col + step - 1) / step) * step;
 
-    for (int row = 0; row < _height; row++) {
-      for (int col = 0; col < _width; col++) {
-        uint32_t pixel = _loll(*(subImg++));
+    for (uint32_t row = rowBot; row < _row + _height; row += step) {
+      const uint32_t* restrict subImg = s_hsvFrame + row * width;
+      for (uint32_t col = colBot; col < _col + _width; col += step) {
+        uint32_t pixel = subImg[col];
 
         ch = static_cast<uint8_t>(pixel) / m_hueScale;
         cs = static_cast<uint8_t>(pixel >> 8) / m_satScale;
@@ -169,7 +152,6 @@ private:
           cv_max = cv;
         }
       }
-      subImg += gap;
     }
 
     // return h, s and v as h_max, s_max and _max with values
@@ -269,8 +251,13 @@ private:
 #define min(x, y) x < y ? x : y;
 
 public:
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
-    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize))
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
+    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize, _arena))
+      return false;
+    if (!setupHsvFrame(_arena))
+      return false;
+    c_color = _arena.alloc<int[m_satClsters][m_valClsters]>(m_hueClsters);
+    if (c_color == NULL)
       return false;
     return true;
   }
@@ -282,18 +269,25 @@ public:
       return false;
     _outImage.m_size = m_outImageDesc.m_height * m_outImageDesc.m_lineLength;
 
+    const bool preview = _inArgs.video_out;
     m_heightM = _inArgs.extra_inArgs.mxnParams.m_m;
     m_widthN = _inArgs.extra_inArgs.mxnParams.m_n;
-    m_widthStep = m_inImageDesc.m_width / m_widthN;
-    m_heightStep = m_inImageDesc.m_height / m_heightM;
+    // grid covers the processing window, colors are taken over whole cells
+    setupRoi(_inArgs, false);
+    m_widthStep = (m_roiRight - m_roiLeft) / m_widthN;
+    m_heightStep = (m_roiBottom - m_roiTop) / m_heightM;
 
 #ifdef DEBUG_REPEAT
     for (unsigned repeat = 0; repeat < DEBUG_REPEAT; ++repeat) {
 #endif
 
       if (m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0) {
-        (this->*convertImageFormatToHSV)(_inImage);
-        proceedImageHsv(_outImage);
+        convertFrameToHsv(_inImage);
+        if (preview) {
+          clearOutputOutsideRoi(_outImage);
+          proceedImageHsv(_inImage, _outImage);
+          markOutputSourceRows(m_roiTop, m_roiBottom);
+        }
       }
 
 #ifdef DEBUG_REPEAT
@@ -304,20 +298,19 @@ public:
     int colorClaster = 0;
 
     int counter = 0;
-    int rowStart = 0;
+    int rowStart = m_roiTop;
     for (int i = 0; i < m_heightM; ++i) {
-      int colStart = 0;
+      int colStart = m_roiLeft;
       for (int j = 0; j < m_widthN; ++j) {
         resColor = GetImgColor2(rowStart, colStart, m_heightStep, m_widthStep);
-        fillImage(rowStart, colStart, _outImage, resColor);
+        if (preview)
+          fillImage(rowStart, colStart, _outImage, resColor);
         _outArgs.targets[0].out_target.targetColors.m_colors[counter++] = resColor;
         colStart += m_widthStep;
       }
       rowStart += m_heightStep;
     }
 
-    Cache_wbInv(_outImage.m_ptr, _outImage.m_size, Cache_Type_ALL, TRUE);
-
     return true;
   }
 };
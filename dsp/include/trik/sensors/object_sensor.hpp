@@ -24,6 +24,7 @@
 #include <map>
 
 #include "bitmap_builder.hpp"
+#include "bitmap_morphology.hpp"
 #include "clusterizer.hpp"
 #include "hsv_range_detector_object.hpp"
 #include <trik/sensors/video_format.h>
@@ -31,15 +32,15 @@
 namespace trik {
 namespace sensors {
 
-static uint16_t s_bitmap[IMG_WIDTH * IMG_HEIGHT];
-static uint16_t s_clustermap[IMG_WIDTH * IMG_HEIGHT];
+// metapixel maps and coordinate tables, carved from the arena in setup
+static uint16_t* restrict s_bitmap = NULL;
+static uint16_t* restrict s_clustermap = NULL;
 
-static int32_t s_wi2wo_out[IMG_WIDTH];
-static int32_t s_hi2ho_out[IMG_HEIGHT];
-static int32_t s_wi2wo_cstr[IMG_WIDTH];
-static int32_t s_hi2ho_cstr[IMG_HEIGHT];
-
-#define OBJECTS 8
+static int32_t* restrict s_wi2wo_out = NULL;
+static int32_t* restrict s_hi2ho_out = NULL;
+// first output column and row of every metapixel column and row, and the end of the last one
+static int32_t* restrict s_mw2wo_out = NULL;
+static int32_t* restrict s_mh2ho_out = NULL;
 
 class ObjectSensorCvAlgorithm : public CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X> {
 private:
@@ -56,58 +57,155 @@ private:
   ImageDesc m_bitmapDesc;
   BitmapBuilderCvAlgorithm m_bitmapBuilder;
   ImageBuffer m_bitmap;
+  BitmapMorphologyCvAlgorithm m_bitmapMorphology;
 
   ImageDesc m_clustermapDesc;
   ClusterizerCvAlgorithm m_clusterizer;
   ImageBuffer m_clustermap;
 
-  ImageDesc m_inRgb888HsvImgDesc;
-  ImageBuffer m_inRgb888HsvImg;
+  ImageDesc m_inHsvImgDesc;
+  ImageBuffer m_inHsvImg;
 
-  void proceedImageHsv(ImageBuffer& _outImage) {
-    const uint64_t* restrict rgb888hsvptr = s_rgb888hsv;
+  // frame was classified by the YUV table rather than converted to HSV
+  bool m_classified;
 
-    const uint32_t width = m_inImageDesc.m_width;
-    const uint32_t height = m_inImageDesc.m_height;
+  // Detected metapixel is one colour over all of its output pixels, packed 4 at a time where they are aligned
+  void fillOutputMetapixel(ImageBuffer& _outImage, const uint32_t _cstrRow, const uint32_t _cstrCol, const uint32_t _rgb565) {
     const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
+    const uint32_t dstColBegin = s_mw2wo_out[_cstrCol];
+    const uint32_t dstColEnd = s_mw2wo_out[_cstrCol + 1];
+    const bool packed = dstColEnd - dstColBegin == 4 && dstColBegin % 4 == 0 && dstLineLength % 8 == 0;
+    const uint32_t rgb565x2 = _rgb565 | (_rgb565 << 16);
+    const uint64_t rgb565x4 = _itoll(rgb565x2, rgb565x2);
+
+    for (uint32_t dstRow = s_mh2ho_out[_cstrRow]; dstRow < s_mh2ho_out[_cstrRow + 1]; ++dstRow) {
+      uint16_t* restrict dstPtr = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstRow * dstLineLength) + dstColBegin;
+      if (packed) {
+        *reinterpret_cast<uint64_t*>(dstPtr) = rgb565x4;
+      } else {
+        for (uint32_t dstCol = dstColBegin; dstCol < dstColEnd; ++dstCol)
+          *dstPtr++ = _rgb565;
+      }
+    }
+  }
+
+  /*
+    Preview is rendered a metapixel at a time: its cluster label is read once, detected ones are
+    filled with the overlay colour, pixels of the rest are shown as they are.
+    Every cluster has the same colour, so a label only needs to be non-zero.
+  */
+  void proceedImageHsv(const ImageBuffer& _inImage, ImageBuffer& _outImage) {
+    const uint32_t dstLineLength = m_outImageDesc.m_lineLength;
+    const uint32_t step = m_decimation;
+
+    uint16_t overlay;
+    writeOutputPixel(&overlay, 0x00ffff);
+
+#pragma MUST_ITERATE(1, , )
+    for (uint32_t cstrRow = m_roiTop / METAPIX_SIZE; cstrRow < m_roiBottom / METAPIX_SIZE; ++cstrRow) {
+      const uint16_t* restrict clustermapRow = s_clustermap + cstrRow * m_clustermapDesc.m_width;
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t cstrCol = m_roiLeft / METAPIX_SIZE; cstrCol < m_roiRight / METAPIX_SIZE; ++cstrCol) {
+        if (clustermapRow[cstrCol] != 0) {
+          fillOutputMetapixel(_outImage, cstrRow, cstrCol, overlay);
+          continue;
+        }
 
-    const int32_t* restrict p_hi2ho_out = s_hi2ho_out;
-    const int32_t* restrict p_hi2ho_cstr = s_hi2ho_cstr;
-    assert(m_outImageDesc.m_height % 4 == 0); // verified in setup
-#pragma MUST_ITERATE(4, , 4)
-    for (uint32_t srcRow = 0; srcRow < height; srcRow++) {
-      const uint32_t dstRow = *(p_hi2ho_out++);
-      const uint32_t cstrRow = *(p_hi2ho_cstr++);
-
-      uint16_t* restrict dstImageRow = reinterpret_cast<uint16_t*>(_outImage.m_ptr + dstRow * dstLineLength);
-      uint16_t* restrict clustermapRow = reinterpret_cast<uint16_t*>(s_clustermap + cstrRow * m_clustermapDesc.m_width);
-
-      const int32_t* restrict p_wi2wo_out = s_wi2wo_out;
-      const int32_t* restrict p_wi2wo_cstr = s_wi2wo_cstr;
-#pragma MUST_ITERATE(32, , 32)
-      for (uint32_t srcCol = 0; srcCol < width; srcCol++) {
-        const uint32_t dstCol = *(p_wi2wo_out++);
-        const uint32_t cstrCol = *(p_wi2wo_cstr++);
-        const uint64_t rgb888hsv = *rgb888hsvptr++;
-
-        uint16_t clusterNum = m_clusterizer.getMinEqCluster(*(clustermapRow + cstrCol));
-        const bool det = clusterNum;
-
-        writeOutputPixel(dstImageRow + dstCol, det ? 0x00ffff : _hill(rgb888hsv));
+        for (uint32_t srcRow = cstrRow * METAPIX_SIZE; srcRow < (cstrRow + 1) * METAPIX_SIZE; srcRow += step) {
+          uint16_t* restrict dstImageRow = reinterpret_cast<uint16_t*>(_outImage.m_ptr + s_hi2ho_out[srcRow] * dstLineLength);
+          for (uint32_t srcCol = cstrCol * METAPIX_SIZE; srcCol < (cstrCol + 1) * METAPIX_SIZE; srcCol += step)
+            writeOutputPixel(dstImageRow + s_wi2wo_out[srcCol], readInputRgb888(_inImage, srcRow, srcCol));
+        }
       }
     }
   }
 
+  // target size in percent, from its area in metapixels
+  int32_t targetSize(const uint32_t _metapixels) const {
+    uint32_t size = 0; // integer square root
+    for (uint32_t bit = 1u << 15; bit != 0; bit >>= 1)
+      if ((size + bit) * (size + bit) <= _metapixels)
+        size += bit;
+    const uint32_t targetRadius = (size * 113 + 354) / 355; // ceil(size / pi)
+    return (targetRadius * 100 * 4) / static_cast<uint32_t>(m_bitmapDesc.m_width + m_bitmapDesc.m_height);
+  }
+
+  // coordinate of the frame in [-100..100]
+  int16_t targetCoordinate(const int32_t _pos, const int32_t _length) const { return ((_pos - _length / 2) * 100 * 2) / _length; }
+
+  /*
+    Orientation and elongation of a target from its central second order moments, as of an ellipse
+    with the same ones: major axis is at 1/2 atan2(2 mu11, mu20 - mu02) and squared axes ratio is
+    that of the covariance eigenvalues. Orientation is given as the angle of a line is.
+  */
+  void targetShape(const int _target, int16_t& _orientation, uint16_t& _elongation) {
+    int64_t mu20;
+    int64_t mu02;
+    int64_t mu11;
+    m_clusterizer.getMoments(_target, mu20, mu02, mu11);
+
+    const float diff = static_cast<float>(mu20 - mu02);
+    const float cross = static_cast<float>(2 * mu11);
+    int32_t angle = static_cast<int32_t>(std::floor(std::atan2(cross, diff) * (90.0f / 3.1415927f) + 0.5f)) + 90;
+    _orientation = angle >= 90 ? angle - 180 : angle;
+
+    const float sum = static_cast<float>(mu20 + mu02);
+    const float spread = std::sqrt(diff * diff + cross * cross);
+    const float minor = sum - spread;
+    const float elongation = minor > 0 ? std::sqrt((sum + spread) / minor) * 100.0f : 65535.0f;
+    _elongation = elongation < 65535.0f ? static_cast<uint16_t>(elongation + 0.5f) : 65535;
+  }
+
+  /*
+    Coarse-to-fine: a target found on decimated frame is measured again at full resolution inside
+    its bounding box grown by a metapixel, since rim of the object is in undetected metapixels.
+    Same colored pixels of another target inside the box are counted too.
+    Returns number of detected pixels, _x and _y are updated if there are any.
+  */
+  uint32_t refineTarget(const ImageBuffer& _inImage, const int _target, int32_t& _x, int32_t& _y) {
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+    m_clusterizer.getBox(_target, left, top, right, bottom);
+
+    // converter needs the window aligned like the ROI is, which keeps it inside of the ROI
+    left = (range<int32_t>(m_roiLeft, left - METAPIX_SIZE, m_roiRight) / 32) * 32;
+    right = ((range<int32_t>(m_roiLeft, right + METAPIX_SIZE, m_roiRight) + 31) / 32) * 32;
+    top = range<int32_t>(m_roiTop, top - METAPIX_SIZE, m_roiBottom);
+    bottom = range<int32_t>(m_roiTop, bottom + METAPIX_SIZE, m_roiBottom);
+
+    int32_t sumCol = 0;
+    int32_t sumRow = 0;
+    uint32_t points;
+    if (m_classified) {
+      classifyWindowFull(_inImage, left, top, right, bottom);
+      points = m_bitmapBuilder.detectWindowClasses(s_classFrame, 1u << YUV_CLASS_OBJECT, left, top, right, bottom, sumCol, sumRow);
+    } else {
+      convertWindowToHsvFull(_inImage, left, top, right, bottom);
+      points = m_bitmapBuilder.detectWindow(m_inHsvImg, left, top, right, bottom, sumCol, sumRow);
+    }
+    if (points > 0) {
+      _x = sumCol / static_cast<int32_t>(points);
+      _y = sumRow / static_cast<int32_t>(points);
+    }
+    return points;
+  }
+
 public:
-  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize) {
-    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize))
+  virtual bool setup(const ImageDesc& _inImageDesc, const ImageDesc& _outImageDesc, int8_t* _fastRam, size_t _fastRamSize, Arena& _arena) {
+    if (!commonSetup(_inImageDesc, _outImageDesc, _fastRam, _fastRamSize, _arena))
+      return false;
+    if (!setupHsvFrame(_arena) || !setupClassFrame(_arena))
       return false;
+    m_classified = false;
     m_minTargetSize = m_inImageDesc.m_width * m_inImageDesc.m_height / 100; // 1% of screen
 
-    m_inRgb888HsvImgDesc.m_width = m_inImageDesc.m_width;
-    m_inRgb888HsvImgDesc.m_height = m_inImageDesc.m_height;
-    m_inRgb888HsvImgDesc.m_lineLength = m_inImageDesc.m_width * sizeof(uint64_t);
-    m_inRgb888HsvImgDesc.m_format = VideoFormat::RGB888HSV;
+    m_inHsvImgDesc.m_width = m_inImageDesc.m_width;
+    m_inHsvImgDesc.m_height = m_inImageDesc.m_height;
+    m_inHsvImgDesc.m_lineLength = m_inImageDesc.m_width * sizeof(uint32_t);
+    m_inHsvImgDesc.m_format = VideoFormat::HSV888;
 
     m_bitmapDesc.m_width = m_inImageDesc.m_width / METAPIX_SIZE;
     m_bitmapDesc.m_height = m_inImageDesc.m_height / METAPIX_SIZE;
@@ -116,17 +214,30 @@ public:
 
     m_clustermapDesc = m_bitmapDesc; // i suppose
 
-    m_bitmapBuilder.setup(m_inRgb888HsvImgDesc, m_bitmapDesc, _fastRam, _fastRamSize);
-    m_clusterizer.setup(m_bitmapDesc, m_clustermapDesc, _fastRam, _fastRamSize);
+    if (!m_bitmapBuilder.setup(m_inHsvImgDesc, m_bitmapDesc, _fastRam, _fastRamSize, _arena))
+      return false;
+    if (!m_bitmapMorphology.setup(m_bitmapDesc, m_bitmapDesc, _fastRam, _fastRamSize, _arena))
+      return false;
+    m_clusterizer.setup(m_bitmapDesc, m_clustermapDesc, _fastRam, _fastRamSize, _arena);
+
+    const uint32_t metapixels = m_bitmapDesc.m_width * m_bitmapDesc.m_height;
+    s_bitmap = _arena.alloc<uint16_t>(metapixels);
+    s_clustermap = _arena.alloc<uint16_t>(metapixels);
+    s_wi2wo_out = _arena.alloc<int32_t>(m_inImageDesc.m_width);
+    s_hi2ho_out = _arena.alloc<int32_t>(m_inImageDesc.m_height);
+    s_mw2wo_out = _arena.alloc<int32_t>(m_bitmapDesc.m_width + 1);
+    s_mh2ho_out = _arena.alloc<int32_t>(m_bitmapDesc.m_height + 1);
+    if (s_bitmap == NULL || s_clustermap == NULL || s_wi2wo_out == NULL || s_hi2ho_out == NULL || s_mw2wo_out == NULL || s_mh2ho_out == NULL)
+      return false;
 
-    m_inRgb888HsvImg.m_ptr = reinterpret_cast<int8_t*>(s_rgb888hsv);
-    m_inRgb888HsvImg.m_size = IMG_WIDTH * IMG_HEIGHT * sizeof(uint64_t);
+    m_inHsvImg.m_ptr = reinterpret_cast<int8_t*>(s_hsvFrame);
+    m_inHsvImg.m_size = m_inImageDesc.m_width * m_inImageDesc.m_height * sizeof(uint32_t);
 
     m_bitmap.m_ptr = reinterpret_cast<int8_t*>(s_bitmap);
-    m_bitmap.m_size = IMG_WIDTH * IMG_HEIGHT * sizeof(uint16_t);
+    m_bitmap.m_size = metapixels * sizeof(uint16_t);
 
     m_clustermap.m_ptr = reinterpret_cast<int8_t*>(s_clustermap);
-    m_clustermap.m_size = IMG_WIDTH * IMG_HEIGHT * sizeof(uint16_t);
+    m_clustermap.m_size = metapixels * sizeof(uint16_t);
 
 #define min(x, y) x < y ? x : y;
     const double srcToDstShift =
@@ -137,20 +248,20 @@ public:
     int32_t* restrict p_wi2wo_out = s_wi2wo_out;
     for (int i = 0; i < widthIn; i++)
       *(p_wi2wo_out++) = i * srcToDstShift;
-    // width step for cluster map
-    int32_t* restrict p_wi2wo_cstr = s_wi2wo_cstr;
-    for (int i = 0; i < widthIn; i++)
-      *(p_wi2wo_cstr++) = i / METAPIX_SIZE;
+    // output columns of metapixels
+    for (int i = 0; i < m_bitmapDesc.m_width; i++)
+      s_mw2wo_out[i] = s_wi2wo_out[i * METAPIX_SIZE];
+    s_mw2wo_out[m_bitmapDesc.m_width] = s_wi2wo_out[widthIn - 1] + 1;
 
     const uint32_t heightIn = _inImageDesc.m_height;
     // height step for out image
     int32_t* restrict p_hi2ho_out = s_hi2ho_out;
     for (int32_t i = 0; i < heightIn; i++)
       *(p_hi2ho_out++) = i * srcToDstShift;
-    // height step for cluster map
-    int32_t* restrict p_hi2ho_cstr = s_hi2ho_cstr;
-    for (int32_t i = 0; i < heightIn; i++)
-      *(p_hi2ho_cstr++) = i / METAPIX_SIZE;
+    // output rows of metapixels
+    for (int32_t i = 0; i < m_bitmapDesc.m_height; i++)
+      s_mh2ho_out[i] = s_hi2ho_out[i * METAPIX_SIZE];
+    s_mh2ho_out[m_bitmapDesc.m_height] = s_hi2ho_out[heightIn - 1] + 1;
 
     return true;
   }
@@ -162,6 +273,11 @@ public:
       return false;
     _outImage.m_size = m_outImageDesc.m_height * m_outImageDesc.m_lineLength;
 
+    const bool preview = _inArgs.video_out;
+    // metapixels need all their rows, so row step is not used here
+    setupRoi(_inArgs, false);
+    m_bitmapBuilder.setWindow(m_roiLeft, m_roiTop, m_roiRight, m_roiBottom, m_decimation);
+
     memset(s_clustermap, 0x00, m_clustermapDesc.m_width * m_clustermapDesc.m_height * sizeof(uint16_t));
     memset(s_bitmap, 0x00, m_bitmapDesc.m_width * m_bitmapDesc.m_height * sizeof(uint16_t));
 
@@ -170,19 +286,31 @@ public:
 #endif
 
       if (m_inImageDesc.m_height > 0 && m_inImageDesc.m_width > 0) {
-        (this->*convertImageFormatToHSV)(_inImage);
+        if (preview)
+          clearOutputOutsideRoi(_outImage);
 
+        // range detection needs real HSV statistics, otherwise pixels are only classified
         bool autoDetectHsv = static_cast<bool>(_inArgs.auto_detect_hsv); // true or false
+        m_classified = !autoDetectHsv;
         if (autoDetectHsv) {
+          convertFrameToHsv(_inImage);
           HsvRangeDetectorObject rangeDetector = HsvRangeDetectorObject(m_inImageDesc.m_width, m_inImageDesc.m_height, m_detectZoneScale);
           rangeDetector.detect(_outArgs.detect_hue_from, _outArgs.detect_hue_to, _outArgs.detect_sat_from, _outArgs.detect_sat_to, _outArgs.detect_val_from,
-            _outArgs.detect_val_to, s_rgb888hsv);
+            _outArgs.detect_val_to, s_hsvFrame);
+          m_bitmapBuilder.run(m_inHsvImg, m_bitmap, _inArgs, _outArgs);
+        } else {
+          m_bitmapBuilder.setHsvRange(_inArgs);
+          setClassRange(YUV_CLASS_OBJECT, m_bitmapBuilder.detectRange(), m_bitmapBuilder.detectExpected());
+          classifyFrame(_inImage);
+          m_bitmapBuilder.runClasses(s_classFrame, 1u << YUV_CLASS_OBJECT, m_bitmap);
         }
-
-        m_bitmapBuilder.run(m_inRgb888HsvImg, m_bitmap, _inArgs, _outArgs);
+        m_bitmapMorphology.run(m_bitmap, m_bitmap, _inArgs, _outArgs);
         m_clusterizer.run(m_bitmap, m_clustermap, _inArgs, _outArgs);
 
-        proceedImageHsv(_outImage);
+        if (preview) {
+          proceedImageHsv(_inImage, _outImage);
+          markOutputSourceRows(m_roiTop, m_roiBottom);
+        }
       }
 
 #ifdef DEBUG_REPEAT
@@ -193,45 +321,62 @@ public:
     const int hHeight = m_inImageDesc.m_height / 2;
     const int hWidth = m_inImageDesc.m_width / 2;
 
-    drawRgbTargetCenterLine(hWidth - step, hHeight, _outImage, 0xff00ff);
-    drawRgbTargetCenterLine(hWidth + step, hHeight, _outImage, 0xff00ff);
-    drawRgbTargetCenterLine(hWidth - 2 * step, hHeight, _outImage, 0xff00ff);
-    drawRgbTargetCenterLine(hWidth + 2 * step, hHeight, _outImage, 0xff00ff);
+    if (preview) {
+      drawRgbTargetCenterLine(hWidth - step, hHeight, _outImage, 0xff00ff);
+      drawRgbTargetCenterLine(hWidth + step, hHeight, _outImage, 0xff00ff);
+      drawRgbTargetCenterLine(hWidth - 2 * step, hHeight, _outImage, 0xff00ff);
+      drawRgbTargetCenterLine(hWidth + 2 * step, hHeight, _outImage, 0xff00ff);
 
-    drawRgbTargetHorizontalCenterLine(hWidth, hHeight - step, _outImage, 0xff00ff);
-    drawRgbTargetHorizontalCenterLine(hWidth, hHeight + step, _outImage, 0xff00ff);
-    drawRgbTargetHorizontalCenterLine(hWidth, hHeight - 2 * step, _outImage, 0xff00ff);
-    drawRgbTargetHorizontalCenterLine(hWidth, hHeight + 2 * step, _outImage, 0xff00ff);
+      drawRgbTargetHorizontalCenterLine(hWidth, hHeight - step, _outImage, 0xff00ff);
+      drawRgbTargetHorizontalCenterLine(hWidth, hHeight + step, _outImage, 0xff00ff);
+      drawRgbTargetHorizontalCenterLine(hWidth, hHeight - 2 * step, _outImage, 0xff00ff);
+      drawRgbTargetHorizontalCenterLine(hWidth, hHeight + 2 * step, _outImage, 0xff00ff);
+    }
 
-    // memset(_outArgs.target, 0, 8*sizeof(XDAS_Target));
     m_clustersAmount = m_clusterizer.getClustersAmount();
-    bool noObjects = true;
-    for (int i = 0; i < OBJECTS; i++) // defined in stdcpp.hpp
-    {
-      int size = std::sqrt(static_cast<float>(m_clusterizer.getSize(i)));
-      const uint32_t targetRadius = std::ceil(size / 3.1415927f);
-      size = static_cast<uint32_t>(targetRadius * 100 * 4) / static_cast<uint32_t>(m_bitmapDesc.m_width + m_bitmapDesc.m_height);
-      if (size > 4) { // it's better to be about 0.5% of image
-        noObjects = false;
-        int x = m_clusterizer.getX(i);
-        int y = m_clusterizer.getY(i);
+    const int32_t width = m_inImageDesc.m_width;
+    const int32_t height = m_inImageDesc.m_height;
+    // clusters come largest first, so do targets
+    for (int i = 0; i < TRIK_MAX_TARGET_COUNT; i++) {
+      TargetObject& target = _outArgs.targets[i].out_target.targetObject;
+      memset(&target, 0, sizeof(target));
+
+      uint32_t area = m_clusterizer.getSize(i);
+      int size = targetSize(area);
+      if (size <= 4) // it's better to be about 0.5% of image
+        continue;
+
+      // refined area is counted in full resolution pixels, size and area both follow it
+      int32_t x = m_clusterizer.getX(i);
+      int32_t y = m_clusterizer.getY(i);
+      if (m_decimation > 1) {
+        const uint32_t points = refineTarget(_inImage, i, x, y);
+        if (points > 0) {
+          area = points / (METAPIX_SIZE * METAPIX_SIZE);
+          size = targetSize(area);
+        }
+      }
 
+      if (preview)
         drawFatPixel(x, y, _outImage, 0xff0000);
 
-        _outArgs.targets[i].out_target.targetLocation.size = size;
-        _outArgs.targets[i].out_target.targetLocation.x = ((x - static_cast<int32_t>(m_inImageDesc.m_width) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_width);
-        _outArgs.targets[i].out_target.targetLocation.y = ((y - static_cast<int32_t>(m_inImageDesc.m_height) / 2) * 100 * 2) / static_cast<int32_t>(m_inImageDesc.m_height);
-      }
-    }
-
-    if (noObjects) {
-      _outArgs.targets[0].out_target.targetLocation.x = 0;
-      _outArgs.targets[0].out_target.targetLocation.y = 0;
-      _outArgs.targets[0].out_target.targetLocation.size = 0;
+      int32_t left;
+      int32_t top;
+      int32_t right;
+      int32_t bottom;
+      m_clusterizer.getBox(i, left, top, right, bottom);
+
+      target.x = targetCoordinate(x, width);
+      target.y = targetCoordinate(y, height);
+      target.size = size;
+      target.left = targetCoordinate(left, width);
+      target.top = targetCoordinate(top, height);
+      target.right = targetCoordinate(right, width);
+      target.bottom = targetCoordinate(bottom, height);
+      target.area = area;
+      targetShape(i, target.orientation, target.elongation);
     }
 
-    Cache_wbInv(_outImage.m_ptr, _outImage.m_size, Cache_Type_ALL, TRUE);
-
     return true;
   }
 };
@@ -0,0 +1,379 @@
+#ifndef TRIK_SENSORS_PREVIEW_ENCODER_HPP_
+#define TRIK_SENSORS_PREVIEW_ENCODER_HPP_
+
+#ifndef __cplusplus
+#error C++-only header
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include <c6x.h>
+
+extern "C" {
+#include <ti/imglib/src/IMG_fdct_8x8/IMG_fdct_8x8.h>
+#include <ti/imglib/src/IMG_quantize/IMG_quantize.h>
+}
+
+#include "image.hpp"
+#include <trik/buffer.h>
+#include <trik/sensors/video_format.h>
+
+namespace trik {
+namespace sensors {
+
+// luma block is 8x8, chroma is subsampled 2x2, so a minimal coded unit is 16x16 pixels of 4 luma blocks, Cb and Cr
+#define JPEG_MCU_SIZE 16
+#define JPEG_MCUS_MAX (PREVIEW_WIDTH / JPEG_MCU_SIZE)
+#define JPEG_BLOCKS_PER_MCU 6
+// Q-point of quantizer reciprocals
+#define JPEG_QUANT_SHIFT 15
+// longest coded block is 64 coefficients of 16 + 11 bits, every byte of it stuffed
+#define JPEG_BLOCK_BYTES_MAX 448
+
+// natural index of every coefficient in zigzag order
+static const uint8_t s_jpegZigzag[64] = {
+  0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,  7,  14, 21, 28,
+  35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// quantization tables of JPEG Annex K for quality 50, in natural order
+static const uint8_t s_jpegLumaQuant[64] = {
+  16, 11, 10, 16, 24,  40,  51,  61,  12, 12, 14, 19, 26,  58,  60,  55,  14, 13, 16, 24, 40,  57,  69,  56,  14, 17, 22, 29, 51,  87,  80,  62,
+  18, 22, 37, 56, 68,  109, 103, 77,  24, 35, 55, 64, 81,  104, 113, 92,  49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+static const uint8_t s_jpegChromaQuant[64] = {
+  17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+// Huffman tables of JPEG Annex K: number of codes of every length 1..16, then symbols by code
+static const uint8_t s_jpegDcLumaBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t s_jpegDcChromaBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t s_jpegDcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t s_jpegAcLumaBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t s_jpegAcLumaValues[162] = {
+  0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+  0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+  0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+  0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+  0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+  0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+
+static const uint8_t s_jpegAcChromaBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t s_jpegAcChromaValues[162] = {
+  0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+  0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+  0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+  0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+  0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+  0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+  0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa,
+};
+
+/*
+  Baseline JPEG of the preview, for streaming it off the robot. Preview is read a row of 16x16
+  coded units at a time and converted to full swing YCbCr 4:2:0, chroma from the average of
+  every 2x2 pixels. IMG_fdct_8x8 and IMG_quantize then run on all blocks of the row at once,
+  and coefficients are Huffman coded with the tables of Annex K, so no optimization pass is needed.
+  Quality scales quantization tables the way IJG does, 50 takes those of Annex K.
+*/
+class PreviewEncoder {
+private:
+  // luma blocks of the row first, then Cb and Cr ones, so each group is quantized with one table
+  int16_t __attribute__((aligned(8))) m_blocks[JPEG_MCUS_MAX * JPEG_BLOCKS_PER_MCU * 64];
+  int16_t __attribute__((aligned(8))) m_lumaRecip[64];
+  int16_t __attribute__((aligned(8))) m_chromaRecip[64];
+  uint8_t m_lumaQuant[64];
+  uint8_t m_chromaQuant[64];
+  uint32_t m_quality;
+
+  // code in upper bits and its length in the low byte, by symbol
+  uint32_t m_dcHuff[2][12];
+  uint32_t m_acHuff[2][256];
+
+  uint8_t* m_out;
+  uint8_t* m_outEnd;
+  uint32_t m_bitBuf;
+  uint32_t m_bitCount;
+
+  static void buildHuff(const uint8_t* _bits, const uint8_t* _values, uint32_t* _huff) {
+    uint32_t code = 0;
+    uint32_t symbol = 0;
+    for (uint32_t length = 1; length <= 16; ++length) {
+      for (uint32_t idx = 0; idx < _bits[length - 1]; ++idx)
+        _huff[_values[symbol++]] = (code++ << 8) | length;
+      code <<= 1;
+    }
+  }
+
+  static void scaleQuant(const uint8_t* _base, const uint32_t _scale, uint8_t* _quant, int16_t* _recip) {
+    for (uint32_t idx = 0; idx < 64; ++idx) {
+      uint32_t quant = (_base[idx] * _scale + 50) / 100;
+      quant = quant < 1 ? 1 : quant > 255 ? 255 : quant;
+      _quant[idx] = quant;
+      // reciprocal of 1 does not fit, the one just below it rounds the same on quantized range
+      const uint32_t recip = ((1u << JPEG_QUANT_SHIFT) + quant / 2) / quant;
+      _recip[idx] = recip > 0x7fff ? 0x7fff : recip;
+    }
+  }
+
+  void setQuality(const uint32_t _quality) {
+    if (_quality == m_quality)
+      return;
+    m_quality = _quality;
+    const uint32_t scale = _quality < 50 ? 5000 / _quality : 200 - 2 * _quality;
+    scaleQuant(s_jpegLumaQuant, scale, m_lumaQuant, m_lumaRecip);
+    scaleQuant(s_jpegChromaQuant, scale, m_chromaQuant, m_chromaRecip);
+  }
+
+  void putByte(const uint32_t _byte) { *m_out++ = _byte; }
+
+  void put16(const uint32_t _word) {
+    putByte(_word >> 8);
+    putByte(_word & 0xff);
+  }
+
+  // Low _count bits of _bits, at most 16; fewer than 8 are ever left pending, so they fit
+  void __attribute__((always_inline)) putBits(const uint32_t _bits, const uint32_t _count) {
+    m_bitBuf = (m_bitBuf << _count) | (_bits & ((1u << _count) - 1));
+    m_bitCount += _count;
+    while (m_bitCount >= 8) {
+      m_bitCount -= 8;
+      const uint32_t byte = (m_bitBuf >> m_bitCount) & 0xff;
+      putByte(byte);
+      // 0xff in coded data is stuffed so it does not read as a marker
+      if (byte == 0xff)
+        putByte(0);
+    }
+  }
+
+  void __attribute__((always_inline)) putHuff(const uint32_t _huff) { putBits(_huff >> 8, _huff & 0xff); }
+
+  // Category of the value, then its bits, negative ones as one's complement
+  void __attribute__((always_inline)) putValue(const int32_t _value, const uint32_t* _huff, const uint32_t _run) {
+    const uint32_t magnitude = _value < 0 ? -_value : _value;
+    const uint32_t size = 32 - _lmbd(1, magnitude);
+    putHuff(_huff[(_run << 4) | size]);
+    putBits(_value < 0 ? _value - 1 : _value, size);
+  }
+
+  void encodeBlock(const int16_t* restrict _block, int32_t& _dcPred, const uint32_t* _dcHuff, const uint32_t* _acHuff) {
+    const int32_t dc = _block[0];
+    putValue(dc - _dcPred, _dcHuff, 0);
+    _dcPred = dc;
+
+    uint32_t run = 0;
+    for (uint32_t idx = 1; idx < 64; ++idx) {
+      int32_t coef = _block[s_jpegZigzag[idx]];
+      if (coef == 0) {
+        ++run;
+        continue;
+      }
+      // runs longer than 15 zeroes are split by ZRL
+      for (; run > 15; run -= 16)
+        putHuff(_acHuff[0xf0]);
+      // baseline AC has 10 bits at most, quality close to 100 may round past that
+      coef = coef < -1023 ? -1023 : coef > 1023 ? 1023 : coef;
+      putValue(coef, _acHuff, run);
+      run = 0;
+    }
+    if (run > 0)
+      putHuff(_acHuff[0x00]);
+  }
+
+  static uint32_t __attribute__((always_inline)) rgb565ToBgr(const uint32_t _rgb565) {
+    const uint32_t r = (_rgb565 >> 11) & 0x1f;
+    const uint32_t g = (_rgb565 >> 5) & 0x3f;
+    const uint32_t b = _rgb565 & 0x1f;
+    return ((b << 3) | (b >> 2)) | (((g << 2) | (g >> 4)) << 8) | (((r << 3) | (r >> 2)) << 16);
+  }
+
+  // pixel words hold B, G and R in bytes 0, 1 and 2, level shifted results are in [-128..127]
+  static int32_t __attribute__((always_inline)) bgrToY(const uint32_t _bgr) { return static_cast<int32_t>((_dotpu4(_bgr, 0x004d961d) + 128) >> 8) - 128; }
+  static int32_t __attribute__((always_inline)) bgrToCb(const uint32_t _bgr) { return (_dotpus4(_bgr, 0x00ead640) + 64) >> 7; }
+  static int32_t __attribute__((always_inline)) bgrToCr(const uint32_t _bgr) { return (_dotpus4(_bgr, 0x0040caf6) + 64) >> 7; }
+
+  // Converts 16 rows of the preview into blocks of the coded units, two rows at a time
+  void convertMcuRow(const ImageDesc& _desc, const ImageBuffer& _preview, const uint32_t _top, const uint32_t _mcus) {
+    int16_t* restrict lumaBlocks = m_blocks;
+    int16_t* restrict cbBlocks = m_blocks + _mcus * 4 * 64;
+    int16_t* restrict crBlocks = cbBlocks + _mcus * 64;
+
+#pragma MUST_ITERATE(8, 8, )
+    for (uint32_t row = 0; row < JPEG_MCU_SIZE; row += 2) {
+      const uint32_t* restrict upper = reinterpret_cast<const uint32_t*>(_preview.m_ptr + (_top + row) * _desc.m_lineLength);
+      const uint32_t* restrict lower = reinterpret_cast<const uint32_t*>(_preview.m_ptr + (_top + row + 1) * _desc.m_lineLength);
+      const uint32_t lumaRow = ((row / 8) * 2) * 64 + (row % 8) * 8;
+      const uint32_t chromaRow = (row / 2) * 8;
+
+#pragma MUST_ITERATE(8, , 8)
+      for (uint32_t col = 0; col < _desc.m_width; col += 2) {
+        const uint32_t upper2 = upper[col / 2];
+        const uint32_t lower2 = lower[col / 2];
+        const uint32_t bgr00 = rgb565ToBgr(upper2);
+        const uint32_t bgr01 = rgb565ToBgr(upper2 >> 16);
+        const uint32_t bgr10 = rgb565ToBgr(lower2);
+        const uint32_t bgr11 = rgb565ToBgr(lower2 >> 16);
+
+        const uint32_t mcu = col / JPEG_MCU_SIZE;
+        const uint32_t x = col % JPEG_MCU_SIZE;
+        int16_t* restrict luma = lumaBlocks + mcu * 4 * 64 + lumaRow + (x / 8) * 64 + x % 8;
+        luma[0] = bgrToY(bgr00);
+        luma[1] = bgrToY(bgr01);
+        luma[8] = bgrToY(bgr10);
+        luma[9] = bgrToY(bgr11);
+
+        const uint32_t bgr = _avgu4(_avgu4(bgr00, bgr01), _avgu4(bgr10, bgr11));
+        const uint32_t chroma = mcu * 64 + chromaRow + x / 2;
+        cbBlocks[chroma] = bgrToCb(bgr);
+        crBlocks[chroma] = bgrToCr(bgr);
+      }
+    }
+  }
+
+  void putQuantTable(const uint32_t _id, const uint8_t* _quant) {
+    putByte(_id);
+    for (uint32_t idx = 0; idx < 64; ++idx)
+      putByte(_quant[s_jpegZigzag[idx]]);
+  }
+
+  void putHuffTable(const uint32_t _classId, const uint8_t* _bits, const uint8_t* _values) {
+    putByte(_classId);
+    uint32_t count = 0;
+    for (uint32_t length = 0; length < 16; ++length) {
+      putByte(_bits[length]);
+      count += _bits[length];
+    }
+    for (uint32_t idx = 0; idx < count; ++idx)
+      putByte(_values[idx]);
+  }
+
+  void putHeaders(const uint32_t _width, const uint32_t _height) {
+    // SOI, then JFIF APP0 for decoders guessing the color space
+    put16(0xffd8);
+    put16(0xffe0);
+    put16(16);
+    putByte('J');
+    putByte('F');
+    putByte('I');
+    putByte('F');
+    putByte(0);
+    put16(0x0101);
+    putByte(0);
+    put16(1);
+    put16(1);
+    put16(0);
+
+    put16(0xffdb);
+    put16(2 + 2 * 65);
+    putQuantTable(0, m_lumaQuant);
+    putQuantTable(1, m_chromaQuant);
+
+    // SOF0: 8 bit samples, Y sampled 2x2 with table 0, Cb and Cr 1x1 with table 1
+    put16(0xffc0);
+    put16(8 + 3 * 3);
+    putByte(8);
+    put16(_height);
+    put16(_width);
+    putByte(3);
+    putByte(1);
+    putByte(0x22);
+    putByte(0);
+    putByte(2);
+    putByte(0x11);
+    putByte(1);
+    putByte(3);
+    putByte(0x11);
+    putByte(1);
+
+    put16(0xffc4);
+    put16(2 + 4 * 17 + 2 * sizeof(s_jpegDcValues) + sizeof(s_jpegAcLumaValues) + sizeof(s_jpegAcChromaValues));
+    putHuffTable(0x00, s_jpegDcLumaBits, s_jpegDcValues);
+    putHuffTable(0x10, s_jpegAcLumaBits, s_jpegAcLumaValues);
+    putHuffTable(0x01, s_jpegDcChromaBits, s_jpegDcValues);
+    putHuffTable(0x11, s_jpegAcChromaBits, s_jpegAcChromaValues);
+
+    // SOS of all three components, full spectral range
+    put16(0xffda);
+    put16(6 + 2 * 3);
+    putByte(3);
+    putByte(1);
+    putByte(0x00);
+    putByte(2);
+    putByte(0x11);
+    putByte(3);
+    putByte(0x11);
+    putByte(0);
+    putByte(63);
+    putByte(0);
+  }
+
+public:
+  PreviewEncoder() {
+    m_quality = 0;
+    buildHuff(s_jpegDcLumaBits, s_jpegDcValues, m_dcHuff[0]);
+    buildHuff(s_jpegDcChromaBits, s_jpegDcValues, m_dcHuff[1]);
+    buildHuff(s_jpegAcLumaBits, s_jpegAcLumaValues, m_acHuff[0]);
+    buildHuff(s_jpegAcChromaBits, s_jpegAcChromaValues, m_acHuff[1]);
+  }
+
+  /*
+    Encodes the top _desc.m_height rows of the RGB565 preview at quality [1..100].
+    Width and height have to be multiples of 16. Fails if JPEG does not fit _jpeg.
+  */
+  bool encode(const ImageDesc& _desc, const ImageBuffer& _preview, const uint32_t _quality, const ImageBuffer& _jpeg, uint32_t& _jpegSize) {
+    _jpegSize = 0;
+    if (_quality < 1 || _quality > 100 || _desc.m_format != VideoFormat::RGB565X)
+      return false;
+    if (_desc.m_width % JPEG_MCU_SIZE != 0 || _desc.m_width > JPEG_MCUS_MAX * JPEG_MCU_SIZE || _desc.m_height % JPEG_MCU_SIZE != 0)
+      return false;
+    if (_desc.m_lineLength * _desc.m_height > _preview.m_size || _jpeg.m_size < 1024)
+      return false;
+
+    setQuality(_quality);
+    m_out = reinterpret_cast<uint8_t*>(_jpeg.m_ptr);
+    m_outEnd = m_out + _jpeg.m_size;
+    m_bitBuf = 0;
+    m_bitCount = 0;
+    putHeaders(_desc.m_width, _desc.m_height);
+
+    const uint32_t mcus = _desc.m_width / JPEG_MCU_SIZE;
+    int32_t dcPred[3] = { 0, 0, 0 };
+    for (uint32_t top = 0; top < _desc.m_height; top += JPEG_MCU_SIZE) {
+      convertMcuRow(_desc, _preview, top, mcus);
+      IMG_fdct_8x8(m_blocks, mcus * JPEG_BLOCKS_PER_MCU);
+      IMG_quantize(m_blocks, mcus * 4, 64, m_lumaRecip, JPEG_QUANT_SHIFT);
+      IMG_quantize(m_blocks + mcus * 4 * 64, mcus * 2, 64, m_chromaRecip, JPEG_QUANT_SHIFT);
+
+      const int16_t* cbBlocks = m_blocks + mcus * 4 * 64;
+      const int16_t* crBlocks = cbBlocks + mcus * 64;
+      for (uint32_t mcu = 0; mcu < mcus; ++mcu) {
+        // room is checked once per coded unit rather than per byte
+        if (m_outEnd - m_out < JPEG_BLOCKS_PER_MCU * JPEG_BLOCK_BYTES_MAX + 4)
+          return false;
+        for (uint32_t block = 0; block < 4; ++block)
+          encodeBlock(m_blocks + (mcu * 4 + block) * 64, dcPred[0], m_dcHuff[0], m_acHuff[0]);
+        encodeBlock(cbBlocks + mcu * 64, dcPred[1], m_dcHuff[1], m_acHuff[1]);
+        encodeBlock(crBlocks + mcu * 64, dcPred[2], m_dcHuff[1], m_acHuff[1]);
+      }
+    }
+
+    // last byte is padded with ones
+    if (m_bitCount > 0)
+      putBits(0xff, 8 - m_bitCount);
+    put16(0xffd9);
+
+    _jpegSize = m_out - reinterpret_cast<uint8_t*>(_jpeg.m_ptr);
+    return true;
+  }
+};
+
+}
+}
+
+#endif
@@ -1,6 +1,9 @@
 #include <trik/sensors/cv_algorithms.h>
 
 #include <trik/sensors/cv_algorithms.hpp>
+#include <trik/sensors/frame_stats.hpp>
+#include <trik/sensors/input_converter.hpp>
+#include <trik/sensors/preview_encoder.hpp>
 #include <trik/sensors/video_format.h>
 
 namespace trik {
@@ -8,55 +11,221 @@ namespace sensors {
 
 int8_t fastRam[4096];
 
+/*
+  Working buffers of all sensors, reset when frame geometry changes. Size is the worst case of
+  every sensor set up on IMG_WIDTH_MAX x IMG_HEIGHT_MAX from a camera format that is converted:
+  shared HSV frame (4 bytes per pixel), NV16 frame of the converter (2), motion reference frame
+  and object class frame (1 each), YUV classifier table, and under 200KB of the rest - object
+  metapixel maps, Hough accumulators, row buffers and tables, alignment included. That is 2.6MB,
+  reported high-water mark is the check against it.
+  Arena has its own section so it can be placed apart from code and IPC buffers.
+*/
+#define ARENA_FRAME_BYTES_PER_PIXEL (sizeof(uint32_t) + 2 + 1 + 1)
+#define ARENA_SMALL_BUFFERS (200 * 1024)
+#define ARENA_SIZE (IMG_WIDTH_MAX * IMG_HEIGHT_MAX * ARENA_FRAME_BYTES_PER_PIXEL + YUV_CLASS_LUT_SIZE + ARENA_SMALL_BUFFERS)
+#pragma DATA_SECTION(".trik_arena")
+int8_t __attribute__((aligned(128))) arenaMem[ARENA_SIZE];
+Arena arena(arenaMem, sizeof(arenaMem));
+
 MotionSensorCvAlgorithm motionSensorCvAlgorithm;
 EdgeLineSensorCvAlgorithm edgeLineSensorCvAlgorithm;
 ObjectSensorCvAlgorithm objectSensorCvAlgorithm;
 LineSensorCvAlgorithm lineSensorCvAlgorithm;
 MxnSensorCvAlgorithm mxnSensorCvAlgorithm;
 
-extern "C" int trik_init_cv_algorithm(enum trik_cv_algorithm algorithm, enum VideoFormat video_format, uint32_t line_length) {
-  ImageDesc inDesc = {
-    .m_width = IMG_WIDTH,
-    .m_height = IMG_HEIGHT,
-    .m_lineLength = line_length,
-    .m_format = video_format,
-  };
-  ImageDesc outDesc = {
-    .m_width = IMG_HEIGHT,
-    .m_height = IMG_WIDTH,
-    .m_lineLength = IMG_HEIGHT * 2,
-    .m_format = VideoFormat::RGB565X,
-  };
+// converted frame is shared by the sensors of the set, the first one to run converts it
+InputConverter inputConverter;
+static bool inputConverting = false;
+static bool inputConverted = false;
+static ImageBuffer convertedIn = { NULL, 0 };
+
+FrameStats frameStats;
+PreviewEncoder previewEncoder;
+
+static CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>* cvAlgorithm(enum trik_cv_algorithm algorithm) {
   if (algorithm == TRIK_CV_ALGORITHM_MOTION_SENSOR)
-    return motionSensorCvAlgorithm.setup(inDesc, outDesc, fastRam, sizeof(fastRam) / sizeof(fastRam[0]));
+    return &motionSensorCvAlgorithm;
   else if (algorithm == TRIK_CV_ALGORITHM_EDGE_LINE_SENSOR)
-    return edgeLineSensorCvAlgorithm.setup(inDesc, outDesc, fastRam, sizeof(fastRam) / sizeof(fastRam[0]));
+    return &edgeLineSensorCvAlgorithm;
   else if (algorithm == TRIK_CV_ALGORITHM_OBJECT_SENSOR)
-    return objectSensorCvAlgorithm.setup(inDesc, outDesc, fastRam, sizeof(fastRam) / sizeof(fastRam[0]));
+    return &objectSensorCvAlgorithm;
   else if (algorithm == TRIK_CV_ALGORITHM_LINE_SENSOR)
-    return lineSensorCvAlgorithm.setup(inDesc, outDesc, fastRam, sizeof(fastRam) / sizeof(fastRam[0]));
+    return &lineSensorCvAlgorithm;
   else if (algorithm == TRIK_CV_ALGORITHM_MXN_SENSOR)
-    return mxnSensorCvAlgorithm.setup(inDesc, outDesc, fastRam, sizeof(fastRam) / sizeof(fastRam[0]));
+    return &mxnSensorCvAlgorithm;
   else
+    return NULL;
+}
+
+/*
+  Every sensor is set up once for the frame geometry, so switching the set is only a matter
+  of selecting other ones. Sensors of a set run one after another on the same frame. Only
+  the primary one draws the preview, the others run with video_out cleared and never touch it.
+*/
+static ImageDesc setupInDesc = { 0, 0, 0, VideoFormat::Unknown };
+// what sensors were set up with, NV16 if the camera format is converted
+static ImageDesc sensorInDesc = { 0, 0, 0, VideoFormat::Unknown };
+static uint32_t readyAlgorithms = 0;
+static enum trik_cv_algorithm primaryAlgorithm = TRIK_CV_ALGORITHM_NONE;
+static uint32_t secondaryAlgorithms = 0;
+
+static void setupCvAlgorithms(const ImageDesc& inDesc) {
+  ImageDesc outDesc = {
+    .m_width = PREVIEW_WIDTH,
+    .m_height = PREVIEW_HEIGHT,
+    .m_lineLength = PREVIEW_WIDTH * 2,
+    .m_format = VideoFormat::RGB565X,
+  };
+
+  // buffers of the previous geometry are dropped
+  arena.reset();
+  CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>::releaseFrameBuffers();
+  setupInDesc = inDesc;
+  readyAlgorithms = 0;
+  primaryAlgorithm = TRIK_CV_ALGORITHM_NONE;
+  secondaryAlgorithms = 0;
+
+  inputConverting = false;
+  inputConverted = false;
+
+  sensorInDesc = inDesc;
+  if (!InputConverter::isNative(inDesc.m_format)) {
+    if (!inputConverter.setup(inDesc, arena))
+      return;
+    inputConverting = true;
+    sensorInDesc = inputConverter.outDesc();
+  }
+
+  // sensor failing to set up, e.g. on geometry it does not support, is just not selectable
+  for (int algorithm = 0; algorithm < TRIK_CV_ALGORITHM_COUNT; ++algorithm) {
+    CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>* cvAlgorithmToSetup = cvAlgorithm(static_cast<enum trik_cv_algorithm>(algorithm));
+    if (cvAlgorithmToSetup != NULL && cvAlgorithmToSetup->setup(sensorInDesc, outDesc, fastRam, sizeof(fastRam) / sizeof(fastRam[0]), arena))
+      readyAlgorithms |= TRIK_CV_ALGORITHM_BIT(algorithm);
+  }
+}
+
+static bool isReadySet(const enum trik_cv_algorithm primary, const uint32_t secondary) {
+  return primary != TRIK_CV_ALGORITHM_NONE && (readyAlgorithms & TRIK_CV_ALGORITHM_BIT(primary)) != 0 && (secondary & ~readyAlgorithms) == 0;
+}
+
+/*
+  Arguments are checked before anything is torn down. On the same geometry a rejected set leaves
+  the current one running. A new geometry sets every sensor up again, so a rejected set falls back
+  to the previous one if that is ready on it, and leaves none running otherwise.
+*/
+extern "C" int trik_init_cv_algorithms(enum trik_cv_algorithm primary, uint32_t secondary, enum VideoFormat video_format, uint32_t width, uint32_t height,
+  uint32_t line_length) {
+  if (primary <= TRIK_CV_ALGORITHM_NONE || primary >= TRIK_CV_ALGORITHM_COUNT || (secondary >> TRIK_CV_ALGORITHM_COUNT) != 0
+      || !trik_is_supported_frame_size(width, height))
+    return 0;
+  secondary &= ~TRIK_CV_ALGORITHM_BIT(primary);
+
+  ImageDesc inDesc = {
+    .m_width = width,
+    .m_height = height,
+    .m_lineLength = line_length,
+    .m_format = video_format,
+  };
+  if (inDesc.m_width != setupInDesc.m_width || inDesc.m_height != setupInDesc.m_height || inDesc.m_lineLength != setupInDesc.m_lineLength
+      || inDesc.m_format != setupInDesc.m_format) {
+    const enum trik_cv_algorithm wasPrimary = primaryAlgorithm;
+    const uint32_t wasSecondary = secondaryAlgorithms;
+    setupCvAlgorithms(inDesc);
+    if (!isReadySet(primary, secondary)) {
+      if (isReadySet(wasPrimary, wasSecondary)) {
+        primaryAlgorithm = wasPrimary;
+        secondaryAlgorithms = wasSecondary;
+      }
+      return 0;
+    }
+  }
+
+  if (!isReadySet(primary, secondary))
     return 0;
+
+  // state carried between frames of a sensor just selected is stale
+  const uint32_t selected = TRIK_CV_ALGORITHM_BIT(primary) | secondary;
+  const uint32_t wasSelected = primaryAlgorithm == TRIK_CV_ALGORITHM_NONE ? 0 : (TRIK_CV_ALGORITHM_BIT(primaryAlgorithm) | secondaryAlgorithms);
+  for (int algorithm = 0; algorithm < TRIK_CV_ALGORITHM_COUNT; ++algorithm)
+    if ((selected & ~wasSelected) & TRIK_CV_ALGORITHM_BIT(algorithm))
+      cvAlgorithm(static_cast<enum trik_cv_algorithm>(algorithm))->restart();
+
+  primaryAlgorithm = primary;
+  secondaryAlgorithms = secondary;
+  return 1;
+}
+
+extern "C" void trik_get_cv_algorithms(enum trik_cv_algorithm* primary, uint32_t* secondary) {
+  *primary = primaryAlgorithm;
+  *secondary = secondaryAlgorithms;
+}
+
+// Frame the sensors run on, converted by the first one asking for it
+static ImageBuffer sensorInput(const ImageBuffer& inBuffer) {
+  if (!inputConverting)
+    return inBuffer;
+  if (!inputConverted) {
+    convertedIn = inputConverter.convert(inBuffer);
+    inputConverted = true;
+  }
+  return convertedIn;
+}
+
+extern "C" void trik_begin_cv_frame(void) {
+  s_featureCache.nextFrame();
+  inputConverted = false;
+}
+
+extern "C" void trik_get_cv_algorithm_arena(uint32_t* used, uint32_t* high_water, uint32_t* size) {
+  *used = arena.used();
+  *high_water = arena.highWater();
+  *size = arena.size();
+}
+
+extern "C" void trik_get_cv_algorithm_out_dirty(enum trik_cv_algorithm algorithm, uint32_t* offset, uint32_t* size) {
+  CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>* active = cvAlgorithm(algorithm);
+  if (active == NULL || algorithm != primaryAlgorithm) {
+    *offset = 0;
+    *size = 0;
+    return;
+  }
+  active->getOutputDirty(*offset, *size);
 }
 
 extern "C" int trik_run_cv_algorithm(enum trik_cv_algorithm algorithm, struct buffer in_buffer, struct buffer out_buffer,
   struct trik_cv_algorithm_in_args in_args, struct trik_cv_algorithm_out_args* out_args) {
   ImageBuffer inBuffer = { .m_ptr = (int8_t*) in_buffer.start, .m_size = in_buffer.length };
   ImageBuffer outBuffer = { .m_ptr = (int8_t*) out_buffer.start, .m_size = out_buffer.length };
-  if (algorithm == TRIK_CV_ALGORITHM_MOTION_SENSOR)
-    return motionSensorCvAlgorithm.run(inBuffer, outBuffer, in_args, *out_args);
-  else if (algorithm == TRIK_CV_ALGORITHM_EDGE_LINE_SENSOR)
-    return edgeLineSensorCvAlgorithm.run(inBuffer, outBuffer, in_args, *out_args);
-  else if (algorithm == TRIK_CV_ALGORITHM_OBJECT_SENSOR)
-    return objectSensorCvAlgorithm.run(inBuffer, outBuffer, in_args, *out_args);
-  else if (algorithm == TRIK_CV_ALGORITHM_LINE_SENSOR)
-    return lineSensorCvAlgorithm.run(inBuffer, outBuffer, in_args, *out_args);
-  else if (algorithm == TRIK_CV_ALGORITHM_MXN_SENSOR)
-    return mxnSensorCvAlgorithm.run(inBuffer, outBuffer, in_args, *out_args);
-  else
+  if (algorithm != primaryAlgorithm && (secondaryAlgorithms & TRIK_CV_ALGORITHM_BIT(algorithm)) == 0)
     return 0;
+
+  CvAlgorithm<VideoFormat::YUV422, VideoFormat::RGB565X>* active = cvAlgorithm(algorithm);
+  if (active == NULL)
+    return 0;
+
+  active->resetOutputDirty();
+  return active->run(sensorInput(inBuffer), outBuffer, in_args, *out_args);
+}
+
+extern "C" int trik_get_cv_frame_stats(struct buffer in_buffer, struct trik_frame_stats* stats) {
+  ImageBuffer inBuffer = { .m_ptr = (int8_t*) in_buffer.start, .m_size = in_buffer.length };
+  if (primaryAlgorithm == TRIK_CV_ALGORITHM_NONE) {
+    memset(stats, 0, sizeof(*stats));
+    return 0;
+  }
+  return frameStats.collect(sensorInDesc, sensorInput(inBuffer), *stats);
+}
+
+extern "C" int trik_encode_cv_preview(struct buffer out_buffer, uint32_t quality, struct buffer jpeg_buffer, uint32_t* jpeg_size) {
+  const ImageDesc previewDesc = {
+    .m_width = PREVIEW_WIDTH,
+    .m_height = PREVIEW_JPEG_HEIGHT,
+    .m_lineLength = PREVIEW_WIDTH * 2,
+    .m_format = VideoFormat::RGB565X,
+  };
+  const ImageBuffer preview = { .m_ptr = (int8_t*) out_buffer.start, .m_size = out_buffer.length };
+  const ImageBuffer jpeg = { .m_ptr = (int8_t*) jpeg_buffer.start, .m_size = jpeg_buffer.length };
+  return previewEncoder.encode(previewDesc, preview, quality, jpeg, *jpeg_size);
 }
 
 }
@@ -9,12 +9,15 @@
 #include <xdc/runtime/Registry.h>
 #include <xdc/std.h>
 
+#include <c6x.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <ti/ipc/MessageQ.h>
 #include <ti/ipc/MultiProc.h>
 
 #include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/family/c64p/Cache.h>
 #include <ti/sysbios/knl/Task.h>
 
 #include <trik/buffer.h>
@@ -23,8 +26,9 @@
 #include <trik/sensors/cv_algorithms.h>
 #include <trik/sensors/msg.h>
 
-int8_t __attribute__((aligned(128))) out_buff[BUFFER_SIZE];
+int8_t __attribute__((aligned(128))) out_buff[PREVIEW_BUFFER_SIZE];
 int8_t __attribute__((aligned(128))) in_buff[BUFFER_SIZE];
+int8_t __attribute__((aligned(128))) jpeg_buff[PREVIEW_JPEG_BUFFER_SIZE];
 
 typedef struct {
   UInt16 hostProcId;
@@ -35,9 +39,18 @@ Registry_Desc Registry_CURDESC;
 static Server_Module Module;
 
 static enum trik_cv_algorithm cv_algorithm = TRIK_CV_ALGORITHM_NONE;
-
+static uint32_t cv_secondary = 0;
+
+/*
+  Buffers are shared with ARM, which writes input frame and reads output preview bypassing DSP cache.
+  Input is owned by DSP from step request and is invalidated before the run; output is owned by ARM
+  from step reply, so rows written by the run are written back before replying. JPEG of the preview
+  is owned the same way as the preview.
+*/
 static struct buffer in_buffer;
 static struct buffer out_buffer;
+static struct buffer jpeg_buffer;
+static size_t in_frame_size = 0;
 
 enum trik_cv_algorithm trik_cv_algorithm_from_cmd(enum trik_cmd cmd) {
   if (cmd == TRIK_CMD_MOTION_SENSOR)
@@ -115,11 +128,18 @@ static int trik_res_msg(struct trik_msg* msg) {
   return 0;
 }
 
+static int trik_put_msg(MessageQ_QueueId queId, struct trik_msg* msg) {
+  if (MessageQ_put(queId, (MessageQ_Msg) msg) < 0)
+    return -1;
+  return 0;
+}
+
 static int trik_handle_init(struct trik_msg* req) {
   struct trik_res_init_msg* res = (struct trik_res_init_msg*) req;
 
   res->dsp_in_buffer = in_buffer.start;
   res->dsp_out_buffer = out_buffer.start;
+  res->dsp_jpeg_buffer = jpeg_buffer.start;
 
   if (trik_res_msg((struct trik_msg*) res) < 0) {
     Log_print0(Diags_INFO, "trik_handle_init(): unable to send ack with buffers");
@@ -128,16 +148,41 @@ static int trik_handle_init(struct trik_msg* req) {
   return 0;
 }
 
+/*
+  Sensor request is sent at start and again between steps to switch the set of sensors, on the
+  same frame geometry it only selects already set up ones. A rejected set is replied with NOP
+  command; what keeps running then is decided by trik_init_cv_algorithms() and taken from it,
+  frames are of the requested geometry either way.
+*/
 static int trik_handle_sensor(struct trik_req_cv_algorithm_msg* req) {
-  cv_algorithm = trik_cv_algorithm_from_cmd(req->header.cmd);
+  enum trik_cv_algorithm algorithm = trik_cv_algorithm_from_cmd(req->header.cmd);
+  uint32_t secondary = algorithm == TRIK_CV_ALGORITHM_NONE ? req->secondary : req->secondary & ~TRIK_CV_ALGORITHM_BIT(algorithm);
 
   struct trik_msg* res = (struct trik_msg*) req;
 
-  if (!trik_init_cv_algorithm(cv_algorithm, req->video_format, req->line_length)) {
-    Log_print1(Diags_INFO, "trik_handle_sensor(): unable to initialize cv algorithm %x", cv_algorithm);
-    return -1;
+  // NV16 has chroma plane of the same size after luma one, YUV422P has two of half the size
+  in_frame_size = req->line_length * req->height;
+  if (req->video_format == NV16 || req->video_format == YUV422P)
+    in_frame_size *= 2;
+  if (in_frame_size > in_buffer.length)
+    in_frame_size = in_buffer.length;
+
+  const int initialized = trik_init_cv_algorithms(algorithm, secondary, req->video_format, req->width, req->height, req->line_length);
+  trik_get_cv_algorithms(&cv_algorithm, &cv_secondary);
+  if (!initialized) {
+    Log_print4(Diags_INFO, "trik_handle_sensor(): unable to initialize cv algorithm %x with %x, running %d with %x", algorithm, secondary, cv_algorithm,
+      cv_secondary);
+    res->cmd = TRIK_CMD_NOP;
+  } else {
+    Log_print4(Diags_INFO, "trik_handle_sensor(): Initialized %d algorithm with %x for %dx%d", cv_algorithm, cv_secondary, req->width, req->height);
+
+    // preview of the previous sensor may cover other rows, start from a blank one
+    memset(out_buffer.start, 0, out_buffer.length);
+    Cache_wb(out_buffer.start, out_buffer.length, Cache_Type_ALL, TRUE);
   }
-  Log_print1(Diags_INFO, "trik_handle_sensor(): Initialized %d algorithm", cv_algorithm);
+
+  trik_get_cv_algorithm_arena(&req->arena_used, &req->arena_high_water, &req->arena_size);
+  Log_print3(Diags_INFO, "trik_handle_sensor(): arena %d bytes used, high-water %d of %d", req->arena_used, req->arena_high_water, req->arena_size);
 
   if (trik_res_msg(res) < 0) {
     Log_print0(Diags_INFO, "trik_handle_sensor(): unable to send ack about setting up motion sensor algo");
@@ -147,18 +192,116 @@ static int trik_handle_sensor(struct trik_req_cv_algorithm_msg* req) {
   return 0;
 }
 
+/*
+  Secondary algorithms of the set run after the primary one has replied, each replies with a
+  message of its own allocated here. ARM waits for all of them before it takes the preview,
+  which only the primary one draws: secondary ones run with video_out cleared. One failing to
+  run still replies, with empty out args, so ARM gets the count it waits for.
+*/
+static uint32_t trik_secondary_count(void) {
+  uint32_t count = 0;
+  int algorithm;
+
+  for (algorithm = 0; algorithm < TRIK_CV_ALGORITHM_COUNT; ++algorithm)
+    if (cv_secondary & TRIK_CV_ALGORITHM_BIT(algorithm))
+      ++count;
+  return count;
+}
+
+static int trik_run_secondary(MessageQ_QueueId queId, const struct trik_cv_algorithm_in_args* in_args) {
+  uint32_t pending = trik_secondary_count();
+  int algorithm;
+
+  for (algorithm = 0; algorithm < TRIK_CV_ALGORITHM_COUNT; ++algorithm) {
+    if ((cv_secondary & TRIK_CV_ALGORITHM_BIT(algorithm)) == 0)
+      continue;
+
+    struct trik_res_step_msg* res = (struct trik_res_step_msg*) MessageQ_alloc(TRIK_MSG_HEAP_ID, TRIK_MSG_SIZE);
+    if (res == NULL)
+      return -1;
+
+    res->header.cmd = TRIK_CMD_STEP;
+    res->in_args = *in_args;
+    res->in_args.video_out = false;
+    res->in_args.preview_jpeg = 0;
+    memset(&res->timings, 0, sizeof(res->timings));
+
+    const uint32_t start = TSCL;
+    if (!trik_run_cv_algorithm((enum trik_cv_algorithm) algorithm, in_buffer, out_buffer, res->in_args, &(res->out_args))) {
+      Log_print1(Diags_INFO, "trik_run_secondary(): unable to run cv algorithm %d", algorithm);
+      memset(&res->out_args, 0, sizeof(res->out_args));
+    }
+    res->timings.run = TSCL - start;
+    memset(&res->stats, 0, sizeof(res->stats));
+    res->jpeg_size = 0;
+    res->algorithm = (enum trik_cv_algorithm) algorithm;
+    res->pending = --pending;
+
+    if (trik_put_msg(queId, (struct trik_msg*) res) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 static int trik_handle_step(struct trik_msg* req) {
   struct trik_res_step_msg* res = (struct trik_res_step_msg*) req;
-
-  if (!trik_run_cv_algorithm(cv_algorithm, in_buffer, out_buffer, res->in_args, &(res->out_args))) {
-    Log_print0(Diags_INFO, "trik_handle_step(): unable to run cv algorithm");
-    return -1;
+  const MessageQ_QueueId queId = MessageQ_getReplyQueue(req);
+  const struct trik_cv_algorithm_in_args in_args = res->in_args;
+  uint32_t dirty_offset;
+  uint32_t dirty_size;
+
+  trik_begin_cv_frame();
+
+  const uint32_t start = TSCL;
+  Cache_inv(in_buffer.start, in_frame_size, Cache_Type_ALL, TRUE);
+  const uint32_t invalidated = TSCL;
+
+  // failed step is still replied, with empty out args and no preview, it does not stop the server
+  const int ran = trik_run_cv_algorithm(cv_algorithm, in_buffer, out_buffer, res->in_args, &(res->out_args));
+  if (!ran) {
+    Log_print1(Diags_INFO, "trik_handle_step(): unable to run cv algorithm %d", cv_algorithm);
+    memset(&res->out_args, 0, sizeof(res->out_args));
+  }
+  const uint32_t processed = TSCL;
+
+  // write back is started before reply is filled and waited for right before sending it
+  trik_get_cv_algorithm_out_dirty(cv_algorithm, &dirty_offset, &dirty_size);
+  if (dirty_size > 0)
+    Cache_wb((int8_t*) out_buffer.start + dirty_offset, dirty_size, Cache_Type_ALL, FALSE);
+
+  // preview is read for JPEG from the cache, write back does not drop it
+  res->jpeg_size = 0;
+  if (ran && in_args.video_out && in_args.preview_jpeg > 0) {
+    if (trik_encode_cv_preview(out_buffer, in_args.preview_jpeg, jpeg_buffer, &res->jpeg_size))
+      Cache_wb(jpeg_buffer.start, res->jpeg_size, Cache_Type_ALL, FALSE);
+    else
+      Log_print0(Diags_INFO, "trik_handle_step(): unable to encode preview");
   }
+  const uint32_t encoded = TSCL;
+
+  // sampled frame statistics are collected while the preview is being written back
+  if (!in_args.frame_stats || !trik_get_cv_frame_stats(in_buffer, &res->stats))
+    memset(&res->stats, 0, sizeof(res->stats));
+
+  res->timings.cache_inv = invalidated - start;
+  res->timings.run = processed - invalidated;
+  res->timings.jpeg = encoded - processed;
+  res->timings.wb_bytes = dirty_size + res->jpeg_size;
+  res->algorithm = cv_algorithm;
+  res->pending = trik_secondary_count();
+
+  Cache_wait();
+  res->timings.cache_wb = TSCL - processed;
 
   if (trik_res_msg((struct trik_msg*) res) < 0) {
     Log_print0(Diags_INFO, "trik_handle_step(): unable to send ack about step");
     return -1;
   }
+
+  if (trik_run_secondary(queId, &in_args) < 0) {
+    Log_print0(Diags_INFO, "trik_handle_step(): unable to run secondary cv algorithms");
+    return -1;
+  }
   return 0;
 }
 
@@ -172,7 +315,12 @@ Int trik_start_dsp_server(Void) {
   in_buffer.start = (void*) &in_buff;
   in_buffer.length = BUFFER_SIZE;
   out_buffer.start = (void*) &out_buff;
-  out_buffer.length = BUFFER_SIZE;
+  out_buffer.length = PREVIEW_BUFFER_SIZE;
+  jpeg_buffer.start = (void*) &jpeg_buff;
+  jpeg_buffer.length = PREVIEW_JPEG_BUFFER_SIZE;
+
+  // time stamp counter runs once written to
+  TSCL = 0;
 
   while (running) {
     status = trik_wait_for_msg(&msg);
@@ -6,12 +6,29 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 
-// TEMP
-#define IMG_WIDTH 320
-#define IMG_HEIGHT 240
-#define BUFFER_SIZE (IMG_WIDTH * IMG_HEIGHT * 2)
-#define BUFFER_SIZE_FOR_FB ((IMG_WIDTH * IMG_HEIGHT * 2) * (240.0 / 320.0))
+// largest supported frame, DSP input buffer is sized for it
+#define IMG_WIDTH_MAX 640
+#define IMG_HEIGHT_MAX 480
+#define BUFFER_SIZE (IMG_WIDTH_MAX * IMG_HEIGHT_MAX * 2)
+
+// preview is drawn rotated for 240x320 display whatever the input resolution is
+#define PREVIEW_WIDTH 240
+#define PREVIEW_HEIGHT 320
+#define PREVIEW_BUFFER_SIZE (PREVIEW_WIDTH * PREVIEW_HEIGHT * 2)
+// top rows of the preview are shown on the display
+#define PREVIEW_FB_HEIGHT 240
+#define BUFFER_SIZE_FOR_FB (PREVIEW_WIDTH * PREVIEW_FB_HEIGHT * 2)
+
+// preview rows shown on the display are the ones streamed as JPEG, its buffer is shared with ARM as well
+#define PREVIEW_JPEG_HEIGHT PREVIEW_FB_HEIGHT
+#define PREVIEW_JPEG_BUFFER_SIZE (128 * 1024)
+
+// 160x120, 320x240 and 640x480
+static inline int trik_is_supported_frame_size(uint32_t width, uint32_t height) {
+  return (width == 160 && height == 120) || (width == 320 && height == 240) || (width == 640 && height == 480);
+}
 
 struct buffer {
   void *start;
@@ -14,10 +14,13 @@ enum trik_cv_algorithm {
   TRIK_CV_ALGORITHM_EDGE_LINE_SENSOR,
   TRIK_CV_ALGORITHM_LINE_SENSOR,
   TRIK_CV_ALGORITHM_OBJECT_SENSOR,
-  TRIK_CV_ALGORITHM_MXN_SENSOR
-
+  TRIK_CV_ALGORITHM_MXN_SENSOR,
+  TRIK_CV_ALGORITHM_COUNT
 };
 
+// sets of algorithms running on the same frame are masks of these
+#define TRIK_CV_ALGORITHM_BIT(algorithm) (1u << (algorithm))
+
 #if defined(__cplusplus)
 }
 #endif
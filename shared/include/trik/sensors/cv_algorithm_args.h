@@ -20,6 +20,29 @@ typedef struct MxnParams
   size_t m_n;
 } MxnParams;
 
+/*
+  Processing window, bounds are in percent of the frame, [left..right) x [top..bottom).
+  All zeroes means the whole frame. Sensors which look at separate rows (line sensor) also
+  skip rows according to row_step, 0 and 1 mean every row.
+*/
+typedef struct RoiParams
+{
+  uint16_t left;     // [0..100]
+  uint16_t top;      // [0..100]
+  uint16_t right;    // [0..100]
+  uint16_t bottom;   // [0..100]
+  uint16_t row_step; // [0..]
+} RoiParams;
+
+// Binary morphology of detected metapixels, applied before object sensor clusters them
+enum trik_morphology {
+  TRIK_MORPHOLOGY_NONE = 0,
+  TRIK_MORPHOLOGY_ERODE,
+  TRIK_MORPHOLOGY_DILATE,
+  TRIK_MORPHOLOGY_OPEN,  // erode, then dilate: drops specks
+  TRIK_MORPHOLOGY_CLOSE  // dilate, then erode: fills holes
+};
+
 typedef struct trik_cv_algorithm_in_args {
   uint16_t detect_hue_from; // [0..359]
   uint16_t detect_hue_to;   // [0..359]
@@ -28,6 +51,12 @@ typedef struct trik_cv_algorithm_in_args {
   uint8_t detect_val_from;  // [0..100]
   uint8_t detect_val_to;    // [0..100]
   bool auto_detect_hsv;     // [true|false]
+  bool video_out;           // [true|false] preview image is requested
+  RoiParams roi;
+  uint8_t decimation;       // [0|1|2|4] every n-th pixel and row is processed, 0 and 1 mean full resolution
+  bool frame_stats;         // [true|false] statistics of the input frame are requested
+  uint8_t morphology;       // [0..4] trik_morphology of detected metapixels
+  uint8_t preview_jpeg;     // [0..100] JPEG quality the preview is encoded with, 0 means it is not, needs video_out
 
   union {
     MxnParams mxnParams;
@@ -46,15 +75,39 @@ typedef struct TargetLocation
   uint16_t size;
 } TargetLocation;
 
+typedef struct TargetLine
+{
+  int16_t angle;    // [-90..89] degrees, 0 is vertical line
+  int16_t offset;   // signed distance from image center, [-100..100] at image border
+  uint16_t support; // number of points on the line
+} TargetLine;
+
+// Object sensor target, starts the same way TargetLocation does
+typedef struct TargetObject
+{
+  int16_t x;
+  int16_t y;
+  uint16_t size;
+  int16_t left;         // bounding box, [-100..100] like x and y
+  int16_t top;
+  int16_t right;
+  int16_t bottom;
+  uint16_t area;        // in metapixels, 0 for no target
+  int16_t orientation;  // [-90..89] degrees of the major axis normal, 0 is vertical object, like TargetLine
+  uint16_t elongation;  // major to minor axis ratio, percent
+} TargetObject;
+
 typedef struct trik_cv_algorithm_out_target {
   union {
     TargetLocation targetLocation;
     TargetColors targetColors;
+    TargetObject targetObject;
   } out_target;
 } trik_cv_algorithm_out_target;
 
 typedef struct trik_cv_algorithm_out_args {
   struct trik_cv_algorithm_out_target targets[TRIK_MAX_TARGET_COUNT];
+  TargetLine lines[TRIK_MAX_TARGET_COUNT];
   uint16_t detect_hue_from; // [0..359]
   uint16_t detect_hue_to;   // [0..359]
   uint8_t detect_sat_from;  // [0..100]
@@ -63,6 +116,24 @@ typedef struct trik_cv_algorithm_out_args {
   uint8_t detect_val_to;    // [0..100]
 } trik_cv_algorithm_out_args;
 
+/*
+  Luma and chroma statistics of the input frame, taken from a sparse grid of pixels.
+  Shares are in 1/255 of the samples, chroma is in YUV units centered at 128.
+*/
+#define TRIK_LUMA_HIST_BINS 16
+
+typedef struct trik_frame_stats {
+  uint8_t luma_hist[TRIK_LUMA_HIST_BINS]; // share of samples in every 16 levels of luma
+  uint8_t luma_mean;
+  uint8_t luma_low;    // 5th percentile
+  uint8_t luma_median;
+  uint8_t luma_high;   // 95th percentile
+  uint8_t u_mean;
+  uint8_t v_mean;
+  uint8_t chroma_mean; // mean of the larger of |U-128| and |V-128|
+  uint16_t samples;    // 0 if statistics were not collected
+} trik_frame_stats;
+
 #if defined(__cplusplus)
 }
 #endif
@@ -6,6 +6,7 @@ extern "C" {
 #endif
 
 #include "cmd.h"
+#include "cv_algorithm.h"
 #include "cv_algorithm_args.h"
 #include <trik/sensors/video_format.h>
 
@@ -19,12 +20,31 @@ struct trik_res_init_msg {
 
   void* dsp_in_buffer;
   void* dsp_out_buffer;
+  void* dsp_jpeg_buffer;
 };
 
 struct trik_req_cv_algorithm_msg {
   struct trik_msg header;
   enum VideoFormat video_format;
+  uint32_t width;
+  uint32_t height;
   uint32_t line_length;
+  // mask of TRIK_CV_ALGORITHM_BIT run on the same frames after the one of cmd
+  uint32_t secondary;
+
+  // filled in reply: working memory arena use after init, in bytes
+  uint32_t arena_used;
+  uint32_t arena_high_water;
+  uint32_t arena_size;
+};
+
+// DSP cycles spent on stages of a step, filled in reply
+struct trik_step_timings {
+  uint32_t cache_inv; // invalidating input frame
+  uint32_t run;       // cv algorithm
+  uint32_t jpeg;      // encoding the preview, while its dirty rows are written back
+  uint32_t cache_wb;  // writing back dirty rows of the output and JPEG, frame statistics are collected meanwhile
+  uint32_t wb_bytes;  // size of the written back ranges
 };
 
 struct trik_res_step_msg {
@@ -32,6 +52,18 @@ struct trik_res_step_msg {
 
   struct trik_cv_algorithm_out_args out_args;
   struct trik_cv_algorithm_in_args in_args;
+  struct trik_step_timings timings;
+  // of the input frame, filled in reply of the primary algorithm when in args request them
+  struct trik_frame_stats stats;
+  // of the preview JPEG in the buffer of init reply, filled in reply of the primary algorithm, 0 if it was not requested or failed
+  uint32_t jpeg_size;
+
+  /*
+    Every algorithm of the set replies with its own message, the primary one first in the
+    request message. Pending is the number of replies of the same step still to come.
+  */
+  enum trik_cv_algorithm algorithm;
+  uint32_t pending;
 };
 
 #define max(a, b) (((a) > (b)) ? (a) : (b))
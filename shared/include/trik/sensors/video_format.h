@@ -11,7 +11,7 @@ extern "C" {
 enum VideoFormat { 
     Unknown = 0, 
     RGB888, 
-    RGB888HSV,
+    HSV888,
     RGB565, 
     RGB565X, 
     YUV444,